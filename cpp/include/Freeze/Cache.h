@@ -9,17 +9,63 @@
 
 #include <IceUtil/IceUtil.h>
 #include <IceUtil/CountDownLatch.h>
+#include <Ice/Identity.h>
 #include <map>
 
 namespace Freeze
 {
 
+//
+// Hash function used by Cache to select the shard of a key. Cache
+// provides specializations for std::string and Ice::Identity; other key
+// types use a single shard unless they provide their own specialization.
+//
+template<typename Key>
+struct CacheKeyHash
+{
+    size_t operator()(const Key&) const
+    {
+        return 0;
+    }
+};
+
+template<>
+struct CacheKeyHash<std::string>
+{
+    size_t operator()(const std::string& key) const
+    {
+        //
+        // FNV-1a
+        //
+        size_t h = 2166136261U;
+        for(std::string::const_iterator p = key.begin(); p != key.end(); ++p)
+        {
+            h = (h ^ static_cast<unsigned char>(*p)) * 16777619U;
+        }
+        return h;
+    }
+};
+
+template<>
+struct CacheKeyHash<Ice::Identity>
+{
+    size_t operator()(const Ice::Identity& ident) const
+    {
+        CacheKeyHash<std::string> hash;
+        return hash(ident.name) * 31 + hash(ident.category);
+    }
+};
+
 //
 // An abstraction to efficiently populate a Cache, without holding
 // a lock while loading from a database.
 //
+// The cache is split into a number of shards, each with its own mutex
+// and map; the shard of a key is selected with Hash, so operations on
+// keys in different shards never contend.
+//
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Hash = CacheKeyHash<Key> >
 class Cache
 {
 public:
@@ -60,13 +106,30 @@ public:
     void clear();
     size_t size() const;
 
+    size_t shardCount() const;
+
     bool pin(const Key&, const IceUtil::Handle<Value>&);
 
     IceUtil::Handle<Value> pin(const Key&);
     IceUtil::Handle<Value> putIfAbsent(const Key&, const IceUtil::Handle<Value>&);
 
+    //
+    // reserve() marks a key as being loaded, like pin() does before calling
+    // load(); it returns false when the key is already cached or being
+    // loaded. The caller loads the object itself and must then call fill()
+    // with the position, and a null object if it was not found; threads
+    // pinning the key meanwhile wait for fill().
+    //
+    bool reserve(const Key&, Position&);
+    void fill(Position, const IceUtil::Handle<Value>&);
+
 protected:
 
+    //
+    // shardCount is rounded up to a power of 2; 0 selects the default
+    //
+    Cache(size_t = 0);
+
     virtual IceUtil::Handle<Value> load(const Key&) = 0;
 
     virtual void pinned(const IceUtil::Handle<Value>&, Position)
@@ -75,27 +138,78 @@ protected:
 
     virtual ~Cache()
     {
+        delete[] _shards;
     }
 
 private:
 
+    Cache(const Cache&);
+    void operator=(const Cache&);
+
     IceUtil::Handle<Value> pinImpl(const Key&, const IceUtil::Handle<Value>&);
 
     typedef std::map<Key, CacheValue> CacheMap;
 
-    IceUtil::Mutex _mutex;
-    CacheMap  _map;
+    struct Shard
+    {
+        IceUtil::Mutex mutex;
+        CacheMap map;
+    };
+
+    Shard& shard(const Key&) const;
+
+    Shard* _shards;
+    size_t _shardMask;
 };
 
-template<typename Key, typename Value> IceUtil::Handle<Value>
-Cache<Key, Value>::getIfPinned(const Key& key, bool wait) const
+template<typename Key, typename Value, typename Hash>
+Cache<Key, Value, Hash>::Cache(size_t shardCount) :
+    _shards(0),
+    _shardMask(0)
+{
+    if(shardCount == 0)
+    {
+        shardCount = 32;
+    }
+
+    size_t count = 1;
+    while(count < shardCount)
+    {
+        count <<= 1;
+    }
+    _shards = new Shard[count];
+    _shardMask = count - 1;
+}
+
+template<typename Key, typename Value, typename Hash> typename Cache<Key, Value, Hash>::Shard&
+Cache<Key, Value, Hash>::shard(const Key& key) const
 {
-    IceUtil::Mutex::Lock sync(_mutex);
+    Hash hash;
+    size_t h = hash(key);
+
+    //
+    // Mix the high bits in, as the mask only keeps the low bits
+    //
+    h ^= (h >> 16);
+    return _shards[h & _shardMask];
+}
+
+template<typename Key, typename Value, typename Hash> size_t
+Cache<Key, Value, Hash>::shardCount() const
+{
+    return _shardMask + 1;
+}
+
+template<typename Key, typename Value, typename Hash> IceUtil::Handle<Value>
+Cache<Key, Value, Hash>::getIfPinned(const Key& key, bool wait) const
+{
+    Shard& sh = shard(key);
+    IceUtil::Mutex::Lock sync(sh.mutex);
 
     for(;;)
     {
-        typename CacheMap::const_iterator p = _map.find(key);
-        if(p != _map.end())
+        typename CacheMap::const_iterator p = sh.map.find(key);
+        if(p != sh.map.end())
         {
             IceUtil::Handle<Value> result = (*p).second.obj;
             if(result != 0 || wait == false)
@@ -132,43 +246,56 @@ Cache<Key, Value>::getIfPinned(const Key& key, bool wait) const
     }
 }
 
-template<typename Key, typename Value> void
-Cache<Key, Value>::unpin(typename Cache::Position p)
+template<typename Key, typename Value, typename Hash> void
+Cache<Key, Value, Hash>::unpin(typename Cache::Position p)
 {
     //
     // There is no risk to erase a 'being loaded' position,
     // since such position never got outside yet!
     //
-    IceUtil::Mutex::Lock sync(_mutex);
-    _map.erase(p);
+    // The key of p is immutable, so it's safe to read it to find
+    // the shard before locking.
+    //
+    Shard& sh = shard(p->first);
+    IceUtil::Mutex::Lock sync(sh.mutex);
+    sh.map.erase(p);
 }
 
-template<typename Key, typename Value> void
-Cache<Key, Value>::clear()
+template<typename Key, typename Value, typename Hash> void
+Cache<Key, Value, Hash>::clear()
 {
     //
     // Not safe during a pin!
     //
-    IceUtil::Mutex::Lock sync(_mutex);
-    _map.clear();
+    for(size_t i = 0; i <= _shardMask; ++i)
+    {
+        IceUtil::Mutex::Lock sync(_shards[i].mutex);
+        _shards[i].map.clear();
+    }
 }
 
-template<typename Key, typename Value> size_t
-Cache<Key, Value>::size() const
+template<typename Key, typename Value, typename Hash> size_t
+Cache<Key, Value, Hash>::size() const
 {
-    IceUtil::Mutex::Lock sync(_mutex);
-    return _map.size();
+    size_t result = 0;
+    for(size_t i = 0; i <= _shardMask; ++i)
+    {
+        IceUtil::Mutex::Lock sync(_shards[i].mutex);
+        result += _shards[i].map.size();
+    }
+    return result;
 }
 
-template<typename Key, typename Value> bool
-Cache<Key, Value>::pin(const Key& key, const IceUtil::Handle<Value>& obj)
+template<typename Key, typename Value, typename Hash> bool
+Cache<Key, Value, Hash>::pin(const Key& key, const IceUtil::Handle<Value>& obj)
 {
-    IceUtil::Mutex::Lock sync(_mutex);
+    Shard& sh = shard(key);
+    IceUtil::Mutex::Lock sync(sh.mutex);
     std::pair<typename CacheMap::iterator, bool> ir =
 #ifdef _MSC_VER
-       _map.insert(CacheMap::value_type(key, CacheValue(obj)));
+       sh.map.insert(CacheMap::value_type(key, CacheValue(obj)));
 #else
-       _map.insert(typename CacheMap::value_type(key, CacheValue(obj)));
+       sh.map.insert(typename CacheMap::value_type(key, CacheValue(obj)));
 #endif
 
     if(ir.second)
@@ -178,28 +305,95 @@ Cache<Key, Value>::pin(const Key& key, const IceUtil::Handle<Value>& obj)
     return ir.second;
 }
 
-template<typename Key, typename Value> IceUtil::Handle<Value>
-Cache<Key, Value>::pin(const Key& key)
+template<typename Key, typename Value, typename Hash> IceUtil::Handle<Value>
+Cache<Key, Value, Hash>::pin(const Key& key)
 {
     return pinImpl(key, 0);
 }
 
-template<typename Key, typename Value> IceUtil::Handle<Value>
-Cache<Key, Value>::putIfAbsent(const Key& key, const IceUtil::Handle<Value>& obj)
+template<typename Key, typename Value, typename Hash> IceUtil::Handle<Value>
+Cache<Key, Value, Hash>::putIfAbsent(const Key& key, const IceUtil::Handle<Value>& obj)
 {
     return pinImpl(key, obj);
 }
 
-template<typename Key, typename Value> IceUtil::Handle<Value>
-Cache<Key, Value>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
+template<typename Key, typename Value, typename Hash> bool
+Cache<Key, Value, Hash>::reserve(const Key& key, typename Cache::Position& p)
+{
+    Shard& sh = shard(key);
+    IceUtil::Mutex::Lock sync(sh.mutex);
+    std::pair<typename CacheMap::iterator, bool> ir =
+#if defined(_MSC_VER)
+        sh.map.insert(CacheMap::value_type(key, CacheValue(0)));
+#else
+        sh.map.insert(typename CacheMap::value_type(key, CacheValue(0)));
+#endif
+
+    p = ir.first;
+    return ir.second;
+}
+
+template<typename Key, typename Value, typename Hash> void
+Cache<Key, Value, Hash>::fill(typename Cache::Position p, const IceUtil::Handle<Value>& obj)
+{
+    Shard& sh = shard(p->first);
+    IceUtil::Mutex::Lock sync(sh.mutex);
+
+    //
+    // p is still valid here -- nobody knows about it. See also unpin().
+    //
+    Latch* latch = p->second.latch;
+    p->second.latch = 0;
+
+    try
+    {
+        if(obj != 0)
+        {
+            p->second.obj = obj;
+            pinned(obj, p);
+        }
+        else
+        {
+            //
+            // The waiting threads will have to call load() to see by themselves.
+            //
+            sh.map.erase(p);
+        }
+    }
+    catch(...)
+    {
+        if(latch != 0)
+        {
+            //
+            // Must be called within sync; see ->countDown() note in pinImpl().
+            //
+            assert(latch->getCount() == 1);
+            latch->countDown();
+        }
+        throw;
+    }
+
+    if(latch != 0)
+    {
+        //
+        // Must be called within sync; see ->countDown() note in pinImpl().
+        //
+        assert(latch->getCount() == 1);
+        latch->countDown();
+    }
+}
+
+template<typename Key, typename Value, typename Hash> IceUtil::Handle<Value>
+Cache<Key, Value, Hash>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
 {
+    Shard& sh = shard(key);
     Latch* latch = 0;
     Position p;
 
     do
     {
         {
-            IceUtil::Mutex::Lock sync(_mutex);
+            IceUtil::Mutex::Lock sync(sh.mutex);
 
             //
             // Clean up latch from previous loop
@@ -215,9 +409,9 @@ Cache<Key, Value>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
 
             std::pair<typename CacheMap::iterator, bool> ir =
 #if defined(_MSC_VER)
-                _map.insert(CacheMap::value_type(key, CacheValue(0)));
+                sh.map.insert(CacheMap::value_type(key, CacheValue(0)));
 #else
-                _map.insert(typename CacheMap::value_type(key, CacheValue(0)));
+                sh.map.insert(typename CacheMap::value_type(key, CacheValue(0)));
 #endif
 
             if(ir.second == false)
@@ -271,10 +465,10 @@ Cache<Key, Value>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
     }
     catch(...)
     {
-        IceUtil::Mutex::Lock sync(_mutex);
+        IceUtil::Mutex::Lock sync(sh.mutex);
         latch = p->second.latch;
         p->second.latch = 0;
-        _map.erase(p);
+        sh.map.erase(p);
         if(latch != 0)
         {
             //
@@ -289,7 +483,7 @@ Cache<Key, Value>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
         throw;
     }
 
-    IceUtil::Mutex::Lock sync(_mutex);
+    IceUtil::Mutex::Lock sync(sh.mutex);
 
     //
     // p is still valid here -- nobody knows about it. See also unpin().
@@ -315,7 +509,7 @@ Cache<Key, Value>::pinImpl(const Key& key, const IceUtil::Handle<Value>& newObj)
                 //
                 // The waiting threads will have to call load() to see by themselves.
                 //
-                _map.erase(p);
+                sh.map.erase(p);
             }
             else
             {
@@ -15,6 +15,7 @@
 #include <Freeze/TransactionHolder.h>
 #include <Freeze/Catalog.h>
 #include <Freeze/AbstractMutex.h>
+#include <Freeze/Snapshot.h>
 #include <Freeze/Cache.h>
 #include <IceUtil/PopDisableWarnings.h>
 
@@ -9,14 +9,38 @@
 
 #include <Ice/Ice.h>
 #include <Freeze/DB.h>
+#include <Freeze/Evictor.h>
 #include <vector>
 
 namespace Freeze
 {
 
 class IndexI;
+class IndexIteratorI;
 class ObjectStoreBase;
 
+//
+// An object found by an index query, with its servant pinned in the
+// evictor cache; the servant is null when the query runs in a
+// transaction, or when the object was destroyed and not saved yet
+//
+struct IndexMatch
+{
+    Ice::Identity ident;
+    Ice::ObjectPtr servant;
+};
+
+//
+// Where a range query stopped: the secondary and primary keys of the last
+// object returned. Pass it back to the same query to get the next
+// objects; the query clears it once it has returned all the objects.
+//
+struct IndexPosition
+{
+    Freeze::Key key;
+    Freeze::Key primaryKey;
+};
+
 class FREEZE_API Index : public IceUtil::Shared
 {
 public:
@@ -28,14 +52,49 @@ public:
 
 protected:
 
-    Index(const std::string&, const std::string&);
+    //
+    // The keys of an ordered index are sorted with compare; changing this
+    // setting requires rebuilding the index database
+    //
+    Index(const std::string&, const std::string&, bool = false);
+
+    //
+    // Returns a negative number, 0 or a positive number when the first key
+    // is respectively lower than, equal to or greater than the second key.
+    // The default compares the Ice encodings of the keys byte per byte,
+    // which is the order of the keys of an index that is not ordered.
+    //
+    virtual int compare(const Freeze::Key&, const Freeze::Key&);
 
     virtual bool marshalKey(const Ice::ObjectPtr&, Freeze::Key&) const = 0;
 
     std::vector<Ice::Identity> untypedFindFirst(const Freeze::Key&, Ice::Int) const;
 
+    std::vector<IndexMatch> untypedFindFirstServants(const Freeze::Key&, Ice::Int) const;
+
     std::vector<Ice::Identity> untypedFind(const Freeze::Key&) const;
 
+    //
+    // Returns the objects with a key in [lower, upper), in key order; an
+    // empty bound means no bound
+    //
+    std::vector<Ice::Identity> untypedFindRange(const Freeze::Key&, const Freeze::Key&, Ice::Int,
+                                                IndexPosition&) const;
+
+    //
+    // Iterators over the same objects as untypedFind and untypedFindRange,
+    // reading batchSize records at a time
+    //
+    EvictorIteratorPtr untypedGetIterator(const Freeze::Key&, Ice::Int) const;
+
+    EvictorIteratorPtr untypedGetRangeIterator(const Freeze::Key&, const Freeze::Key&, Ice::Int) const;
+
+    //
+    // Computes the smallest string greater than all the strings starting
+    // with the given prefix; returns false when there is none
+    //
+    static bool prefixUpperBound(const std::string&, std::string&);
+
     Ice::Int untypedCount(const Freeze::Key&) const;
 
     Ice::CommunicatorPtr _communicator;
@@ -44,10 +103,12 @@ protected:
 private:
 
     friend class IndexI;
+    friend class IndexIteratorI;
     friend class ObjectStoreBase;
 
     std::string _name;
     std::string _facet;
+    bool _ordered;
     IndexI* _impl;
 };
 
@@ -105,6 +105,58 @@ FREEZE_API DbTxn* getTxn(const TransactionPtr&);
 typedef void (*FatalErrorCallback)(const BackgroundSaveEvictorPtr&, const Ice::CommunicatorPtr&);
 FREEZE_API FatalErrorCallback registerFatalErrorCallback(FatalErrorCallback);
 
+//
+// The save settings of a background save evictor, as currently chosen by
+// its save controller when Freeze.Evictor.env.filename.AdaptiveSave is set,
+// or as configured otherwise. Times are in milliseconds.
+//
+struct BackgroundSaveStatus
+{
+    bool adaptive;
+    Ice::Int saveSizeTrigger;
+    Ice::Int savePeriod;
+    Ice::Int maxTxSize;
+    Ice::Int commitLatency; // Average commit latency, adaptive only
+    Ice::Int deadlocks; // Deadlocks while saving the last batch, adaptive only
+    Ice::Int modifiedQueueSize;
+
+    //
+    // Objects modified and not saved yet, with their estimated footprint,
+    // and the calls to finished or addFacet held back by the
+    // MaxModifiedObjects and MaxModifiedBytes high-water marks
+    //
+    Ice::Long unsavedObjects;
+    Ice::Long unsavedBytes;
+    Ice::Long heldBackCalls;
+    Ice::Long heldBackTime;
+    Ice::Int maxHeldBackTime;
+};
+
+FREEZE_API BackgroundSaveStatus getBackgroundSaveStatus(const BackgroundSaveEvictorPtr&);
+
+//
+// Loads all the facets of the given identity in the cache of the evictor,
+// with a single cursor pass when Freeze.Evictor.env.filename.ColocateFacets
+// stores all the facets of an identity together, and returns the number of
+// facets found.
+//
+FREEZE_API Ice::Int preloadFacets(const EvictorPtr&, const Ice::Identity&);
+
+//
+// Tells the evictor that the given objects of a facet are about to be
+// used: they are loaded in key order with a single cursor, in the
+// background when Freeze.Evictor.env.filename.LoadThreads is set.
+//
+FREEZE_API void prefetch(const EvictorPtr&, const Ice::IdentitySeq&, const std::string& = "");
+
+//
+// Write-locks the given objects of a facet in the current transaction of
+// the transactional evictor, in key order; transactions that update
+// several objects can call it first, so that they can't deadlock on each
+// other's locks.
+//
+FREEZE_API void lockForUpdate(const TransactionalEvictorPtr&, const Ice::IdentitySeq&, const std::string& = "");
+
 }
 
 #endif
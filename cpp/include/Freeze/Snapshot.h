@@ -0,0 +1,40 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_SNAPSHOT_H
+#define FREEZE_SNAPSHOT_H
+
+#include <Ice/Ice.h>
+
+namespace Freeze
+{
+
+//
+// With Freeze.Evictor.env.filename.SnapshotStreaming set, a background save
+// evictor locks each modified servant implementing Snapshot only to take a
+// snapshot of it, and streams this snapshot once the servant is unlocked;
+// the snapshot should be cheap, for example state shared copy-on-write.
+// The other servants are streamed while locked, as without
+// SnapshotStreaming.
+//
+class FREEZE_API Snapshot
+{
+public:
+
+    virtual ~Snapshot()
+    {
+    }
+
+    //
+    // Called with the servant locked; the returned object must not change
+    // once the servant is unlocked.
+    //
+    virtual Ice::ObjectPtr ice_snapshot() const = 0;
+};
+
+}
+
+#endif
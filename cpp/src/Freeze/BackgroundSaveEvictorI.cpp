@@ -11,11 +11,13 @@
 #include <Freeze/Util.h>
 
 #include <Freeze/ObjectStore.h>
+#include <Freeze/Snapshot.h>
 
 #include <IceUtil/Mutex.h>
 #include <IceUtil/MutexPtrLock.h>
 
 #include <typeinfo>
+#include <set>
 
 using namespace std;
 using namespace Freeze;
@@ -88,6 +90,21 @@ private:
     BackgroundSaveEvictorI& _evictor;
 };
 
+//
+// The saving thread streams the modified objects alone when there are
+// fewer than minSliceSize objects per stream thread
+//
+const size_t minSliceSize = 16;
+
+//
+// Objects in use or in the modifiedQueue can't be evicted
+//
+bool
+isEvictable(const BackgroundSaveEvictorElementPtr& element)
+{
+    return element->usageCount == 0;
+}
+
 }
 
 //
@@ -126,10 +143,67 @@ Freeze::registerFatalErrorCallback(FatalErrorCallback cb)
     return result;
 }
 
+BackgroundSaveStatus
+Freeze::getBackgroundSaveStatus(const BackgroundSaveEvictorPtr& evictor)
+{
+    BackgroundSaveEvictorI* evictorI = dynamic_cast<BackgroundSaveEvictorI*>(evictor.get());
+    if(evictorI == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "getBackgroundSaveStatus: invalid evictor");
+    }
+    return evictorI->status();
+}
+
 //
 // BackgroundSaveEvictorI
 //
 
+class Freeze::BackgroundSaveEvictorI::WriterThread : public IceUtil::Thread
+{
+public:
+
+    //
+    // The evictor joins this thread during deactivation
+    //
+    WriterThread(BackgroundSaveEvictorI* evictor) :
+        IceUtil::Thread("Freeze background save evictor writer thread"),
+        _evictor(evictor)
+    {
+    }
+
+    virtual void run()
+    {
+        _evictor->runWriter();
+    }
+
+private:
+
+    BackgroundSaveEvictorI* _evictor;
+};
+
+class Freeze::BackgroundSaveEvictorI::StreamThread : public IceUtil::Thread
+{
+public:
+
+    //
+    // The evictor joins this thread during deactivation
+    //
+    StreamThread(BackgroundSaveEvictorI* evictor) :
+        IceUtil::Thread("Freeze background save evictor stream thread"),
+        _evictor(evictor)
+    {
+    }
+
+    virtual void run()
+    {
+        _evictor->runStreamThread();
+    }
+
+private:
+
+    BackgroundSaveEvictorI* _evictor;
+};
+
 Freeze::BackgroundSaveEvictorI::BackgroundSaveEvictorI(const ObjectAdapterPtr& adapter,
                                                        const string& envName,
                                                        DbEnv* dbEnv,
@@ -139,8 +213,24 @@ Freeze::BackgroundSaveEvictorI::BackgroundSaveEvictorI(const ObjectAdapterPtr& a
                                                        bool createDb) :
     EvictorI<BackgroundSaveEvictorElement>(adapter, envName, dbEnv, filename, FacetTypeMap(), initializer, indices, createDb),
     IceUtil::Thread("Freeze background save evictor thread"),
-    _currentEvictorSize(0),
-    _savingThreadDone(false)
+    _savingThreadDone(false),
+    _batchSequence(0),
+    _savedSequence(0),
+    _streamedSequence(0),
+    _saveNowSequence(0),
+    _streamingBatch(0),
+    _pendingBatch(0),
+    _writingBatch(0),
+    _writerDone(false),
+    _deadlocks(0),
+    _modifiedBytes(0),
+    _unsavedObjects(0),
+    _unsavedBytes(0),
+    _heldBackCalls(0),
+    _maxModifiedObjects(0),
+    _maxModifiedBytes(0),
+    _pendingSlices(0),
+    _streamThreadsDone(false)
 {
     string propertyPrefix = string("Freeze.Evictor.") + envName + '.' + _filename;
 
@@ -168,6 +258,46 @@ Freeze::BackgroundSaveEvictorI::BackgroundSaveEvictorI(const ObjectAdapterPtr& a
         _maxTxSize = 100;
     }
 
+    //
+    // With AdaptiveSave, the save controller tunes these settings to save
+    // each modified object within MaxDirtyAge ms (by default SavePeriod),
+    // with commits that take at most CommitLatencyBudget ms
+    //
+    if(_communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".AdaptiveSave") > 0)
+    {
+        Int maxDirtyAge = _communicator->getProperties()->
+            getPropertyAsIntWithDefault(propertyPrefix + ".MaxDirtyAge", savePeriod);
+        Int latencyBudget = _communicator->getProperties()->
+            getPropertyAsIntWithDefault(propertyPrefix + ".CommitLatencyBudget", 100);
+
+        if(maxDirtyAge <= 0 || latencyBudget <= 0)
+        {
+            Warning out(_communicator->getLogger());
+            out << propertyPrefix << ".AdaptiveSave requires a positive MaxDirtyAge and CommitLatencyBudget; "
+                << "using the configured save settings";
+        }
+        else
+        {
+            _saveController.reset(new SaveController(_saveSizeTrigger < 0 ? 10 : _saveSizeTrigger, _maxTxSize,
+                                                     IceUtil::Time::milliSeconds(maxDirtyAge),
+                                                     IceUtil::Time::milliSeconds(latencyBudget)));
+        }
+    }
+
+    //
+    // By default, no high-water mark; when set, callers wait at most one
+    // second by default
+    //
+    Int maxModifiedObjects = _communicator->getProperties()->
+        getPropertyAsInt(propertyPrefix + ".MaxModifiedObjects");
+    if(maxModifiedObjects > 0)
+    {
+        _maxModifiedObjects = static_cast<size_t>(maxModifiedObjects);
+    }
+    _maxModifiedBytes = getPropertyAsBytes(propertyPrefix + ".MaxModifiedBytes");
+    _backpressureTimeout = IceUtil::Time::milliSeconds(_communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".BackpressureTimeout", 1000));
+
     //
     // By default, no stream timeout
     //
@@ -179,12 +309,55 @@ Freeze::BackgroundSaveEvictorI::BackgroundSaveEvictorI(const ObjectAdapterPtr& a
         _timer = IceInternal::getInstanceTimer(_communicator);
     }
 
+    //
+    // By default, servants are locked while they are streamed; with
+    // SnapshotStreaming, the servants implementing Freeze::Snapshot are
+    // only locked to take their snapshot
+    //
+    _snapshotStreaming = _communicator->getProperties()->
+        getPropertyAsInt(propertyPrefix + ".SnapshotStreaming") > 0;
+
+    //
+    // By default, queries wait until all the modified objects are saved;
+    // otherwise, they wait until these objects are streamed and merge the
+    // streamed values with their results
+    //
+    _strictQueries = _communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".StrictQueries", 1) > 0;
+
+    //
+    // The elements are loaded with the digest of their record, so that
+    // the saving thread skips an object that still marshals to this record
+    //
+    _keepDigests = true;
+
+    //
+    // By default, the saving thread streams all the modified objects
+    //
+    Int streamThreads = _communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".StreamThreads", 1);
+
+    for(Int i = 1; i < streamThreads; ++i)
+    {
+        IceUtil::ThreadPtr thread = new StreamThread(this);
+        _streamThreads.push_back(thread->start());
+    }
+
+    IceUtil::ThreadPtr writerThread = new WriterThread(this);
+    _writerThread = writerThread->start();
+
     //
     // Start saving thread
     //
     __setNoDelete(true);
     start();
     __setNoDelete(false);
+
+    //
+    // Registered once the constructor can no longer fail, since only
+    // deactivate unregisters this evictor
+    //
+    registerMemoryBudget();
 }
 
 Ice::ObjectPrx
@@ -202,6 +375,11 @@ Freeze::BackgroundSaveEvictorI::addFacet(const ObjectPtr& servant, const Identit
                                 + facet + "'");
     }
 
+    //
+    // Before this facet can be found in the cache
+    //
+    store->facetAdded(ident);
+
     bool alreadyThere = false;
 
     for(;;)
@@ -220,7 +398,8 @@ Freeze::BackgroundSaveEvictorI::addFacet(const ObjectPtr& servant, const Identit
         }
 
         {
-            Lock sync(*this);
+            Segment& segment = findSegment(ident);
+            IceUtil::Mutex::Lock sync(segment.mutex);
 
             if(element->stale)
             {
@@ -229,7 +408,7 @@ Freeze::BackgroundSaveEvictorI::addFacet(const ObjectPtr& servant, const Identit
                 //
                 continue;
             }
-            fixEvictPosition(element);
+            fixEvictPosition(segment, element);
 
             IceUtil::Mutex::Lock lock(element->mutex);
 
@@ -302,6 +481,8 @@ Freeze::BackgroundSaveEvictorI::addFacet(const ObjectPtr& servant, const Identit
         out << " to Db \"" << _filename << "\"";
     }
 
+    throttle();
+
     ObjectPrx obj = _adapter->createProxy(ident);
     if(!facet.empty())
     {
@@ -330,7 +511,8 @@ Freeze::BackgroundSaveEvictorI::removeFacet(const Identity& ident, const string&
             BackgroundSaveEvictorElementPtr element = store->pin(ident);
             if(element != 0)
             {
-                Lock sync(*this);
+                Segment& segment = findSegment(ident);
+                IceUtil::Mutex::Lock sync(segment.mutex);
                 if(element->stale)
                 {
                     //
@@ -339,7 +521,7 @@ Freeze::BackgroundSaveEvictorI::removeFacet(const Identity& ident, const string&
                     continue;
                 }
 
-                fixEvictPosition(element);
+                fixEvictPosition(segment, element);
                 {
                     IceUtil::Mutex::Lock lock(element->mutex);
 
@@ -394,9 +576,7 @@ Freeze::BackgroundSaveEvictorI::removeFacet(const Identity& ident, const string&
                     //
                     // Note that save evicts dead objects
                     //
-                    _evictorList.push_front(element);
-                    _currentEvictorSize++;
-                    element->evictPosition = _evictorList.begin();
+                    segment.policy->add(element);
                 }
             }
             break; // for(;;)
@@ -458,7 +638,8 @@ Freeze::BackgroundSaveEvictorI::keepFacet(const Identity& ident, const string& f
                 break;
             }
 
-            Lock sync(*this);
+            Segment& segment = findSegment(ident);
+            IceUtil::Mutex::Lock sync(segment.mutex);
 
             if(element->stale)
             {
@@ -492,8 +673,7 @@ Freeze::BackgroundSaveEvictorI::keepFacet(const Identity& ident, const string& f
                 }
                 else
                 {
-                    _evictorList.erase(element->evictPosition);
-                    _currentEvictorSize--;
+                    segment.policy->remove(element);
                 }
                 element->keepCount = 1;
             }
@@ -534,7 +714,8 @@ Freeze::BackgroundSaveEvictorI::releaseFacet(const Identity& ident, const string
 
     if(store != 0)
     {
-        Lock sync(*this);
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
 
         BackgroundSaveEvictorElementPtr element = store->getIfPinned(ident);
         if(element != 0)
@@ -550,9 +731,7 @@ Freeze::BackgroundSaveEvictorI::releaseFacet(const Identity& ident, const string
                     // Note that the element cannot be destroyed or dead since
                     // its keepCount was > 0.
                     //
-                    _evictorList.push_front(element);
-                    _currentEvictorSize++;
-                    element->evictPosition = _evictorList.begin();
+                    segment.policy->add(element);
                 }
                 //
                 // Success
@@ -585,7 +764,8 @@ Freeze::BackgroundSaveEvictorI::hasFacet(const Identity& ident, const string& fa
     }
 
     {
-        Lock sync(*this);
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
         BackgroundSaveEvictorElementPtr element = store->getIfPinned(ident);
         if(element != 0)
         {
@@ -598,6 +778,121 @@ Freeze::BackgroundSaveEvictorI::hasFacet(const Identity& ident, const string& fa
     return store->dbHasObject(ident, 0);
 }
 
+Int
+Freeze::BackgroundSaveEvictorI::preloadFacets(const Identity& ident)
+{
+    checkIdentity(ident);
+    DeactivateController::Guard deactivateGuard(_deactivateController);
+
+    vector<BackgroundSaveEvictorElementPtr> elements;
+    pinFacets(ident, elements);
+
+    Int count = 0;
+    {
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        for(vector<BackgroundSaveEvictorElementPtr>::const_iterator p = elements.begin(); p != elements.end(); ++p)
+        {
+            const BackgroundSaveEvictorElementPtr& element = *p;
+            if(element->stale)
+            {
+                //
+                // Already evicted
+                //
+                continue;
+            }
+
+            fixEvictPosition(segment, element);
+
+            IceUtil::Mutex::Lock lock(element->mutex);
+            if(element->status != destroyed && element->status != dead)
+            {
+                ++count;
+            }
+        }
+        evict(segment);
+    }
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "preloaded " << count << " facets of \"" << _communicator->identityToString(ident) << "\" from Db \""
+            << _filename << "\"";
+    }
+    return count;
+}
+
+void
+Freeze::BackgroundSaveEvictorI::prefetchNow(const vector<Identity>& idents, const string& facet)
+{
+    ObjectStore<BackgroundSaveEvictorElement>* store = findStore(facet, false);
+    if(store == 0)
+    {
+        return;
+    }
+
+    vector<pair<Identity, BackgroundSaveEvictorElementPtr> > elements;
+    store->pinMany(idents, elements);
+
+    for(vector<pair<Identity, BackgroundSaveEvictorElementPtr> >::const_iterator p = elements.begin(); p != elements.end(); ++p)
+    {
+        Segment& segment = findSegment(p->first);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        const BackgroundSaveEvictorElementPtr& element = p->second;
+        if(!element->stale)
+        {
+            fixEvictPosition(segment, element);
+            evict(segment);
+        }
+    }
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "prefetched " << elements.size() << " of " << idents.size() << " objects";
+        if(!facet.empty())
+        {
+            out << " with facet \"" << facet << "\"";
+        }
+        out << " from Db \"" << _filename << "\"";
+    }
+}
+
+void
+Freeze::BackgroundSaveEvictorI::pinServants(ObjectStoreBase* storeBase, const vector<Identity>& idents,
+                                            map<Identity, ObjectPtr>& servants)
+{
+    ObjectStore<BackgroundSaveEvictorElement>* store =
+        static_cast<ObjectStore<BackgroundSaveEvictorElement>*>(storeBase);
+
+    vector<pair<Identity, BackgroundSaveEvictorElementPtr> > elements;
+    store->pinMany(idents, elements);
+
+    for(vector<pair<Identity, BackgroundSaveEvictorElementPtr> >::const_iterator p = elements.begin(); p != elements.end(); ++p)
+    {
+        Segment& segment = findSegment(p->first);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        const BackgroundSaveEvictorElementPtr& element = p->second;
+        if(element->stale)
+        {
+            continue;
+        }
+        fixEvictPosition(segment, element);
+
+        {
+            IceUtil::Mutex::Lock lockElement(element->mutex);
+            if(element->status != destroyed && element->status != dead)
+            {
+                servants[p->first] = element->rec.servant;
+            }
+        }
+        evict(segment);
+    }
+}
+
 bool
 Freeze::BackgroundSaveEvictorI::hasAnotherFacet(const Identity& ident, const string& facet)
 {
@@ -607,44 +902,69 @@ Freeze::BackgroundSaveEvictorI::hasAnotherFacet(const Identity& ident, const str
     // If the object exists in another store, throw FacetNotExistException
     // instead of returning 0 (== ObjectNotExistException)
     //
-    StoreMap storeMapCopy;
+    // With a facet directory, only the stores of the facets it may have
+    // are searched
+    //
+    Dbt dbKey;
+    ObjectStoreBase::KeyMarshaler km(ident, _communicator, _encoding);
+    km.getDbt(dbKey);
+    const Byte* key = static_cast<const Byte*>(dbKey.get_data());
+
+    Long epoch = 0;
+    Long facets = 0;
+    if(_facetDirectory.get() != 0)
+    {
+        facets = _facetDirectory->facets(key, dbKey.get_size(), epoch);
+    }
+
+    vector<ObjectStore<BackgroundSaveEvictorElement>*> stores;
     {
         Lock sync(*this);
-        storeMapCopy = _storeMap;
+        for(StoreMap::const_iterator p = _storeMap.begin(); p != _storeMap.end(); ++p)
+        {
+            //
+            // Do not check again the given facet
+            //
+            int index = p->second->facetIndex();
+            if(p->first != facet && (_facetDirectory.get() == 0 || index < 0 || (facets & FacetDirectory::bit(index))))
+            {
+                stores.push_back(p->second);
+            }
+        }
     }
 
-    for(StoreMap::iterator p = storeMapCopy.begin(); p != storeMapCopy.end(); ++p)
+    Segment& segment = findSegment(ident);
+
+    for(size_t i = 0; i < stores.size(); ++i)
     {
-        //
-        // Do not check again the given facet
-        //
-        if((*p).first != facet)
+        ObjectStore<BackgroundSaveEvictorElement>* store = stores[i];
+
+        bool inCache = false;
         {
-            ObjectStore<BackgroundSaveEvictorElement>* store = (*p).second;
+            IceUtil::Mutex::Lock sync(segment.mutex);
 
-            bool inCache = false;
+            BackgroundSaveEvictorElementPtr element = store->getIfPinned(ident);
+            if(element != 0)
             {
-                Lock sync(*this);
+                inCache = true;
+                assert(!element->stale);
 
-                BackgroundSaveEvictorElementPtr element = store->getIfPinned(ident);
-                if(element != 0)
+                IceUtil::Mutex::Lock lock(element->mutex);
+                if(element->status != dead && element->status != destroyed)
                 {
-                    inCache = true;
-                    assert(!element->stale);
-
-                    IceUtil::Mutex::Lock lock(element->mutex);
-                    if(element->status != dead && element->status != destroyed)
-                    {
-                        return true;
-                    }
+                    return true;
                 }
             }
-            if(!inCache)
+        }
+        if(!inCache)
+        {
+            if(store->dbHasObject(ident, 0))
             {
-                if(store->dbHasObject(ident, 0))
-                {
-                    return true;
-                }
+                return true;
+            }
+            if(_facetDirectory.get() != 0)
+            {
+                _facetDirectory->absent(key, dbKey.get_size(), store->facetIndex(), epoch);
             }
         }
     }
@@ -671,7 +991,7 @@ Freeze::BackgroundSaveEvictorI::locateImpl(const Current& current, LocalObjectPt
 
     for(;;)
     {
-        BackgroundSaveEvictorElementPtr element = store->pin(current.id);
+        BackgroundSaveEvictorElementPtr element = pinElement(store, current.id);
         if(element == 0)
         {
             if(_trace >= 2)
@@ -683,7 +1003,8 @@ Freeze::BackgroundSaveEvictorI::locateImpl(const Current& current, LocalObjectPt
             return 0;
         }
 
-        Lock sync(*this);
+        Segment& segment = findSegment(current.id);
+        IceUtil::Mutex::Lock sync(segment.mutex);
 
         if(element->stale)
         {
@@ -715,7 +1036,7 @@ Freeze::BackgroundSaveEvictorI::locateImpl(const Current& current, LocalObjectPt
                 << _filename << "\"";
         }
 
-        fixEvictPosition(element);
+        fixEvictPosition(segment, element);
         element->usageCount++;
         cookie = element;
         assert(element->rec.servant != 0);
@@ -750,30 +1071,38 @@ Freeze::BackgroundSaveEvictorI::finished(const Current& current, const ObjectPtr
             }
         }
 
-        Lock sync(*this);
+        {
+            Segment& segment = findSegment(current.id);
+            IceUtil::Mutex::Lock sync(segment.mutex);
 
-        //
-        // Only elements with a usageCount == 0 can become stale and we own
-        // one count!
-        //
-        assert(!element->stale);
-        assert(element->usageCount >= 1);
+            //
+            // Only elements with a usageCount == 0 can become stale and we own
+            // one count!
+            //
+            assert(!element->stale);
+            assert(element->usageCount >= 1);
 
-        //
-        // Decrease the usage count of the evictor queue element.
-        //
-        element->usageCount--;
+            //
+            // Decrease the usage count of the evictor queue element.
+            //
+            element->usageCount--;
 
-        if(enqueue)
-        {
-            addToModifiedQueue(element);
+            if(enqueue)
+            {
+                addToModifiedQueue(element);
+            }
+            else if(element->usageCount == 0 && element->keepCount == 0)
+            {
+                //
+                // Evict as many elements as necessary.
+                //
+                evict(segment);
+            }
         }
-        else if(element->usageCount == 0 && element->keepCount == 0)
+
+        if(enqueue)
         {
-            //
-            // Evict as many elements as necessary.
-            //
-            evict();
+            throttle();
         }
     }
 }
@@ -785,22 +1114,37 @@ Freeze::BackgroundSaveEvictorI::deactivate(const string&)
     {
         try
         {
+            unregisterMemoryBudget();
             saveNow();
 
-            Lock sync(*this);
-
             //
             // Set the evictor size to zero, meaning that we will evict
             // everything possible.
             //
-            _evictorSize = 0;
-            evict();
+            resize(0);
 
+            Lock sync(*this);
             _savingThreadDone = true;
             notifyAll();
             sync.release();
             getThreadControl().join();
 
+            sync.acquire();
+            _writerDone = true;
+            notifyAll();
+            sync.release();
+            _writerThread.join();
+
+            {
+                IceUtil::Monitor<IceUtil::Mutex>::Lock streamSync(_streamMonitor);
+                _streamThreadsDone = true;
+                _streamMonitor.notifyAll();
+            }
+            for(vector<IceUtil::ThreadControl>::iterator p = _streamThreads.begin(); p != _streamThreads.end(); ++p)
+            {
+                p->join();
+            }
+
             closeDbEnv();
         }
         catch(...)
@@ -828,209 +1172,170 @@ Freeze::BackgroundSaveEvictorI::run()
     {
         for(;;)
         {
-            deque<BackgroundSaveEvictorElementPtr> allObjects;
-            deque<BackgroundSaveEvictorElementPtr> deadObjects;
-
-            size_t saveNowThreadsSize = 0;
+            IceInternal::UniquePtr<Batch> batch(new Batch);
+            deque<BackgroundSaveEvictorElementPtr>& allObjects = batch->allObjects;
+            deque<BackgroundSaveEvictorElementPtr>& deadObjects = batch->deadObjects;
+            deque<StreamedObjectPtr>& streamedObjectQueue = batch->streamedObjects;
+            deque<BackgroundSaveEvictorElementPtr> requeued;
+            bool mayRequeue;
 
             {
                 Lock sync(*this);
 
+                //
+                // The writer thread also notifies this monitor, so we wait
+                // until a deadline
+                //
+                IceUtil::Time deadline = IceUtil::Time::now(IceUtil::Time::Monotonic) + _savePeriod;
+
                 while(!_savingThreadDone &&
-                      (_saveNowThreads.size() == 0) &&
-                      (_saveSizeTrigger < 0 || static_cast<Int>(_modifiedQueue.size()) < _saveSizeTrigger))
+                      (_saveNowSequence <= _batchSequence) &&
+                      (_saveSizeTrigger < 0 || static_cast<Int>(_modifiedQueue.size()) < _saveSizeTrigger) &&
+                      (_modifiedQueue.size() == 0 || !overHighWaterMark()))
                 {
                     if(_savePeriod == IceUtil::Time::milliSeconds(0))
                     {
                         wait();
                     }
-                    else if(timedWait(_savePeriod) == false)
+                    else
                     {
-                        //
-                        // Timeout, so let's save
-                        //
-                        break; // while
+                        IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+                        if(now >= deadline || timedWait(deadline - now) == false)
+                        {
+                            //
+                            // Timeout, so let's save
+                            //
+                            break; // while
+                        }
                     }
                 }
 
-                saveNowThreadsSize = _saveNowThreads.size();
-
                 if(_savingThreadDone)
                 {
                     assert(_modifiedQueue.size() == 0);
-                    assert(saveNowThreadsSize == 0);
+                    assert(_saveNowSequence <= _savedSequence);
                     break; // for(;;)
                 }
 
                 //
-                // Check first if there is something to do!
+                // Check first if there is something to do! When saveNow is
+                // waiting, we hand over an empty batch to the writer thread,
+                // which completes once the previous batches are saved.
                 //
-                if(_modifiedQueue.size() == 0)
+                if(_modifiedQueue.size() == 0 && _saveNowSequence <= _batchSequence)
                 {
-                    if(saveNowThreadsSize > 0)
-                    {
-                        _saveNowThreads.clear();
-                        notifyAll();
-                    }
                     continue; // for(;;)
                 }
 
+                batch->sequence = ++_batchSequence;
+                batch->swapTime = IceUtil::Time::now(IceUtil::Time::Monotonic);
+                batch->bytes = _modifiedBytes;
                 _modifiedQueue.swap(allObjects);
+                _modifiedBytes = 0;
+                _streamingBatch = batch.get();
+
+                //
+                // saveNow expects its batch to contain all the modified objects
+                //
+                mayRequeue = _snapshotStreaming && _saveNowSequence < batch->sequence;
             }
 
             const size_t size = allObjects.size();
 
-            deque<StreamedObjectPtr> streamedObjectQueue;
-
             Long streamStart = IceUtil::Time::now(IceUtil::Time::Monotonic).toMilliSeconds();
 
             //
-            // Stream each element
+            // Stream each element, in parallel with the stream threads when
+            // there are enough elements; the saving thread streams the first
+            // slice
             //
-            for(size_t i = 0; i < size; i++)
+            size_t unchanged = 0;
+            size_t sliceCount = min(_streamThreads.size() + 1, size / minSliceSize);
+            if(sliceCount <= 1)
             {
-                BackgroundSaveEvictorElementPtr& element = allObjects[i];
-
-                bool tryAgain;
-                do
+                StreamSlice slice(allObjects, streamStart, mayRequeue);
+                slice.positions.reserve(size);
+                for(size_t i = 0; i < size; ++i)
                 {
-                    tryAgain = false;
-                    ObjectPtr servant = 0;
-
-                    //
-                    // These elements can't be stale as only elements with
-                    // usageCount == 0 can become stale, and the modifiedQueue
-                    // (us now) owns one count.
-                    //
+                    slice.positions.push_back(i);
+                }
+                streamSlice(slice);
+                streamedObjectQueue.swap(slice.streamed);
+                deadObjects.swap(slice.dead);
+                requeued.swap(slice.requeued);
+                unchanged = slice.unchanged;
+            }
+            else
+            {
+                //
+                // Slices are partitioned by identity, as an element can be
+                // queued more than once and its entries must be streamed in
+                // order
+                //
+                vector<StreamSlice*> slices;
+                for(size_t i = 0; i < sliceCount; ++i)
+                {
+                    slices.push_back(new StreamSlice(allObjects, streamStart, mayRequeue));
+                    slices.back()->positions.reserve(size / sliceCount + 1);
+                }
+                CacheKeyHash<Identity> hash;
+                for(size_t i = 0; i < size; ++i)
+                {
+                    size_t h = hash(allObjects[i]->cachePosition->first);
+                    h ^= (h >> 16);
+                    slices[h % sliceCount]->positions.push_back(i);
+                }
 
-                    IceUtil::Mutex::Lock lockElement(element->mutex);
-                    Byte status = element->status;
+                {
+                    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(_streamMonitor);
+                    _streamSlices.insert(_streamSlices.end(), slices.begin() + 1, slices.end());
+                    _pendingSlices = sliceCount - 1;
+                    _streamMonitor.notifyAll();
+                }
 
-                    switch(status)
-                    {
-                        case created:
-                        case modified:
-                        {
-                            servant = element->rec.servant;
-                            break;
-                        }
-                        case destroyed:
-                        {
-                            size_t index = streamedObjectQueue.size();
-                            streamedObjectQueue.resize(index + 1);
-                            streamedObjectQueue[index] = new StreamedObject;
-                            stream(element, streamStart, streamedObjectQueue[index]);
-
-                            element->status = dead;
-                            deadObjects.push_back(element);
+                try
+                {
+                    streamSlice(*slices[0]);
+                }
+                catch(const std::exception& ex)
+                {
+                    slices[0]->error = ex.what();
+                }
+                catch(...)
+                {
+                    slices[0]->error = "unknown exception";
+                }
 
-                            break;
-                        }
-                        case dead:
-                        {
-                            deadObjects.push_back(element);
-                            break;
-                        }
-                        default:
-                        {
-                            //
-                            // Nothing to do (could be a duplicate)
-                            //
-                            break;
-                        }
-                    }
-                    if(servant == 0)
+                {
+                    IceUtil::Monitor<IceUtil::Mutex>::Lock sync(_streamMonitor);
+                    while(_pendingSlices > 0)
                     {
-                        lockElement.release();
+                        _streamMonitor.wait();
                     }
-                    else
-                    {
-                        IceUtil::AbstractMutex* mutex = dynamic_cast<IceUtil::AbstractMutex*>(servant.get());
-                        if(mutex != 0)
-                        {
-                            //
-                            // Lock servant and then element so that user can safely lock
-                            // servant and call various Evictor operations
-                            //
-
-                            IceUtil::AbstractMutex::TryLock lockServant(*mutex);
-                            if(!lockServant.acquired())
-                            {
-                                lockElement.release();
-
-                                IceUtil::TimerTaskPtr watchDogTask;
-                                if(_timer)
-                                {
-                                    watchDogTask = new WatchDogTask(*this);
-                                    _timer->schedule(watchDogTask, IceUtil::Time::milliSeconds(_streamTimeout));
-                                }
-                                lockServant.acquire();
-                                if(watchDogTask)
-                                {
-                                    _timer->cancel(watchDogTask);
-                                    watchDogTask = 0;
-                                }
-
-                                lockElement.acquire();
-                                status = element->status;
-                            }
-
-                            switch(status)
-                            {
-                                case created:
-                                case modified:
-                                {
-                                    if(servant == element->rec.servant)
-                                    {
-                                        size_t index = streamedObjectQueue.size();
-                                        streamedObjectQueue.resize(index + 1);
-                                        streamedObjectQueue[index] = new StreamedObject;
-                                        stream(element, streamStart, streamedObjectQueue[index]);
-
-                                        element->status = clean;
-                                    }
-                                    else
-                                    {
-                                        tryAgain = true;
-                                    }
-                                    break;
-                                }
-                                case destroyed:
-                                {
-                                    lockServant.release();
-
-                                    size_t index = streamedObjectQueue.size();
-                                    streamedObjectQueue.resize(index + 1);
-                                    streamedObjectQueue[index] = new StreamedObject;
-                                    stream(element, streamStart, streamedObjectQueue[index]);
+                }
 
-                                    element->status = dead;
-                                    deadObjects.push_back(element);
-                                    break;
-                                }
-                                case dead:
-                                {
-                                    deadObjects.push_back(element);
-                                    break;
-                                }
-                                default:
-                                {
-                                    //
-                                    // Nothing to do (could be a duplicate)
-                                    //
-                                    break;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            DatabaseException ex(__FILE__, __LINE__);
-                            Ice::Object& svnt = *element->rec.servant;
-                            ex.message = string(typeid(svnt).name()) + " does not implement IceUtil::AbstractMutex";
-                            throw ex;
-                        }
+                //
+                // Keep the order of the modified queue for each element
+                //
+                string error;
+                for(size_t i = 0; i < sliceCount; ++i)
+                {
+                    StreamSlice* slice = slices[i];
+                    if(error.empty())
+                    {
+                        error = slice->error;
                     }
-                } while(tryAgain);
+                    streamedObjectQueue.insert(streamedObjectQueue.end(), slice->streamed.begin(), slice->streamed.end());
+                    deadObjects.insert(deadObjects.end(), slice->dead.begin(), slice->dead.end());
+                    requeued.insert(requeued.end(), slice->requeued.begin(), slice->requeued.end());
+                    unchanged += slice->unchanged;
+                    delete slice;
+                }
+
+                if(!error.empty())
+                {
+                    throw DatabaseException(__FILE__, __LINE__, error);
+                }
             }
 
             if(_trace >= 1)
@@ -1039,6 +1344,117 @@ Freeze::BackgroundSaveEvictorI::run()
                 Trace out(_communicator->getLogger(), "Freeze.Evictor");
                 out << "streamed " << streamedObjectQueue.size() << " objects in "
                     << static_cast<Int>(now - streamStart) << " ms";
+                if(unchanged > 0)
+                {
+                    out << " (skipped " << unchanged << " unchanged objects)";
+                }
+                if(requeued.size() > 0)
+                {
+                    out << " (requeued " << requeued.size() << " locked objects)";
+                }
+            }
+
+            //
+            // The locked servants are streamed with the next batch; they are
+            // still modified, and this batch keeps its usage count on them
+            //
+            for(deque<BackgroundSaveEvictorElementPtr>::iterator q = requeued.begin(); q != requeued.end(); ++q)
+            {
+                Segment& segment = findSegment((*q)->cachePosition->first);
+                IceUtil::Mutex::Lock sync(segment.mutex);
+                addToModifiedQueue(*q);
+            }
+
+            if(!_strictQueries)
+            {
+                batch->queryObjects.assign(streamedObjectQueue.begin(), streamedObjectQueue.end());
+            }
+
+            //
+            // Hand over this batch to the writer thread, and stream the next
+            // batch while this one is being saved
+            //
+            {
+                Lock sync(*this);
+                _streamedSequence = batch->sequence;
+                notifyAll();
+
+                while(_pendingBatch != 0)
+                {
+                    wait();
+                }
+                _streamingBatch = 0;
+                _pendingBatch = batch.release();
+                notifyAll();
+            }
+        }
+    }
+    catch(const std::exception& ex)
+    {
+        Error out(_communicator->getLogger());
+        out << "Saving thread killed by exception: " << ex;
+        out.flush();
+        handleFatalError(this, _communicator);
+    }
+    catch(...)
+    {
+        Error out(_communicator->getLogger());
+        out << "Saving thread killed by unknown exception";
+        out.flush();
+        handleFatalError(this, _communicator);
+    }
+}
+
+void
+Freeze::BackgroundSaveEvictorI::runWriter()
+{
+    try
+    {
+        IceUtil::Time previousSwapTime;
+        for(;;)
+        {
+            IceInternal::UniquePtr<Batch> batch;
+            size_t maxTxSize;
+            {
+                Lock sync(*this);
+                while(!_writerDone && _pendingBatch == 0)
+                {
+                    wait();
+                }
+
+                if(_pendingBatch == 0)
+                {
+                    break; // for(;;)
+                }
+
+                batch.reset(_pendingBatch);
+                _pendingBatch = 0;
+                _writingBatch = batch.get();
+                maxTxSize = static_cast<size_t>(_maxTxSize);
+
+                //
+                // The saving thread can hand over the next batch
+                //
+                notifyAll();
+            }
+
+            deque<BackgroundSaveEvictorElementPtr>& allObjects = batch->allObjects;
+            deque<BackgroundSaveEvictorElementPtr>& deadObjects = batch->deadObjects;
+            deque<StreamedObjectPtr>& streamedObjectQueue = batch->streamedObjects;
+            const size_t batchSize = allObjects.size();
+
+            //
+            // The footprints of the objects saved, from the size of their
+            // streamed values
+            //
+            vector<pair<BackgroundSaveEvictorElementPtr, size_t> > footprints;
+            for(deque<StreamedObjectPtr>::const_iterator q = streamedObjectQueue.begin();
+                q != streamedObjectQueue.end(); ++q)
+            {
+                if((*q)->value != 0 && (*q)->size > 0)
+                {
+                    footprints.push_back(make_pair((*q)->element, (*q)->size));
+                }
             }
 
             //
@@ -1050,9 +1466,9 @@ Freeze::BackgroundSaveEvictorI::run()
             // per transaction
             //
             size_t txSize = streamedObjectQueue.size();
-            if(txSize > static_cast<size_t>(_maxTxSize))
+            if(txSize > maxTxSize)
             {
-                txSize = static_cast<size_t>(_maxTxSize);
+                txSize = maxTxSize;
             }
             bool tryAgain;
 
@@ -1116,13 +1532,19 @@ Freeze::BackgroundSaveEvictorI::run()
 
                         streamedObjectQueue.erase(streamedObjectQueue.begin(), streamedObjectQueue.begin() + txSize);
 
+                        Long now = IceUtil::Time::now(IceUtil::Time::Monotonic).toMilliSeconds();
                         if(_trace >= 1)
                         {
-                            Long now = IceUtil::Time::now(IceUtil::Time::Monotonic).toMilliSeconds();
                             Trace out(_communicator->getLogger(), "Freeze.Evictor");
                             out << "saved " << txSize << " objects in "
                                 << static_cast<Int>(now - saveStart) << " ms";
                         }
+
+                        if(_saveController.get() != 0)
+                        {
+                            _saveController->committed(txSize, IceUtil::Time::milliSeconds(now - saveStart));
+                            txSize = static_cast<size_t>(_saveController->maxTxSize());
+                        }
                     }
                     catch(const DbDeadlockException&)
                     {
@@ -1135,6 +1557,11 @@ Freeze::BackgroundSaveEvictorI::run()
 
                         tryAgain = true;
                         txSize = (txSize + 1)/2;
+
+                        if(_saveController.get() != 0)
+                        {
+                            _saveController->deadlocked();
+                        }
                     }
                     catch(const DbException& dx)
                     {
@@ -1146,131 +1573,573 @@ Freeze::BackgroundSaveEvictorI::run()
             }
             while(tryAgain);
 
+            //
+            // The database is up to date, so queries no longer need this
+            // batch
+            //
             {
                 Lock sync(*this);
+                _writingBatch = 0;
+            }
+
+            //
+            // Find the segment of each dead object while we still own a usage count
+            // on it, since its cache position is only valid as long as it's not stale
+            //
+            vector<Segment*> deadSegments;
+            deadSegments.reserve(deadObjects.size());
+            for(deque<BackgroundSaveEvictorElementPtr>::iterator q = deadObjects.begin();
+                q != deadObjects.end(); q++)
+            {
+                deadSegments.push_back(&findSegment((*q)->cachePosition->first));
+            }
+
+            //
+            // Update the footprint of the saved objects, which are still in
+            // allObjects, and then release usage count
+            //
+            for(vector<pair<BackgroundSaveEvictorElementPtr, size_t> >::iterator p = footprints.begin();
+                p != footprints.end(); p++)
+            {
+                Segment& segment = findSegment(p->first->cachePosition->first);
+                IceUtil::Mutex::Lock sync(segment.mutex);
+                segment.policy->setFootprint(p->first, p->second);
+            }
+            footprints.clear();
+
+            for(deque<BackgroundSaveEvictorElementPtr>::iterator p = allObjects.begin();
+                p != allObjects.end(); p++)
+            {
+                BackgroundSaveEvictorElementPtr& element = *p;
+                Segment& segment = findSegment(element->cachePosition->first);
+                IceUtil::Mutex::Lock sync(segment.mutex);
+                element->usageCount--;
+            }
+            allObjects.clear();
+
+            for(size_t i = 0; i < deadObjects.size(); ++i)
+            {
+                BackgroundSaveEvictorElementPtr& element = deadObjects[i];
+                Segment& segment = *deadSegments[i];
+                IceUtil::Mutex::Lock sync(segment.mutex);
 
                 //
-                // Release usage count
+                // Can be stale when there are duplicate elements on the
+                // deadObjects queue
                 //
-                for(deque<BackgroundSaveEvictorElementPtr>::iterator p = allObjects.begin();
-                    p != allObjects.end(); p++)
+                if(!element->stale && element->usageCount == 0 && element->keepCount == 0)
                 {
-                    BackgroundSaveEvictorElementPtr& element = *p;
-                    element->usageCount--;
+                    //
+                    // Get rid of unused dead elements
+                    //
+                    IceUtil::Mutex::Lock lockElement(element->mutex);
+                    if(element->status == dead)
+                    {
+                        evict(segment, element);
+                    }
                 }
-                allObjects.clear();
+            }
+            deadObjects.clear();
 
-                for(deque<BackgroundSaveEvictorElementPtr>::iterator q = deadObjects.begin();
-                    q != deadObjects.end(); q++)
+            //
+            // Evict as many elements as necessary, now that these usage counts
+            // are released
+            //
+            for(size_t i = 0; i < _segments.size(); ++i)
+            {
+                Segment& segment = *_segments[i];
+                IceUtil::Mutex::Lock sync(segment.mutex);
+                evict(segment);
+            }
+
+            if(_saveController.get() != 0)
+            {
+                IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+                if(previousSwapTime != IceUtil::Time())
                 {
-                    BackgroundSaveEvictorElementPtr& element = *q;
-                    if(!element->stale)
-                    {
-                        //
-                        // Can be stale when there are duplicate elements on the
-                        // deadObjecst queue
-                        //
+                    _saveController->batchSaved(batchSize, batch->swapTime - previousSwapTime,
+                                                now - batch->swapTime);
+                }
+                previousSwapTime = batch->swapTime;
 
-                        if(!element->stale && element->usageCount == 0 && element->keepCount == 0)
-                        {
-                            //
-                            // Get rid of unused dead elements
-                            //
-                            IceUtil::Mutex::Lock lockElement(element->mutex);
-                            if(element->status == dead)
-                            {
-                                evict(element);
-                            }
-                        }
-                    }
+                if(_trace >= 1)
+                {
+                    Trace out(_communicator->getLogger(), "Freeze.Evictor");
+                    out << "save controller: save size trigger " << _saveController->saveSizeTrigger()
+                        << ", save period " << static_cast<Int>(_saveController->savePeriod().toMilliSeconds())
+                        << " ms, max tx size " << _saveController->maxTxSize() << ", commit latency "
+                        << static_cast<Int>(_saveController->commitLatency().toMilliSeconds()) << " ms, "
+                        << _saveController->deadlocks() << " deadlock(s)";
                 }
-                deadObjects.clear();
-                evict();
+            }
 
-                if(saveNowThreadsSize > 0)
+            {
+                Lock sync(*this);
+                _savedSequence = batch->sequence;
+                _unsavedObjects -= batchSize;
+                _unsavedBytes -= batch->bytes;
+                if(_saveController.get() != 0)
                 {
-                    _saveNowThreads.erase(_saveNowThreads.begin(), _saveNowThreads.begin() + saveNowThreadsSize);
-                    notifyAll();
+                    _saveSizeTrigger = _saveController->saveSizeTrigger();
+                    _savePeriod = _saveController->savePeriod();
+                    _maxTxSize = _saveController->maxTxSize();
+                    _commitLatency = _saveController->commitLatency();
+                    _deadlocks = _saveController->deadlocks();
                 }
+                notifyAll();
             }
         }
     }
     catch(const std::exception& ex)
     {
         Error out(_communicator->getLogger());
-        out << "Saving thread killed by exception: " << ex;
+        out << "Writer thread killed by exception: " << ex;
         out.flush();
         handleFatalError(this, _communicator);
     }
     catch(...)
     {
         Error out(_communicator->getLogger());
-        out << "Saving thread killed by unknown exception";
+        out << "Writer thread killed by unknown exception";
         out.flush();
         handleFatalError(this, _communicator);
     }
 }
 
+void
+Freeze::BackgroundSaveEvictorI::streamSlice(StreamSlice& slice)
+{
+    for(vector<size_t>::const_iterator p = slice.positions.begin(); p != slice.positions.end(); ++p)
+    {
+        const BackgroundSaveEvictorElementPtr& element = slice.objects[*p];
+
+        bool tryAgain;
+        do
+        {
+            tryAgain = false;
+            ObjectPtr servant = 0;
+
+            //
+            // These elements can't be stale as only elements with
+            // usageCount == 0 can become stale, and the modifiedQueue
+            // (us now) owns one count.
+            //
+
+            IceUtil::Mutex::Lock lockElement(element->mutex);
+            Byte status = element->status;
+
+            switch(status)
+            {
+                case created:
+                case modified:
+                {
+                    servant = element->rec.servant;
+                    break;
+                }
+                case destroyed:
+                {
+                    size_t index = slice.streamed.size();
+                    slice.streamed.resize(index + 1);
+                    slice.streamed[index] = new StreamedObject;
+                    stream(element, slice.streamStart, slice.streamed[index]);
+
+                    element->status = dead;
+                    slice.dead.push_back(element);
+
+                    break;
+                }
+                case dead:
+                {
+                    slice.dead.push_back(element);
+                    break;
+                }
+                default:
+                {
+                    //
+                    // Nothing to do (could be a duplicate)
+                    //
+                    break;
+                }
+            }
+            if(servant == 0)
+            {
+                lockElement.release();
+            }
+            else
+            {
+                IceUtil::AbstractMutex* mutex = dynamic_cast<IceUtil::AbstractMutex*>(servant.get());
+                if(mutex != 0)
+                {
+                    //
+                    // Lock servant and then element so that user can safely lock
+                    // servant and call various Evictor operations
+                    //
+
+                    IceUtil::AbstractMutex::TryLock lockServant(*mutex);
+                    if(!lockServant.acquired() && slice.mayRequeue && !element->requeued)
+                    {
+                        //
+                        // Don't wait for a busy servant, unless it was
+                        // already busy during the previous batch
+                        //
+                        element->requeued = true;
+                        slice.requeued.push_back(element);
+                        continue;
+                    }
+                    if(!lockServant.acquired())
+                    {
+                        lockElement.release();
+
+                        IceUtil::TimerTaskPtr watchDogTask;
+                        if(_timer)
+                        {
+                            watchDogTask = new WatchDogTask(*this);
+                            _timer->schedule(watchDogTask, IceUtil::Time::milliSeconds(_streamTimeout));
+                        }
+                        lockServant.acquire();
+                        if(watchDogTask)
+                        {
+                            _timer->cancel(watchDogTask);
+                            watchDogTask = 0;
+                        }
+
+                        lockElement.acquire();
+                        status = element->status;
+                    }
+
+                    switch(status)
+                    {
+                        case created:
+                        case modified:
+                        {
+                            Snapshot* snapshot = _snapshotStreaming ? dynamic_cast<Snapshot*>(servant.get()) : 0;
+                            if(servant == element->rec.servant && snapshot != 0)
+                            {
+                                //
+                                // Lock the servant only to take the snapshot
+                                //
+                                StreamedObjectPtr obj = new StreamedObject;
+                                streamKey(element, slice.streamStart, obj);
+                                ObjectRecord rec = element->rec;
+                                rec.servant = snapshot->ice_snapshot();
+
+                                element->status = clean;
+                                element->requeued = false;
+                                lockElement.release();
+                                lockServant.release();
+
+                                marshalValue(element, rec, obj);
+                                lockElement.acquire();
+                                bool changed = valueChanged(element, obj);
+                                lockElement.release();
+                                if(changed)
+                                {
+                                    slice.streamed.push_back(obj);
+                                }
+                                else
+                                {
+                                    slice.unchanged++;
+                                }
+                            }
+                            else if(servant == element->rec.servant)
+                            {
+                                StreamedObjectPtr obj = new StreamedObject;
+                                if(stream(element, slice.streamStart, obj))
+                                {
+                                    slice.streamed.push_back(obj);
+                                }
+                                else
+                                {
+                                    slice.unchanged++;
+                                }
+
+                                element->status = clean;
+                            }
+                            else
+                            {
+                                tryAgain = true;
+                            }
+                            break;
+                        }
+                        case destroyed:
+                        {
+                            lockServant.release();
+
+                            size_t index = slice.streamed.size();
+                            slice.streamed.resize(index + 1);
+                            slice.streamed[index] = new StreamedObject;
+                            stream(element, slice.streamStart, slice.streamed[index]);
+
+                            element->status = dead;
+                            slice.dead.push_back(element);
+                            break;
+                        }
+                        case dead:
+                        {
+                            slice.dead.push_back(element);
+                            break;
+                        }
+                        default:
+                        {
+                            //
+                            // Nothing to do (could be a duplicate)
+                            //
+                            break;
+                        }
+                    }
+                }
+                else
+                {
+                    DatabaseException ex(__FILE__, __LINE__);
+                    Ice::Object& svnt = *element->rec.servant;
+                    ex.message = string(typeid(svnt).name()) + " does not implement IceUtil::AbstractMutex";
+                    throw ex;
+                }
+            }
+        } while(tryAgain);
+    }
+}
+
+void
+Freeze::BackgroundSaveEvictorI::runStreamThread()
+{
+    for(;;)
+    {
+        StreamSlice* slice = 0;
+        {
+            IceUtil::Monitor<IceUtil::Mutex>::Lock sync(_streamMonitor);
+            while(!_streamThreadsDone && _streamSlices.empty())
+            {
+                _streamMonitor.wait();
+            }
+            if(_streamSlices.empty())
+            {
+                return;
+            }
+            slice = _streamSlices.front();
+            _streamSlices.pop_front();
+        }
+
+        //
+        // The saving thread reports the errors
+        //
+        try
+        {
+            streamSlice(*slice);
+        }
+        catch(const std::exception& ex)
+        {
+            slice->error = ex.what();
+        }
+        catch(...)
+        {
+            slice->error = "unknown exception";
+        }
+
+        {
+            IceUtil::Monitor<IceUtil::Mutex>::Lock sync(_streamMonitor);
+            if(--_pendingSlices == 0)
+            {
+                _streamMonitor.notifyAll();
+            }
+        }
+    }
+}
+
 Freeze::TransactionIPtr
 Freeze::BackgroundSaveEvictorI::beforeQuery()
 {
-    saveNow();
+    if(_strictQueries)
+    {
+        saveNow();
+    }
     return 0;
 }
 
+bool
+Freeze::BackgroundSaveEvictorI::unsavedObjects(const ObjectStoreBase* store, vector<UnsavedObject>& objects)
+{
+    if(_strictQueries)
+    {
+        return false;
+    }
+
+    //
+    // Queries don't lock servants: the saving thread streams the objects
+    // modified before this call, and queries read them from the batches
+    // not saved yet, from the oldest to the newest
+    //
+    streamNow();
+
+    vector<StreamedObjectPtr> streamed;
+    {
+        Lock sync(*this);
+
+        Batch* batches[] =
+        {
+            _writingBatch,
+            _pendingBatch,
+            _streamingBatch != 0 && _streamingBatch->sequence <= _streamedSequence ? _streamingBatch : 0
+        };
+
+        for(size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); ++i)
+        {
+            if(batches[i] == 0)
+            {
+                continue;
+            }
+            for(vector<StreamedObjectPtr>::const_iterator p = batches[i]->queryObjects.begin();
+                p != batches[i]->queryObjects.end(); ++p)
+            {
+                if((*p)->store == store)
+                {
+                    streamed.push_back(*p);
+                }
+            }
+        }
+    }
+
+    map<Identity, size_t> positions;
+    for(vector<StreamedObjectPtr>::const_iterator p = streamed.begin(); p != streamed.end(); ++p)
+    {
+        UnsavedObject object;
+
+        Dbt dbKey;
+        (*p)->key->getDbt(dbKey);
+        const Byte* key = static_cast<const Byte*>(dbKey.get_data());
+        ObjectStoreBase::unmarshal(object.ident, Key(key, key + dbKey.get_size()), _communicator, _encoding);
+
+        if((*p)->value != 0)
+        {
+            Dbt dbValue;
+            (*p)->value->getDbt(dbValue);
+            const Byte* value = static_cast<const Byte*>(dbValue.get_data());
+            object.value.assign(value, value + dbValue.get_size());
+        }
+
+        map<Identity, size_t>::iterator q = positions.find(object.ident);
+        if(q == positions.end())
+        {
+            positions.insert(make_pair(object.ident, objects.size()));
+            objects.push_back(object);
+        }
+        else
+        {
+            objects[q->second] = object;
+        }
+    }
+    return true;
+}
+
+BackgroundSaveStatus
+Freeze::BackgroundSaveEvictorI::status()
+{
+    Lock sync(*this);
+
+    BackgroundSaveStatus result;
+    result.adaptive = _saveController.get() != 0;
+    result.saveSizeTrigger = _saveSizeTrigger;
+    result.savePeriod = static_cast<Int>(_savePeriod.toMilliSeconds());
+    result.maxTxSize = _maxTxSize;
+    result.commitLatency = static_cast<Int>(_commitLatency.toMilliSeconds());
+    result.deadlocks = _deadlocks;
+    result.modifiedQueueSize = static_cast<Int>(_modifiedQueue.size());
+    result.unsavedObjects = static_cast<Long>(_unsavedObjects);
+    result.unsavedBytes = static_cast<Long>(_unsavedBytes);
+    result.heldBackCalls = _heldBackCalls;
+    result.heldBackTime = _heldBackTime.toMilliSeconds();
+    result.maxHeldBackTime = static_cast<Int>(_maxHeldBackTime.toMilliSeconds());
+    return result;
+}
+
 void
 Freeze::BackgroundSaveEvictorI::saveNow()
 {
     Lock sync(*this);
 
-    IceUtil::ThreadControl myself;
+    //
+    // Wait until the writer thread has saved the next batch, which
+    // contains all the objects modified before this call
+    //
+    Long sequence = _batchSequence + 1;
+    if(_saveNowSequence < sequence)
+    {
+        _saveNowSequence = sequence;
+    }
+    notifyAll();
+
+    while(_savedSequence < sequence)
+    {
+        wait();
+    }
+}
 
-    _saveNowThreads.push_back(myself);
+void
+Freeze::BackgroundSaveEvictorI::streamNow()
+{
+    Lock sync(*this);
+
+    //
+    // Wait until the saving thread has streamed the next batch; a batch
+    // requested this way doesn't requeue locked servants
+    //
+    Long sequence = _batchSequence + 1;
+    if(_saveNowSequence < sequence)
+    {
+        _saveNowSequence = sequence;
+    }
     notifyAll();
-    do
+
+    while(_streamedSequence < sequence)
     {
         wait();
     }
-    while(find(_saveNowThreads.begin(), _saveNowThreads.end(), myself) != _saveNowThreads.end());
 }
 
 void
 Freeze::BackgroundSaveEvictorI::evict()
 {
     //
-    // Must be called with *this locked
+    // Must be called with _sizeMutex locked
     //
+    for(size_t i = 0; i < _segments.size(); ++i)
+    {
+        Segment& segment = *_segments[i];
+        IceUtil::Mutex::Lock sync(segment.mutex);
+        segment.policy->setCapacity(segmentSize(i));
+        segment.policy->setByteCapacity(segmentBytes(i));
+        evict(segment);
+    }
+}
 
-    assert(_currentEvictorSize == _evictorList.size());
-
-    list<BackgroundSaveEvictorElementPtr>::reverse_iterator p = _evictorList.rbegin();
+void
+Freeze::BackgroundSaveEvictorI::evict(Segment& segment)
+{
+    //
+    // Must be called with segment locked
+    //
 
-    while(_currentEvictorSize > _evictorSize)
+    if(!segment.policy->overflow())
     {
-        //
-        // Get the last unused element from the evictor queue.
-        //
-        while(p != _evictorList.rend())
-        {
-            if((*p)->usageCount == 0)
-            {
-                break; // Fine, servant is not in use (and not in the modifiedQueue)
-            }
-            ++p;
-        }
-        if(p == _evictorList.rend())
-        {
-            //
-            // All servants are active, can't evict any further.
-            //
-            break;
-        }
+        return;
+    }
+    size_t size = segment.policy->size();
 
-        BackgroundSaveEvictorElementPtr& element = *p;
+    //
+    // The policy selects the objects to evict among the unused objects
+    // (not in use and not in the modifiedQueue); if all servants are
+    // active, we can't evict any further.
+    //
+    vector<BackgroundSaveEvictorElementPtr> victims;
+    segment.policy->evict(isEvictable, victims);
+
+    for(vector<BackgroundSaveEvictorElementPtr>::const_iterator p = victims.begin(); p != victims.end(); ++p)
+    {
+        const BackgroundSaveEvictorElementPtr& element = *p;
         assert(!element->stale);
         assert(element->keepCount == 0);
 
-        if(_trace >= 2 || (_trace >= 1 && _evictorList.size() % 50 == 0))
+        if(_trace >= 2 || (_trace >= 1 && size % 50 == 0))
         {
             string facet = element->store.facet();
 
@@ -1280,23 +2149,23 @@ Freeze::BackgroundSaveEvictorI::evict()
             {
                 out << "-f \"" << facet << "\" ";
             }
-            out << "from the queue\n"
-                << "number of elements in the queue: " << _currentEvictorSize;
+            out << "from the " << segment.policy->name() << " queue\n"
+                << "number of elements in the queue: " << size;
         }
+        --size;
 
-        //
-        // Remove last unused element from the evictor queue.
-        //
         element->stale = true;
         element->store.unpin(element->cachePosition);
-        p = list<BackgroundSaveEvictorElementPtr>::reverse_iterator(_evictorList.erase(element->evictPosition));
-        _currentEvictorSize--;
     }
 }
 
 void
-Freeze::BackgroundSaveEvictorI::fixEvictPosition(const BackgroundSaveEvictorElementPtr& element)
+Freeze::BackgroundSaveEvictorI::fixEvictPosition(Segment& segment, const BackgroundSaveEvictorElementPtr& element)
 {
+    //
+    // Must be called with segment locked
+    //
+
     assert(!element->stale);
 
     if(element->keepCount == 0)
@@ -1307,25 +2176,26 @@ Freeze::BackgroundSaveEvictorI::fixEvictPosition(const BackgroundSaveEvictorElem
             // New object
             //
             element->usageCount = 0;
-            _currentEvictorSize++;
+            segment.policy->add(element);
         }
         else
         {
-            _evictorList.erase(element->evictPosition);
+            segment.policy->touch(element);
         }
-        _evictorList.push_front(element);
-        element->evictPosition = _evictorList.begin();
     }
 }
 
 void
-Freeze::BackgroundSaveEvictorI::evict(const BackgroundSaveEvictorElementPtr& element)
+Freeze::BackgroundSaveEvictorI::evict(Segment& segment, const BackgroundSaveEvictorElementPtr& element)
 {
+    //
+    // Must be called with segment locked
+    //
+
     assert(!element->stale);
     assert(element->keepCount == 0);
 
-    _evictorList.erase(element->evictPosition);
-    _currentEvictorSize--;
+    segment.policy->remove(element);
     element->stale = true;
     element->store.unpin(element->cachePosition);
 }
@@ -1333,36 +2203,152 @@ Freeze::BackgroundSaveEvictorI::evict(const BackgroundSaveEvictorElementPtr& ele
 void
 Freeze::BackgroundSaveEvictorI::addToModifiedQueue(const BackgroundSaveEvictorElementPtr& element)
 {
+    //
+    // Must be called with the element's segment locked
+    //
     element->usageCount++;
+
+    Lock sync(*this);
     _modifiedQueue.push_back(element);
+    _modifiedBytes += element->policyEntry.footprint;
+    _unsavedObjects++;
+    _unsavedBytes += element->policyEntry.footprint;
 
-    if(_saveSizeTrigger >= 0 && static_cast<Int>(_modifiedQueue.size()) >= _saveSizeTrigger)
+    if((_saveSizeTrigger >= 0 && static_cast<Int>(_modifiedQueue.size()) >= _saveSizeTrigger) ||
+       overHighWaterMark())
     {
         notifyAll();
     }
 }
 
 void
+Freeze::BackgroundSaveEvictorI::throttle()
+{
+    //
+    // Must be called without any segment or element locked
+    //
+    Lock sync(*this);
+    if(!overHighWaterMark())
+    {
+        return;
+    }
+
+    IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    IceUtil::Time deadline = start + _backpressureTimeout;
+    IceUtil::Time now = start;
+
+    while(!_savingThreadDone && overHighWaterMark())
+    {
+        if(_backpressureTimeout <= IceUtil::Time())
+        {
+            wait();
+        }
+        else if(now >= deadline || timedWait(deadline - now) == false)
+        {
+            break;
+        }
+        now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    }
+    now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+
+    _heldBackCalls++;
+    _heldBackTime += now - start;
+    if(now - start > _maxHeldBackTime)
+    {
+        _maxHeldBackTime = now - start;
+    }
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "held back caller for " << static_cast<Int>((now - start).toMilliSeconds()) << " ms with "
+            << _unsavedObjects << " unsaved objects (" << _unsavedBytes << " bytes)";
+    }
+}
+
+bool
+Freeze::BackgroundSaveEvictorI::overHighWaterMark() const
+{
+    //
+    // Must be called with this evictor's monitor locked
+    //
+    return (_maxModifiedObjects > 0 && _unsavedObjects >= _maxModifiedObjects) ||
+        (_maxModifiedBytes > 0 && _unsavedBytes >= _maxModifiedBytes);
+}
+
+bool
 Freeze::BackgroundSaveEvictorI::stream(const BackgroundSaveEvictorElementPtr& element, Long streamStart,
                                        const StreamedObjectPtr& obj)
 {
+    streamKey(element, streamStart, obj);
+    if(element->status != destroyed)
+    {
+        return streamValue(element, element->rec, obj);
+    }
+    return true;
+}
+
+void
+Freeze::BackgroundSaveEvictorI::streamKey(const BackgroundSaveEvictorElementPtr& element, Long streamStart,
+                                          const StreamedObjectPtr& obj)
+{
+    //
+    // Must be called with the element locked
+    //
     assert(element->status != dead);
 
     obj->status = element->status;
     obj->store = &element->store;
 
     const Identity& ident = element->cachePosition->first;
-    obj->key = new ObjectStoreBase::KeyMarshaler(ident, _communicator, _encoding);
+    obj->key = new ObjectStoreBase::KeyMarshaler(ident, *obj->store);
 
-    if(element->status != destroyed)
+    if(element->status != destroyed && obj->store->keepStats())
     {
-        const bool keepStats = obj->store->keepStats();
-        if(keepStats)
-        {
-            EvictorIBase::updateStats(element->rec.stats, streamStart);
-        }
-        obj->value = new ObjectStoreBase::ValueMarshaler(element->rec, _communicator, _encoding, keepStats);
+        EvictorIBase::updateStats(element->rec.stats, streamStart);
+    }
+}
+
+bool
+Freeze::BackgroundSaveEvictorI::streamValue(const BackgroundSaveEvictorElementPtr& element, const ObjectRecord& rec,
+                                            const StreamedObjectPtr& obj)
+{
+    //
+    // Must be called with the element locked
+    //
+    marshalValue(element, rec, obj);
+    return valueChanged(element, obj);
+}
+
+void
+Freeze::BackgroundSaveEvictorI::marshalValue(const BackgroundSaveEvictorElementPtr& element, const ObjectRecord& rec,
+                                             const StreamedObjectPtr& obj)
+{
+    obj->value = new ObjectStoreBase::ValueMarshaler(rec, _communicator, _encoding, obj->store->keepStats());
+    obj->element = element;
+    obj->size = obj->value->size();
+}
+
+bool
+Freeze::BackgroundSaveEvictorI::valueChanged(const BackgroundSaveEvictorElementPtr& element,
+                                             const StreamedObjectPtr& obj)
+{
+    //
+    // Must be called with the element locked
+    //
+    // A modified object that marshals to the same bytes as its last save
+    // doesn't need to be written again. With statistics, the last save
+    // time changes each time, so these values are never the same. Only
+    // the digests are compared: a modified value with the same size and
+    // hashes as the saved value is not saved.
+    //
+    ObjectStoreBase::Digest digest = obj->value->digest();
+    if(obj->status == modified && !obj->store->keepStats() && digest == element->marshaled)
+    {
+        return false;
     }
+    element->marshaled = digest;
+    return true;
 }
 
 Freeze::BackgroundSaveEvictorElement::BackgroundSaveEvictorElement(ObjectRecord& r,
@@ -1372,7 +2358,8 @@ Freeze::BackgroundSaveEvictorElement::BackgroundSaveEvictorElement(ObjectRecord&
     keepCount(0),
     stale(true),
     rec(r),
-    status(clean)
+    status(clean),
+    requeued(false)
 {
 }
 
@@ -1381,7 +2368,8 @@ Freeze::BackgroundSaveEvictorElement::BackgroundSaveEvictorElement(ObjectStore<B
     usageCount(-1),
     keepCount(0),
     stale(true),
-    status(clean)
+    status(clean),
+    requeued(false)
 {
     const Statistics cleanStats = { 0, 0, 0 };
     rec.stats = cleanStats;
@@ -1396,4 +2384,6 @@ Freeze::BackgroundSaveEvictorElement::init(ObjectStore<BackgroundSaveEvictorElem
 {
     stale = false;
     cachePosition = p;
+    policyEntry.ident = &p->first;
+    policyEntry.store = &store;
 }
@@ -9,6 +9,7 @@
 
 #include <Freeze/EvictorI.h>
 #include <Freeze/BackgroundSaveEvictor.h>
+#include <Freeze/SaveController.h>
 
 namespace Freeze
 {
@@ -78,9 +79,9 @@ struct BackgroundSaveEvictorElement : public Ice::LocalObject
     ObjectStore<BackgroundSaveEvictorElement>::Position cachePosition;
 
     //
-    // Protected by EvictorI
+    // Protected by the mutex of the evictor segment of this element
     //
-    std::list<BackgroundSaveEvictorElementPtr>::iterator evictPosition;
+    EvictionPolicyEntry<BackgroundSaveEvictorElement> policyEntry;
     int usageCount;
     int keepCount;
     bool stale;
@@ -91,6 +92,12 @@ struct BackgroundSaveEvictorElement : public Ice::LocalObject
     IceUtil::Mutex mutex;
     ObjectRecord rec;
     Ice::Byte status;
+    bool requeued; // Servant was locked during the last snapshot attempt
+
+    //
+    // Digest of the value last streamed, with a 0 size for a new object
+    //
+    ObjectStoreBase::Digest marshaled;
 };
 
 class BackgroundSaveEvictorI : public BackgroundSaveEvictor, public EvictorI<BackgroundSaveEvictorElement>,
@@ -112,12 +119,20 @@ public:
 
     virtual bool hasFacet(const Ice::Identity&, const std::string&);
 
+    virtual Ice::Int preloadFacets(const Ice::Identity&);
+    virtual void prefetchNow(const std::vector<Ice::Identity>&, const std::string&);
+
+    virtual void pinServants(ObjectStoreBase*, const std::vector<Ice::Identity>&, std::map<Ice::Identity, Ice::ObjectPtr>&);
+
     virtual void finished(const Ice::Current&, const Ice::ObjectPtr&, const Ice::LocalObjectPtr&);
     virtual void deactivate(const std::string&);
 
     virtual ~BackgroundSaveEvictorI();
 
     virtual TransactionIPtr beforeQuery();
+    virtual bool unsavedObjects(const ObjectStoreBase*, std::vector<UnsavedObject>&);
+
+    BackgroundSaveStatus status();
 
     //
     // Thread
@@ -127,7 +142,7 @@ public:
     struct StreamedObject : public IceUtil::Shared
     {
         StreamedObject() :
-            key(0), value(0)
+            key(0), value(0), size(0)
         {
         }
 
@@ -142,6 +157,12 @@ public:
         Ice::Byte status;
         ObjectStore<BackgroundSaveEvictorElement>* store;
 
+        //
+        // The element of a streamed value, and the size of the value
+        //
+        BackgroundSaveEvictorElementPtr element;
+        size_t size;
+
     private:
 
         StreamedObject(const StreamedObject&);
@@ -159,41 +180,166 @@ protected:
 
 private:
 
-    void saveNow();
+    class WriterThread;
+    friend class WriterThread;
 
-    void evict(const BackgroundSaveEvictorElementPtr&);
-    void addToModifiedQueue(const BackgroundSaveEvictorElementPtr&);
-    void fixEvictPosition(const BackgroundSaveEvictorElementPtr&);
+    class StreamThread;
+    friend class StreamThread;
 
-    void stream(const BackgroundSaveEvictorElementPtr&, Ice::Long, const StreamedObjectPtr&);
+    //
+    // The objects swapped out of the modified queue at once; the saving
+    // thread streams them and hands them over to the writer thread
+    //
+    struct Batch
+    {
+        Ice::Long sequence;
+        IceUtil::Time swapTime;
+        size_t bytes;
+        std::deque<BackgroundSaveEvictorElementPtr> allObjects;
+        std::deque<BackgroundSaveEvictorElementPtr> deadObjects;
+        std::deque<StreamedObjectPtr> streamedObjects;
+
+        //
+        // The streamed objects read by queries without StrictQueries; the
+        // writer thread consumes streamedObjects
+        //
+        std::vector<StreamedObjectPtr> queryObjects;
+    };
 
     //
-    // The _evictorList contains a list of all objects we keep,
-    // with the most recently used first.
+    // A slice of the modified objects, streamed by the saving thread or
+    // by a stream thread
     //
-    std::list<BackgroundSaveEvictorElementPtr> _evictorList;
-    std::list<BackgroundSaveEvictorElementPtr>::size_type _currentEvictorSize;
+    struct StreamSlice
+    {
+        StreamSlice(const std::deque<BackgroundSaveEvictorElementPtr>& o, Ice::Long s, bool r) :
+            objects(o), streamStart(s), mayRequeue(r), unchanged(0)
+        {
+        }
+
+        const std::deque<BackgroundSaveEvictorElementPtr>& objects;
+
+        //
+        // The positions in objects of the elements of this slice; all the
+        // entries of an element are in the same slice, in queue order
+        //
+        std::vector<size_t> positions;
+
+        const Ice::Long streamStart;
+        const bool mayRequeue;
+
+        std::deque<StreamedObjectPtr> streamed;
+        std::deque<BackgroundSaveEvictorElementPtr> dead;
+        std::deque<BackgroundSaveEvictorElementPtr> requeued;
+        size_t unchanged;
+        std::string error;
+    };
+
+    void saveNow();
+    void streamNow();
+
+    void evict(Segment&);
+    void evict(Segment&, const BackgroundSaveEvictorElementPtr&);
+    void addToModifiedQueue(const BackgroundSaveEvictorElementPtr&);
+    void throttle();
+    bool overHighWaterMark() const;
+    void fixEvictPosition(Segment&, const BackgroundSaveEvictorElementPtr&);
+
+    bool stream(const BackgroundSaveEvictorElementPtr&, Ice::Long, const StreamedObjectPtr&);
+    void streamKey(const BackgroundSaveEvictorElementPtr&, Ice::Long, const StreamedObjectPtr&);
+    bool streamValue(const BackgroundSaveEvictorElementPtr&, const ObjectRecord&, const StreamedObjectPtr&);
+    void marshalValue(const BackgroundSaveEvictorElementPtr&, const ObjectRecord&, const StreamedObjectPtr&);
+    bool valueChanged(const BackgroundSaveEvictorElementPtr&, const StreamedObjectPtr&);
+    void streamSlice(StreamSlice&);
+    void runStreamThread();
+    void runWriter();
 
     //
     // The _modifiedQueue contains a queue of all modified objects
     // Each element in the queue "owns" a usage count, to ensure the
     // element containing the pointed element remains in the cache.
     //
+    // Lock order: segment mutex, element mutex and finally this
+    // evictor's monitor, which protects _modifiedQueue and the batch
+    // hand-over between the saving and writer threads.
+    //
     std::deque<BackgroundSaveEvictorElementPtr> _modifiedQueue;
 
     bool _savingThreadDone;
+
+    //
+    // Each batch gets a sequence number. The writer thread saves the
+    // batches in order, while the saving thread streams the next batch.
+    // saveNow requests a batch and waits until it's saved, and streamNow
+    // until it's streamed.
+    //
+    Ice::Long _batchSequence; // Last batch swapped out of the modified queue
+    Ice::Long _savedSequence; // Last batch saved by the writer thread
+    Ice::Long _streamedSequence; // Last batch streamed by the saving thread
+    Ice::Long _saveNowSequence; // Last batch requested by saveNow
+    Batch* _streamingBatch; // Being streamed by the saving thread
+    Batch* _pendingBatch; // Streamed and waiting for the writer thread
+    Batch* _writingBatch; // Being saved by the writer thread
+    bool _writerDone;
+    IceUtil::ThreadControl _writerThread;
+
     long _streamTimeout;
+    bool _snapshotStreaming;
+    bool _strictQueries;
     IceUtil::TimerPtr _timer;
 
     //
-    // Threads that have requested a "saveNow" and are waiting for
-    // its completion
+    // Protected by this evictor's monitor; the save controller, when
+    // enabled, updates them after each batch
     //
-    std::deque<IceUtil::ThreadControl> _saveNowThreads;
-
     Ice::Int _saveSizeTrigger;
     Ice::Int _maxTxSize;
     IceUtil::Time _savePeriod;
+    IceUtil::Time _commitLatency;
+    Ice::Int _deadlocks;
+
+    //
+    // Only used by the writer thread; null unless AdaptiveSave is set
+    //
+    IceInternal::UniquePtr<SaveController> _saveController;
+
+    //
+    // Backpressure: above MaxModifiedObjects or MaxModifiedBytes unsaved
+    // objects, the saving thread saves right away, and finished and
+    // addFacet wait until the writer thread catches up, for at most
+    // BackpressureTimeout.
+    //
+    // Protected by this evictor's monitor
+    //
+    size_t _modifiedBytes; // Footprint of the objects in _modifiedQueue
+    size_t _unsavedObjects; // In _modifiedQueue or in a batch not saved yet
+    size_t _unsavedBytes;
+    Ice::Long _heldBackCalls;
+    IceUtil::Time _heldBackTime;
+    IceUtil::Time _maxHeldBackTime;
+
+    //
+    // Immutable; 0 means no limit
+    //
+    size_t _maxModifiedObjects;
+    size_t _maxModifiedBytes;
+    IceUtil::Time _backpressureTimeout;
+
+    //
+    // The stream threads stream slices of the modified objects in parallel
+    // with the saving thread; the writer thread alone saves them.
+    //
+    // Protected by _streamMonitor
+    //
+    IceUtil::Monitor<IceUtil::Mutex> _streamMonitor;
+    std::deque<StreamSlice*> _streamSlices;
+    size_t _pendingSlices;
+    bool _streamThreadsDone;
+
+    //
+    // Immutable
+    //
+    std::vector<IceUtil::ThreadControl> _streamThreads;
 };
 
 }
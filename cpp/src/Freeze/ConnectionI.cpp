@@ -19,14 +19,14 @@ Freeze::ConnectionI::beginTransaction()
 }
 
 Freeze::TransactionIPtr
-Freeze::ConnectionI::beginTransactionI()
+Freeze::ConnectionI::beginTransactionI(bool snapshot)
 {
     if(_transaction)
     {
         throw TransactionAlreadyInProgressException(__FILE__, __LINE__);
     }
     closeAllIterators();
-    _transaction = new TransactionI(this);
+    _transaction = new TransactionI(this, snapshot);
     return _transaction;
 }
 
@@ -57,7 +57,7 @@ public:
 
     ConnectionI(const SharedDbEnvPtr&);
 
-    TransactionIPtr beginTransactionI();
+    TransactionIPtr beginTransactionI(bool = false);
 
     void closeAllIterators();
 
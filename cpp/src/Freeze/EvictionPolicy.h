@@ -0,0 +1,740 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_EVICTION_POLICY_H
+#define FREEZE_EVICTION_POLICY_H
+
+#include <IceUtil/IceUtil.h>
+#include <Ice/Identity.h>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace Freeze
+{
+
+class ObjectStoreBase;
+
+//
+// The bookkeeping of an eviction policy in each evictor element.
+// Protected by the mutex of the evictor segment of this element.
+//
+template<class T>
+struct EvictionPolicyEntry
+{
+    EvictionPolicyEntry() :
+        ident(0),
+        store(0),
+        queue(0),
+        referenced(false),
+        footprint(0)
+    {
+    }
+
+    //
+    // Set when the element is pinned in the cache, valid as long
+    // as the element is not stale
+    //
+    const Ice::Identity* ident;
+    const ObjectStoreBase* store;
+
+    //
+    // The policy queue holding this element (0 means none), and
+    // the position of this element in this queue
+    //
+    int queue;
+    typename std::list<IceUtil::Handle<T> >::iterator position;
+
+    //
+    // Reference bit, for CLOCK
+    //
+    bool referenced;
+
+    //
+    // Estimated memory footprint of this element, in bytes; updated
+    // with EvictionPolicy::setFootprint
+    //
+    size_t footprint;
+};
+
+//
+// The identities of recently evicted objects, used by the policies
+// that adapt to objects reloaded soon after their eviction.
+//
+class GhostList
+{
+public:
+
+    typedef std::pair<const ObjectStoreBase*, Ice::Identity> Key;
+
+    //
+    // Adds key as the most recent ghost
+    //
+    void
+    push(const Key& key)
+    {
+        remove(key);
+        _list.push_front(key);
+        _map.insert(Map::value_type(key, _list.begin()));
+    }
+
+    //
+    // Returns true if key was in this list
+    //
+    bool
+    remove(const Key& key)
+    {
+        Map::iterator p = _map.find(key);
+        if(p == _map.end())
+        {
+            return false;
+        }
+        _list.erase(p->second);
+        _map.erase(p);
+        return true;
+    }
+
+    //
+    // Forgets the oldest ghost
+    //
+    void
+    pop()
+    {
+        assert(!_list.empty());
+        _map.erase(_list.back());
+        _list.pop_back();
+    }
+
+    size_t
+    size() const
+    {
+        return _map.size();
+    }
+
+    bool
+    empty() const
+    {
+        return _list.empty();
+    }
+
+private:
+
+    typedef std::list<Key> List;
+    typedef std::map<Key, List::iterator> Map;
+
+    List _list;
+    Map _map;
+};
+
+//
+// An eviction policy decides which objects of an evictor segment are evicted.
+// Each segment has its own policy, always used with the segment's mutex locked.
+//
+template<class T>
+class EvictionPolicy
+{
+public:
+
+    typedef IceUtil::Handle<T> ElementPtr;
+
+    //
+    // Returns false if the given element can't be evicted at this time
+    //
+    typedef bool (*Evictable)(const ElementPtr&);
+
+    virtual ~EvictionPolicy()
+    {
+    }
+
+    //
+    // Adds an element that is not yet managed by this policy
+    //
+    virtual void add(const ElementPtr&) = 0;
+
+    //
+    // Records an access to an element managed by this policy
+    //
+    virtual void touch(const ElementPtr&) = 0;
+
+    //
+    // Removes an element from this policy, for example because it is
+    // destroyed or kept in the cache by the application
+    //
+    virtual void remove(const ElementPtr&) = 0;
+
+    //
+    // Selects evictable elements until this policy no longer overflows,
+    // removes them from this policy and appends them to victims
+    //
+    virtual void evict(Evictable, std::vector<ElementPtr>&) = 0;
+
+    virtual const char* name() const = 0;
+
+    size_t
+    size() const
+    {
+        return _size;
+    }
+
+    size_t
+    capacity() const
+    {
+        return _capacity;
+    }
+
+    void
+    setCapacity(size_t capacity)
+    {
+        _capacity = capacity;
+    }
+
+    //
+    // Total footprint of the elements managed by this policy
+    //
+    size_t
+    bytes() const
+    {
+        return _bytes;
+    }
+
+    //
+    // 0 means no byte budget
+    //
+    size_t
+    byteCapacity() const
+    {
+        return _byteCapacity;
+    }
+
+    void
+    setByteCapacity(size_t byteCapacity)
+    {
+        _byteCapacity = byteCapacity;
+    }
+
+    //
+    // Returns true if there are more elements, or more bytes, than allowed
+    //
+    bool
+    overflow() const
+    {
+        return _size > _capacity || (_byteCapacity > 0 && _bytes > _byteCapacity);
+    }
+
+    //
+    // Updates the footprint of an element, managed or not by this policy
+    //
+    void
+    setFootprint(const ElementPtr& element, size_t footprint)
+    {
+        if(element->policyEntry.queue != 0)
+        {
+            _bytes = _bytes - element->policyEntry.footprint + footprint;
+        }
+        element->policyEntry.footprint = footprint;
+    }
+
+protected:
+
+    typedef std::list<ElementPtr> Queue;
+
+    EvictionPolicy() :
+        _size(0),
+        _capacity(0),
+        _bytes(0),
+        _byteCapacity(0)
+    {
+    }
+
+    void
+    push(Queue& q, int id, const ElementPtr& element)
+    {
+        q.push_front(element);
+        element->policyEntry.position = q.begin();
+        element->policyEntry.queue = id;
+        element->policyEntry.referenced = false;
+        ++_size;
+        _bytes += element->policyEntry.footprint;
+    }
+
+    static void
+    moveToFront(Queue& to, Queue& from, int id, const ElementPtr& element)
+    {
+        //
+        // splice does not invalidate the position
+        //
+        to.splice(to.begin(), from, element->policyEntry.position);
+        element->policyEntry.queue = id;
+    }
+
+    void
+    erase(Queue& q, const ElementPtr& element)
+    {
+        //
+        // element may refer to the queue entry we erase
+        //
+        ElementPtr e = element;
+        e->policyEntry.queue = 0;
+        q.erase(e->policyEntry.position);
+        --_size;
+        _bytes -= e->policyEntry.footprint;
+    }
+
+    //
+    // Removes the least recently inserted or moved evictable element of q;
+    // returns 0 if there is none
+    //
+    ElementPtr
+    evictLast(Queue& q, Evictable evictable)
+    {
+        typename Queue::iterator p = q.end();
+        while(p != q.begin())
+        {
+            --p;
+            if(evictable(*p))
+            {
+                ElementPtr element = *p;
+                erase(q, element);
+                return element;
+            }
+        }
+        return 0;
+    }
+
+    static GhostList::Key
+    ghostKey(const ElementPtr& element)
+    {
+        assert(element->policyEntry.ident != 0);
+        return GhostList::Key(element->policyEntry.store, *element->policyEntry.ident);
+    }
+
+    size_t _size;
+    size_t _capacity;
+    size_t _bytes;
+    size_t _byteCapacity;
+};
+
+//
+// Least recently used: each access moves the object to the front of
+// the queue. This is the default policy.
+//
+template<class T>
+class LruEvictionPolicy : public EvictionPolicy<T>
+{
+public:
+
+    typedef typename EvictionPolicy<T>::ElementPtr ElementPtr;
+    typedef typename EvictionPolicy<T>::Evictable Evictable;
+
+    virtual void
+    add(const ElementPtr& element)
+    {
+        this->push(_queue, 1, element);
+    }
+
+    virtual void
+    touch(const ElementPtr& element)
+    {
+        this->moveToFront(_queue, _queue, 1, element);
+    }
+
+    virtual void
+    remove(const ElementPtr& element)
+    {
+        this->erase(_queue, element);
+    }
+
+    virtual void
+    evict(Evictable evictable, std::vector<ElementPtr>& victims)
+    {
+        //
+        // Single pass from the back of the queue, skipping the objects in use
+        //
+        typename EvictionPolicy<T>::Queue::iterator p = _queue.end();
+        while(this->overflow() && p != _queue.begin())
+        {
+            --p;
+            if(evictable(*p))
+            {
+                ElementPtr element = *p;
+                ++p;
+                this->erase(_queue, element);
+                victims.push_back(element);
+            }
+        }
+    }
+
+    virtual const char*
+    name() const
+    {
+        return "LRU";
+    }
+
+private:
+
+    typename EvictionPolicy<T>::Queue _queue;
+};
+
+//
+// CLOCK: an access only sets the reference bit of the object, and the
+// clock hand gives a second chance to referenced objects. New objects
+// are not referenced, so a scan does not push the working set out.
+//
+template<class T>
+class ClockEvictionPolicy : public EvictionPolicy<T>
+{
+public:
+
+    typedef typename EvictionPolicy<T>::ElementPtr ElementPtr;
+    typedef typename EvictionPolicy<T>::Evictable Evictable;
+
+    ClockEvictionPolicy()
+    {
+        _hand = _queue.end();
+    }
+
+    virtual void
+    add(const ElementPtr& element)
+    {
+        //
+        // Insert just behind the hand, i.e. the last position it visits
+        //
+        element->policyEntry.position = _queue.insert(_hand, element);
+        element->policyEntry.queue = 1;
+        element->policyEntry.referenced = false;
+        ++this->_size;
+        this->_bytes += element->policyEntry.footprint;
+    }
+
+    virtual void
+    touch(const ElementPtr& element)
+    {
+        element->policyEntry.referenced = true;
+    }
+
+    virtual void
+    remove(const ElementPtr& element)
+    {
+        if(_hand == element->policyEntry.position)
+        {
+            ++_hand;
+        }
+        this->erase(_queue, element);
+    }
+
+    virtual void
+    evict(Evictable evictable, std::vector<ElementPtr>& victims)
+    {
+        //
+        // Two full turns are enough to clear all the reference bits; we
+        // stop after that if all the remaining objects are in use.
+        //
+        size_t steps = 2 * this->_size + 1;
+        while(this->overflow() && !_queue.empty() && steps-- > 0)
+        {
+            if(_hand == _queue.end())
+            {
+                _hand = _queue.begin();
+            }
+
+            ElementPtr element = *_hand;
+            if(!evictable(element))
+            {
+                ++_hand;
+            }
+            else if(element->policyEntry.referenced)
+            {
+                element->policyEntry.referenced = false;
+                ++_hand;
+            }
+            else
+            {
+                ++_hand;
+                this->erase(_queue, element);
+                victims.push_back(element);
+            }
+        }
+    }
+
+    virtual const char*
+    name() const
+    {
+        return "CLOCK";
+    }
+
+private:
+
+    typename EvictionPolicy<T>::Queue _queue;
+    typename EvictionPolicy<T>::Queue::iterator _hand;
+};
+
+//
+// 2Q: new objects enter a FIFO queue (A1in) and are promoted to the main
+// LRU queue (Am) only when they are reloaded shortly after their eviction,
+// which is detected with the A1out ghost list. Objects seen only once, for
+// example during a scan, therefore never displace the objects of Am.
+//
+template<class T>
+class TwoQueueEvictionPolicy : public EvictionPolicy<T>
+{
+public:
+
+    typedef typename EvictionPolicy<T>::ElementPtr ElementPtr;
+    typedef typename EvictionPolicy<T>::Evictable Evictable;
+
+    virtual void
+    add(const ElementPtr& element)
+    {
+        if(_a1out.remove(this->ghostKey(element)))
+        {
+            this->push(_am, am, element);
+        }
+        else
+        {
+            this->push(_a1in, a1in, element);
+        }
+    }
+
+    virtual void
+    touch(const ElementPtr& element)
+    {
+        //
+        // Accesses to objects in A1in are considered correlated
+        //
+        if(element->policyEntry.queue == am)
+        {
+            this->moveToFront(_am, _am, am, element);
+        }
+    }
+
+    virtual void
+    remove(const ElementPtr& element)
+    {
+        this->erase(element->policyEntry.queue == am ? _am : _a1in, element);
+    }
+
+    virtual void
+    evict(Evictable evictable, std::vector<ElementPtr>& victims)
+    {
+        //
+        // A1in gets 1/4 of the capacity, and A1out remembers the identities
+        // of up to 1/2 of the capacity
+        //
+        const size_t kin = std::max<size_t>(this->_capacity / 4, 1);
+        const size_t kout = std::max<size_t>(this->_capacity / 2, 1);
+
+        while(this->overflow())
+        {
+            bool fromA1in = _a1in.size() > kin || _am.empty();
+
+            ElementPtr element = this->evictLast(fromA1in ? _a1in : _am, evictable);
+            if(element == 0)
+            {
+                fromA1in = !fromA1in;
+                element = this->evictLast(fromA1in ? _a1in : _am, evictable);
+                if(element == 0)
+                {
+                    break;
+                }
+            }
+
+            if(fromA1in)
+            {
+                _a1out.push(this->ghostKey(element));
+                while(_a1out.size() > kout)
+                {
+                    _a1out.pop();
+                }
+            }
+            victims.push_back(element);
+        }
+    }
+
+    virtual const char*
+    name() const
+    {
+        return "2Q";
+    }
+
+private:
+
+    static const int a1in = 1;
+    static const int am = 2;
+
+    typename EvictionPolicy<T>::Queue _a1in;
+    typename EvictionPolicy<T>::Queue _am;
+    GhostList _a1out;
+};
+
+//
+// ARC (adaptive replacement cache): T1 holds the objects accessed once
+// recently and T2 the objects accessed at least twice. The ghost lists
+// B1 and B2 remember the objects recently evicted from T1 and T2, and
+// reloads of these objects adapt the target size of T1.
+//
+template<class T>
+class ArcEvictionPolicy : public EvictionPolicy<T>
+{
+public:
+
+    typedef typename EvictionPolicy<T>::ElementPtr ElementPtr;
+    typedef typename EvictionPolicy<T>::Evictable Evictable;
+
+    ArcEvictionPolicy() :
+        _p(0)
+    {
+    }
+
+    virtual void
+    add(const ElementPtr& element)
+    {
+        const size_t c = this->_capacity;
+        GhostList::Key key = this->ghostKey(element);
+
+        size_t b1 = _b1.size();
+        size_t b2 = _b2.size();
+
+        if(_b1.remove(key))
+        {
+            //
+            // T1 was too small
+            //
+            size_t delta = std::max<size_t>(b2 / b1, 1);
+            _p = std::min(c, _p + delta);
+            this->push(_t2, t2, element);
+        }
+        else if(_b2.remove(key))
+        {
+            //
+            // T2 was too small
+            //
+            size_t delta = std::max<size_t>(b1 / b2, 1);
+            _p = _p > delta ? _p - delta : 0;
+            this->push(_t2, t2, element);
+        }
+        else
+        {
+            this->push(_t1, t1, element);
+
+            while(_t1.size() + _b1.size() > c && !_b1.empty())
+            {
+                _b1.pop();
+            }
+            while(this->_size + _b1.size() + _b2.size() > 2 * c && !_b2.empty())
+            {
+                _b2.pop();
+            }
+        }
+    }
+
+    virtual void
+    touch(const ElementPtr& element)
+    {
+        if(element->policyEntry.queue == t1)
+        {
+            this->moveToFront(_t2, _t1, t2, element);
+        }
+        else
+        {
+            this->moveToFront(_t2, _t2, t2, element);
+        }
+    }
+
+    virtual void
+    remove(const ElementPtr& element)
+    {
+        this->erase(element->policyEntry.queue == t1 ? _t1 : _t2, element);
+    }
+
+    virtual void
+    evict(Evictable evictable, std::vector<ElementPtr>& victims)
+    {
+        while(this->overflow())
+        {
+            bool fromT1 = !_t1.empty() && (_t1.size() > _p || _t2.empty());
+
+            ElementPtr element = this->evictLast(fromT1 ? _t1 : _t2, evictable);
+            if(element == 0)
+            {
+                fromT1 = !fromT1;
+                element = this->evictLast(fromT1 ? _t1 : _t2, evictable);
+                if(element == 0)
+                {
+                    break;
+                }
+            }
+
+            if(fromT1)
+            {
+                _b1.push(this->ghostKey(element));
+            }
+            else
+            {
+                _b2.push(this->ghostKey(element));
+            }
+            victims.push_back(element);
+        }
+
+        while(_b1.size() > this->_capacity)
+        {
+            _b1.pop();
+        }
+        while(_b2.size() > this->_capacity)
+        {
+            _b2.pop();
+        }
+    }
+
+    virtual const char*
+    name() const
+    {
+        return "ARC";
+    }
+
+private:
+
+    static const int t1 = 1;
+    static const int t2 = 2;
+
+    typename EvictionPolicy<T>::Queue _t1;
+    typename EvictionPolicy<T>::Queue _t2;
+    GhostList _b1;
+    GhostList _b2;
+
+    //
+    // Target size of T1
+    //
+    size_t _p;
+};
+
+//
+// Returns 0 if the policy name is unknown
+//
+template<class T> EvictionPolicy<T>*
+createEvictionPolicy(const std::string& name)
+{
+    if(name.empty() || name == "LRU")
+    {
+        return new LruEvictionPolicy<T>;
+    }
+    else if(name == "CLOCK")
+    {
+        return new ClockEvictionPolicy<T>;
+    }
+    else if(name == "2Q")
+    {
+        return new TwoQueueEvictionPolicy<T>;
+    }
+    else if(name == "ARC")
+    {
+        return new ArcEvictionPolicy<T>;
+    }
+    return 0;
+}
+
+}
+
+#endif
@@ -9,24 +9,127 @@
 #include <Freeze/Util.h>
 #include <Freeze/EvictorIteratorI.h>
 #include <Freeze/PingObject.h>
+#include <Freeze/CatalogIndexList.h>
 
 #include <IceUtil/IceUtil.h>
+#include <IceUtil/MutexPtrLock.h>
 
 #include <Ice/StringConverter.h>
 
 #include <typeinfo>
+#include <fstream>
+#include <set>
+#include <algorithm>
 
 using namespace std;
 using namespace Freeze;
 using namespace Ice;
 using namespace IceUtil;
 
+namespace
+{
+
+//
+// The process-wide byte budget, shared equally by all the evictors; it's
+// read once, with the properties of the first evictor registered
+//
+IceUtil::Mutex* memoryBudgetMutex = 0;
+set<EvictorIBase*>* memoryBudgetEvictors = 0;
+size_t globalMaxBytes = 0;
+bool globalMaxBytesRead = false;
+
+class Init
+{
+public:
+
+    Init()
+    {
+        memoryBudgetMutex = new IceUtil::Mutex;
+        memoryBudgetEvictors = new set<EvictorIBase*>;
+    }
+
+    ~Init()
+    {
+        delete memoryBudgetMutex;
+        memoryBudgetMutex = 0;
+        delete memoryBudgetEvictors;
+        memoryBudgetEvictors = 0;
+    }
+};
+Init init;
+
+//
+// Parses a number of bytes, with an optional K, M or G suffix
+//
+bool
+parseBytes(const string& value, Int64& bytes)
+{
+    istringstream is(value);
+    if(!(is >> bytes) || bytes < 0)
+    {
+        return false;
+    }
+
+    string unit;
+    is >> unit;
+    if(unit == "K")
+    {
+        bytes *= 1024;
+    }
+    else if(unit == "M")
+    {
+        bytes *= 1024 * 1024;
+    }
+    else if(unit == "G")
+    {
+        bytes *= 1024 * 1024 * 1024;
+    }
+    else if(!unit.empty())
+    {
+        return false;
+    }
+    return true;
+}
+
+//
+// The memory limit of the cgroup (v2 or v1) of this process; 0 if
+// there is no such limit. This limit is read once, so a later change of
+// the limit doesn't change the budget of the evictors.
+//
+Int64
+cgroupMemoryLimit()
+{
+    const char* files[] = { "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes" };
+
+    for(size_t i = 0; i < sizeof(files) / sizeof(*files); ++i)
+    {
+        ifstream is(files[i]);
+        string value;
+        if(is >> value)
+        {
+            //
+            // "max" with v2, and a very large value with v1, means no limit
+            //
+            Int64 limit;
+            if(value != "max" && parseBytes(value, limit) && limit < (static_cast<Int64>(1) << 60))
+            {
+                return limit;
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+}
+
 //
 // Static members
 //
 
 string Freeze::EvictorIBase::defaultDb = "$default";
 string Freeze::EvictorIBase::indexPrefix = "$index:";
+string Freeze::EvictorIBase::colocatedDbName = "$facets";
 
 //
 // DeactivateController
@@ -143,6 +246,8 @@ Freeze::EvictorIBase::EvictorIBase(const ObjectAdapterPtr& adapter,
                                    const ServantInitializerPtr& initializer,
                                    bool createDb) :
     _evictorSize(10),
+    _evictorBytes(0),
+    _maxBytes(0),
     _facetTypes(facetTypes),
     _deactivateController(this),
     _adapter(adapter),
@@ -153,6 +258,10 @@ Freeze::EvictorIBase::EvictorIBase(const ObjectAdapterPtr& adapter,
     _createDb(createDb),
     _trace(0),
     _txTrace(0),
+    _cacheShards(0),
+    _colocateFacets(false),
+    _keepDigests(false),
+    _multiversion(false),
     _pingObject(new PingObject)
 {
     _encoding = _dbEnv->getEncoding();
@@ -160,6 +269,90 @@ Freeze::EvictorIBase::EvictorIBase(const ObjectAdapterPtr& adapter,
     _trace = _communicator->getProperties()->getPropertyAsInt("Freeze.Trace.Evictor");
     _txTrace = _communicator->getProperties()->getPropertyAsInt("Freeze.Trace.Transaction");
     _deadlockWarning = (_communicator->getProperties()->getPropertyAsInt("Freeze.Warn.Deadlocks") > 0);
+
+    //
+    // Number of independently locked shards in each ObjectStore cache;
+    // 0 or less selects the Cache default.
+    //
+    string propertyPrefix = string("Freeze.Evictor.") + envName + '.' + _filename;
+    Int cacheShards = _communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".CacheShards");
+    if(cacheShards > 0)
+    {
+        _cacheShards = static_cast<size_t>(cacheShards);
+    }
+
+    //
+    // By default, no byte budget; the footprint of each object is
+    // estimated with its marshaled size.
+    //
+    _maxBytes = getPropertyAsBytes(propertyPrefix + ".MaxBytes");
+    _evictorBytes = _maxBytes;
+
+    //
+    // By default, hasAnotherFacet searches the database of every other facet
+    //
+    if(_communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".FacetDirectory") > 0)
+    {
+        _facetDirectory.reset(new FacetDirectory);
+    }
+
+    //
+    // By default, each facet is stored in its own database; this setting
+    // must not change once the evictor has stored objects, and opening
+    // the evictor fails when the file has databases of the other layout.
+    //
+    _colocateFacets = _communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".ColocateFacets") > 0;
+
+    //
+    // Snapshot isolation for the read-only transactions of a transactional
+    // evictor; the databases are opened with DB_MULTIVERSION. The freeze:write
+    // operations called within such a transaction are rejected.
+    //
+    _multiversion = _communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".Snapshot") > 0;
+
+    //
+    // The dispatch threads load the objects they don't find in the cache;
+    // with LoadThreads, at most LoadThreads such loads run at once, and
+    // the prefetches run on LoadThreads threads
+    //
+    Int loadThreads = _communicator->getProperties()->getPropertyAsInt(propertyPrefix + ".LoadThreads");
+    if(loadThreads > 0)
+    {
+        Int loadQueueSize = _communicator->getProperties()->
+            getPropertyAsIntWithDefault(propertyPrefix + ".LoadQueueSize", 1000);
+        _loadPool.reset(new LoadPool(_communicator, loadThreads, loadQueueSize > 0 ? loadQueueSize : 0));
+
+        if(_trace >= 1)
+        {
+            Trace out(_communicator->getLogger(), "Freeze.Evictor");
+            out << "started " << loadThreads << " load threads for \"" << _filename << "\"";
+        }
+    }
+}
+
+bool
+Freeze::EvictorIBase::unsavedObjects(const ObjectStoreBase*, vector<UnsavedObject>&)
+{
+    return false;
+}
+
+size_t
+Freeze::EvictorIBase::getPropertyAsBytes(const string& name) const
+{
+    string value = _communicator->getProperties()->getProperty(name);
+    if(value.empty())
+    {
+        return 0;
+    }
+
+    Int64 bytes;
+    if(!parseBytes(value, bytes))
+    {
+        Warning out(_communicator->getLogger());
+        out << "invalid value `" << value << "' for " << name;
+        return 0;
+    }
+    return static_cast<size_t>(bytes);
 }
 
 void
@@ -167,8 +360,6 @@ Freeze::EvictorIBase::setSize(Int evictorSize)
 {
     DeactivateController::Guard deactivateGuard(_deactivateController);
 
-    Lock sync(*this);
-
     //
     // Ignore requests to set the evictor size to values smaller than zero.
     //
@@ -177,10 +368,25 @@ Freeze::EvictorIBase::setSize(Int evictorSize)
         return;
     }
 
+    resize(static_cast<size_t>(evictorSize));
+}
+
+Int
+Freeze::EvictorIBase::getSize()
+{
+    IceUtil::Mutex::Lock sync(_sizeMutex);
+    return static_cast<Int>(_evictorSize);
+}
+
+void
+Freeze::EvictorIBase::resize(size_t evictorSize)
+{
+    IceUtil::Mutex::Lock sync(_sizeMutex);
+
     //
     // Update the evictor size.
     //
-    _evictorSize = static_cast<size_t>(evictorSize);
+    _evictorSize = evictorSize;
 
     //
     // Evict as many elements as necessary.
@@ -188,11 +394,89 @@ Freeze::EvictorIBase::setSize(Int evictorSize)
     evict();
 }
 
-Int
-Freeze::EvictorIBase::getSize()
+void
+Freeze::EvictorIBase::registerMemoryBudget()
 {
-    Lock sync(*this);
-    return static_cast<Int>(_evictorSize);
+    IceUtilInternal::MutexPtrLock<IceUtil::Mutex> lock(memoryBudgetMutex);
+
+    //
+    // Freeze.Evictor.MaxBytes is a number of bytes, or cgroup to use a
+    // percentage of the cgroup memory limit of this process. It's a
+    // process-wide setting, read by the first evictor registered; the
+    // properties of the communicators of the other evictors are ignored.
+    //
+    if(!globalMaxBytesRead)
+    {
+        globalMaxBytesRead = true;
+
+        PropertiesPtr properties = _communicator->getProperties();
+        string maxBytes = properties->getProperty("Freeze.Evictor.MaxBytes");
+        if(maxBytes == "cgroup")
+        {
+            Int percent = properties->getPropertyAsIntWithDefault("Freeze.Evictor.CgroupMemoryPercent", 50);
+            globalMaxBytes = static_cast<size_t>(cgroupMemoryLimit() / 100 * percent);
+        }
+        else if(!maxBytes.empty())
+        {
+            Int64 bytes;
+            if(parseBytes(maxBytes, bytes))
+            {
+                globalMaxBytes = static_cast<size_t>(bytes);
+            }
+            else
+            {
+                Warning out(_communicator->getLogger());
+                out << "invalid value `" << maxBytes << "' for Freeze.Evictor.MaxBytes";
+            }
+        }
+    }
+
+    memoryBudgetEvictors->insert(this);
+    if(globalMaxBytes > 0)
+    {
+        //
+        // Shrink the other evictors
+        //
+        size_t share = globalMaxBytes / memoryBudgetEvictors->size();
+        for(set<EvictorIBase*>::const_iterator p = memoryBudgetEvictors->begin(); p != memoryBudgetEvictors->end(); ++p)
+        {
+            (*p)->setMemoryBudgetShare(share);
+        }
+    }
+}
+
+void
+Freeze::EvictorIBase::unregisterMemoryBudget()
+{
+    IceUtilInternal::MutexPtrLock<IceUtil::Mutex> lock(memoryBudgetMutex);
+
+    if(memoryBudgetEvictors->erase(this) > 0 && globalMaxBytes > 0 && !memoryBudgetEvictors->empty())
+    {
+        //
+        // Grow the other evictors
+        //
+        size_t share = globalMaxBytes / memoryBudgetEvictors->size();
+        for(set<EvictorIBase*>::const_iterator p = memoryBudgetEvictors->begin(); p != memoryBudgetEvictors->end(); ++p)
+        {
+            (*p)->setMemoryBudgetShare(share);
+        }
+    }
+}
+
+void
+Freeze::EvictorIBase::setMemoryBudgetShare(size_t share)
+{
+    IceUtil::Mutex::Lock sync(_sizeMutex);
+
+    _evictorBytes = (_maxBytes > 0 && _maxBytes < share) ? _maxBytes : share;
+
+    if(_trace >= 1)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "byte budget of evictor \"" << _filename << "\" set to " << _evictorBytes << " bytes";
+    }
+
+    evict();
 }
 
 Ice::ObjectPrx
@@ -298,9 +582,48 @@ Freeze::EvictorIBase::filename() const
     return _filename;
 }
 
+string
+Freeze::EvictorIBase::colocatedFacetsKey() const
+{
+    return _filename + "/" + colocatedDbName;
+}
+
 vector<string>
 Freeze::EvictorIBase::allDbs() const
 {
+    vector<string> dbs = fileDbs();
+
+    //
+    // Opening the file with the other layout would silently hide the
+    // objects already stored
+    //
+    bool colocated = find(dbs.begin(), dbs.end(), colocatedDbName) != dbs.end();
+    if(_colocateFacets && (colocated ? dbs.size() > 1 : !dbs.empty()))
+    {
+        throw DatabaseException(__FILE__, __LINE__, "\"" + _filename + "\" stores each facet in its own database; "
+                                "Freeze.Evictor." + _dbEnv->getEnvName() + "." + _filename +
+                                ".ColocateFacets must not be set");
+    }
+    else if(!_colocateFacets && colocated)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "\"" + _filename + "\" stores its facets in a single database; "
+                                "Freeze.Evictor." + _dbEnv->getEnvName() + "." + _filename +
+                                ".ColocateFacets must be set");
+    }
+
+    if(_colocateFacets)
+    {
+        return colocatedFacets();
+    }
+    return dbs;
+}
+
+vector<string>
+Freeze::EvictorIBase::fileDbs() const
+{
+    //
+    // The databases of this file, other than the indices
+    //
     vector<string> result;
 
     try
@@ -353,3 +676,157 @@ Freeze::EvictorIBase::allDbs() const
 
     return result;
 }
+
+vector<string>
+Freeze::EvictorIBase::colocatedFacets() const
+{
+    //
+    // The facets listed in the catalog, named like their database
+    // otherwise
+    //
+    {
+        ConnectionPtr connection = createConnection(_communicator, _dbEnv->getEnvName());
+        CatalogIndexList catalogIndexList(connection, catalogIndexListName());
+        CatalogIndexList::const_iterator p = catalogIndexList.find(colocatedFacetsKey());
+        if(p != catalogIndexList.end())
+        {
+            return p->second;
+        }
+    }
+
+    //
+    // A colocated database created before the facets were listed in the
+    // catalog is scanned once; the ObjectStores of these facets then add
+    // them to the catalog
+    //
+    set<string> facets;
+
+    try
+    {
+        Db db(_dbEnv->getEnv(), 0);
+        db.open(0, nativeToUTF8(_filename, getProcessStringConverter()).c_str(), colocatedDbName.c_str(), DB_UNKNOWN,
+                DB_RDONLY, 0);
+
+        Dbc* dbc = 0;
+        db.cursor(0, &dbc, 0);
+
+        Dbt dbKey;
+        dbKey.set_flags(DB_DBT_MALLOC);
+
+        Dbt dbValue;
+        dbValue.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+        bool more = true;
+        while(more)
+        {
+            more = (dbc->get(&dbKey, &dbValue, DB_NEXT) == 0);
+            if(more)
+            {
+                const Byte* data = static_cast<const Byte*>(dbKey.get_data());
+                InputStream stream(_communicator, _encoding, make_pair(data, data + dbKey.get_size()));
+                Identity ident;
+                string facet;
+                stream.read(ident);
+                stream.read(facet);
+                facets.insert(facet.empty() ? defaultDb : facet);
+                free(dbKey.get_data());
+            }
+        }
+
+        dbc->close();
+        db.close(0);
+    }
+    catch(const DbException& dx)
+    {
+        if(dx.get_errno() != ENOENT)
+        {
+            DatabaseException ex(__FILE__, __LINE__);
+            ex.message = dx.what();
+            throw ex;
+        }
+    }
+
+    return vector<string>(facets.begin(), facets.end());
+}
+
+namespace
+{
+
+class PrefetchTask : public LoadPool::Task
+{
+public:
+
+    PrefetchTask(EvictorIBase* evictor, const vector<Identity>& idents, const string& facet) :
+        _evictor(evictor),
+        _idents(idents),
+        _facet(facet)
+    {
+    }
+
+    virtual void run()
+    {
+        try
+        {
+            DeactivateController::Guard deactivateGuard(_evictor->deactivateController());
+            _evictor->prefetchNow(_idents, _facet);
+        }
+        catch(const EvictorDeactivatedException&)
+        {
+            //
+            // Too late
+            //
+        }
+        catch(const Ice::Exception& ex)
+        {
+            Warning out(_evictor->communicator()->getLogger());
+            out << "Freeze: prefetching " << _idents.size() << " objects from \"" << _evictor->filename()
+                << "\" raised " << ex;
+        }
+    }
+
+private:
+
+    EvictorIBase* _evictor;
+    const vector<Identity> _idents;
+    const string _facet;
+};
+
+}
+
+void
+Freeze::EvictorIBase::prefetch(const vector<Identity>& idents, const string& facet)
+{
+    DeactivateController::Guard deactivateGuard(_deactivateController);
+
+    if(_loadPool.get() == 0)
+    {
+        prefetchNow(idents, facet);
+    }
+    else if(!_loadPool->submit(new PrefetchTask(this, idents, facet)))
+    {
+        LoadPool::Slot slot(*_loadPool);
+        prefetchNow(idents, facet);
+    }
+}
+
+void
+Freeze::prefetch(const EvictorPtr& evictor, const IdentitySeq& idents, const string& facet)
+{
+    EvictorIBase* evictorI = dynamic_cast<EvictorIBase*>(evictor.get());
+    if(evictorI == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "prefetch: invalid evictor");
+    }
+    evictorI->prefetch(idents, facet);
+}
+
+Int
+Freeze::preloadFacets(const EvictorPtr& evictor, const Identity& ident)
+{
+    EvictorIBase* evictorI = dynamic_cast<EvictorIBase*>(evictor.get());
+    if(evictorI == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "preloadFacets: invalid evictor");
+    }
+    return evictorI->preloadFacets(ident);
+}
@@ -15,6 +15,9 @@
 #include <Freeze/SharedDbEnv.h>
 #include <Freeze/Index.h>
 #include <Freeze/DB.h>
+#include <Freeze/EvictionPolicy.h>
+#include <Freeze/FacetDirectory.h>
+#include <Freeze/LoadPool.h>
 #include <list>
 #include <vector>
 #include <deque>
@@ -78,6 +81,14 @@ public:
 
     virtual TransactionIPtr beforeQuery() = 0;
 
+    //
+    // Queries call beforeQuery first. When it doesn't save the modified
+    // objects, unsavedObjects returns true with the objects of the given
+    // store not saved yet, and queries merge them with their results.
+    // These objects are read as last streamed, without locking servants.
+    //
+    virtual bool unsavedObjects(const ObjectStoreBase*, std::vector<UnsavedObject>&);
+
     virtual void setSize(Ice::Int);
     virtual Ice::Int getSize();
 
@@ -88,6 +99,25 @@ public:
 
     virtual Ice::ObjectPtr locate(const Ice::Current&, Ice::LocalObjectPtr&);
 
+    //
+    // Loads all the facets of the given identity in the cache, and returns
+    // the number of facets found
+    //
+    virtual Ice::Int preloadFacets(const Ice::Identity&) = 0;
+
+    //
+    // Pins the given objects of a facet, on a load thread when LoadThreads
+    // is set
+    //
+    void prefetch(const std::vector<Ice::Identity>&, const std::string&);
+    virtual void prefetchNow(const std::vector<Ice::Identity>&, const std::string&) = 0;
+
+    //
+    // Pins the objects found by an index query, and adds their servants to
+    // the given map
+    //
+    virtual void pinServants(ObjectStoreBase*, const std::vector<Ice::Identity>&, std::map<Ice::Identity, Ice::ObjectPtr>&) = 0;
+
     DeactivateController& deactivateController();
     const Ice::CommunicatorPtr& communicator() const;
     const Ice::EncodingVersion& encoding() const;
@@ -95,15 +125,46 @@ public:
     const std::string& filename() const;
 
     bool deadlockWarning() const;
+    size_t cacheShards() const;
     Ice::Int trace() const;
     Ice::Int txTrace() const;
 
+    //
+    // Null unless FacetDirectory is set
+    //
+    FacetDirectory* facetDirectory() const;
+
+    //
+    // With ColocateFacets, all the facets are stored in a single database,
+    // opened by the first ObjectStore and closed by closeDbEnv; the
+    // ObjectStores are created during construction or with this evictor
+    // locked. The names of these facets are kept in the catalog index
+    // list, under colocatedFacetsKey.
+    //
+    bool colocateFacets() const;
+    Db* colocatedDb() const;
+    void colocatedDbOpened(Db*);
+    std::string colocatedFacetsKey() const;
+
+    //
+    // When true, the ObjectStores compute the digests of the records they
+    // load into the cache and update
+    //
+    bool keepDigests() const;
+
+    //
+    // When true, the databases are opened with DB_MULTIVERSION, so that
+    // transactions can read them in snapshot isolation
+    //
+    bool multiversion() const;
+
     void initialize(const Ice::Identity&, const std::string&, const Ice::ObjectPtr&);
 
     static void updateStats(Statistics&, IceUtil::Int64);
 
     static std::string defaultDb;
     static std::string indexPrefix;
+    static std::string colocatedDbName;
 
 protected:
 
@@ -114,11 +175,48 @@ protected:
 
     virtual Ice::ObjectPtr locateImpl(const Ice::Current&, Ice::LocalObjectPtr&) = 0;
 
+    //
+    // Evicts as many objects as necessary to match _evictorSize and
+    // _evictorBytes; must be called with _sizeMutex locked.
+    //
     virtual void evict() = 0;
 
+    void resize(size_t);
+
+    //
+    // Shares the process-wide byte budget (Freeze.Evictor.MaxBytes, read
+    // once with the cgroup memory limit) with the other evictors;
+    // registerMemoryBudget must be called at the end of the constructor of
+    // the most derived class, once nothing can throw, and
+    // unregisterMemoryBudget during deactivation.
+    //
+    void registerMemoryBudget();
+    void unregisterMemoryBudget();
+    void setMemoryBudgetShare(size_t);
+
+    //
+    // Reads a number of bytes, with an optional K, M or G suffix; returns 0
+    // when the property is not set or invalid
+    //
+    size_t getPropertyAsBytes(const std::string&) const;
+
     std::vector<std::string> allDbs() const;
 
+    //
+    // Protected by _sizeMutex
+    //
+    // _evictorBytes is the byte budget of this evictor, the smaller of
+    // _maxBytes and its share of the process-wide budget; 0 means no
+    // byte budget.
+    //
+    IceUtil::Mutex _sizeMutex;
     size_t _evictorSize;
+    size_t _evictorBytes;
+
+    //
+    // Immutable
+    //
+    size_t _maxBytes;
 
     FacetTypeMap _facetTypes;
 
@@ -140,8 +238,26 @@ protected:
 
     bool _deadlockWarning;
 
+    size_t _cacheShards;
+
+    IceInternal::UniquePtr<FacetDirectory> _facetDirectory;
+
+    bool _colocateFacets;
+    IceInternal::UniquePtr<Db> _colocatedDb;
+
+    bool _keepDigests;
+    bool _multiversion;
+
+    //
+    // Null unless LoadThreads is set; destroyed during deactivation
+    //
+    IceInternal::UniquePtr<LoadPool> _loadPool;
+
 private:
 
+    std::vector<std::string> fileDbs() const;
+    std::vector<std::string> colocatedFacets() const;
+
     Ice::ObjectPtr _pingObject;
 };
 
@@ -158,11 +274,50 @@ public:
         DeactivateController::Guard deactivateGuard(_deactivateController);
 
         TransactionIPtr tx = beforeQuery();
-        return new EvictorIteratorI(findStore(facet, false), tx, batchSize);
+        ObjectStoreBase* store = findStore(facet, false);
+        std::vector<UnsavedObject> unsaved;
+        if(store != 0)
+        {
+            unsavedObjects(store, unsaved);
+        }
+        return new EvictorIteratorI(store, tx, batchSize, unsaved);
     }
 
 protected:
 
+    //
+    // The evictor queue is partitioned into segments, each with its own
+    // mutex, eviction policy and share of _evictorSize. All the facets of
+    // a given identity belong to the same segment.
+    //
+    struct Segment
+    {
+        Segment(EvictionPolicy<T>* p) :
+            policy(p)
+        {
+        }
+
+        ~Segment()
+        {
+            delete policy;
+        }
+
+        IceUtil::Mutex mutex;
+
+        //
+        // Protected by mutex
+        //
+        // policy tracks the objects of this segment that can be evicted,
+        // and its capacity is the share of _evictorSize of this segment.
+        //
+        EvictionPolicy<T>* policy;
+
+    private:
+
+        Segment(const Segment&);
+        void operator=(const Segment&);
+    };
+
     EvictorI(const Ice::ObjectAdapterPtr& adapter, const std::string& envName, DbEnv* dbEnv,
              const std::string& filename, const FacetTypeMap& facetTypes,
              const ServantInitializerPtr& initializer, const std::vector<IndexPtr>& indices, bool createDb) :
@@ -173,6 +328,43 @@ protected:
             (_communicator->getProperties()->
              getPropertyAsIntWithDefault(propertyPrefix + ".PopulateEmptyIndices", 0) != 0);
 
+        //
+        // By default, a single segment, i.e. a strict LRU over the whole evictor
+        //
+        Ice::Int segments = _communicator->getProperties()->
+            getPropertyAsIntWithDefault(propertyPrefix + ".EvictorSegments", 1);
+        if(segments < 1)
+        {
+            segments = 1;
+        }
+
+        //
+        // LRU (the default), CLOCK, 2Q or ARC
+        //
+        std::string policy = _communicator->getProperties()->getProperty(propertyPrefix + ".Policy");
+        EvictionPolicy<T>* p = createEvictionPolicy<T>(policy);
+        if(p == 0)
+        {
+            Ice::Warning out(_communicator->getLogger());
+            out << "unknown eviction policy `" << policy << "' for Freeze evictor `" << filename
+                << "'; using LRU";
+            policy = "LRU";
+        }
+        else
+        {
+            delete p;
+        }
+
+        for(Ice::Int i = 0; i < segments; ++i)
+        {
+            _segments.push_back(new Segment(createEvictionPolicy<T>(policy)));
+        }
+        for(size_t i = 0; i < _segments.size(); ++i)
+        {
+            _segments[i]->policy->setCapacity(segmentSize(i));
+            _segments[i]->policy->setByteCapacity(segmentBytes(i));
+        }
+
         //
         // Instantiate all Dbs in 2 steps:
         // (1) iterate over the indices and create ObjectStore with indices
@@ -242,6 +434,12 @@ protected:
                 ir.first->second = new ObjectStore<T>(facet, facetType, _createDb, this);
             }
         }
+
+        if(_facetDirectory.get() != 0 && _trace >= 1)
+        {
+            Ice::Trace out(_communicator->getLogger(), "Freeze.Evictor");
+            out << "facet directory of \"" << _filename << "\" has " << _facetDirectory->size() << " identities";
+        }
     }
 
     ObjectStore<T>*
@@ -269,20 +467,202 @@ protected:
         return os;
     }
 
+    //
+    // Pins the given object; with LoadThreads set, at most LoadThreads
+    // cache misses are loaded at once
+    //
+    IceUtil::Handle<T>
+    pinElement(ObjectStore<T>* store, const Ice::Identity& ident)
+    {
+        if(_loadPool.get() != 0 && store->getIfPinned(ident) == 0)
+        {
+            LoadPool::Slot slot(*_loadPool);
+            return store->pin(ident);
+        }
+        return store->pin(ident);
+    }
+
+    //
+    // Pins all the facets of the given identity, loaded with a single cursor
+    // pass when the facets are colocated
+    //
+    void
+    pinFacets(const Ice::Identity& ident, std::vector<IceUtil::Handle<T> >& elements)
+    {
+        std::vector<ObjectStore<T>*> stores;
+        {
+            Lock sync(*this);
+            for(typename StoreMap::const_iterator p = _storeMap.begin(); p != _storeMap.end(); ++p)
+            {
+                stores.push_back(p->second);
+            }
+        }
+
+        if(_colocateFacets)
+        {
+            typedef typename ObjectStore<T>::ObjectCache::Position Position;
+
+            //
+            // The facets are reserved before they are read, as ObjectStore::pinMany
+            // does; those being loaded by other threads are pinned afterwards
+            //
+            std::map<std::string, std::pair<ObjectStore<T>*, Position> > reserved;
+            std::vector<ObjectStore<T>*> busy;
+            for(size_t i = 0; i < stores.size(); ++i)
+            {
+                IceUtil::Handle<T> element = stores[i]->getIfPinned(ident);
+                if(element != 0)
+                {
+                    elements.push_back(element);
+                    continue;
+                }
+
+                Position pos;
+                if(stores[i]->reserve(ident, pos))
+                {
+                    reserved.insert(std::make_pair(stores[i]->facet(), std::make_pair(stores[i], pos)));
+                }
+                else
+                {
+                    busy.push_back(stores[i]);
+                }
+            }
+
+            if(!reserved.empty())
+            {
+                std::vector<FacetRecord> records;
+                try
+                {
+                    findStore("", false)->loadFacets(ident, records);
+                }
+                catch(...)
+                {
+                    for(typename std::map<std::string, std::pair<ObjectStore<T>*, Position> >::iterator p =
+                            reserved.begin(); p != reserved.end(); ++p)
+                    {
+                        p->second.first->fill(p->second.second, 0);
+                    }
+                    throw;
+                }
+
+                for(std::vector<FacetRecord>::iterator p = records.begin(); p != records.end(); ++p)
+                {
+                    typename std::map<std::string, std::pair<ObjectStore<T>*, Position> >::iterator q =
+                        reserved.find(p->facet);
+                    if(q != reserved.end())
+                    {
+                        elements.push_back(q->second.first->fillLoaded(q->second.second, p->rec, p->digest));
+                        reserved.erase(q);
+                    }
+                }
+
+                for(typename std::map<std::string, std::pair<ObjectStore<T>*, Position> >::iterator p =
+                        reserved.begin(); p != reserved.end(); ++p)
+                {
+                    p->second.first->fill(p->second.second, 0);
+                }
+            }
+
+            for(size_t i = 0; i < busy.size(); ++i)
+            {
+                IceUtil::Handle<T> element = busy[i]->pin(ident);
+                if(element != 0)
+                {
+                    elements.push_back(element);
+                }
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < stores.size(); ++i)
+            {
+                IceUtil::Handle<T> element = stores[i]->pin(ident);
+                if(element != 0)
+                {
+                    elements.push_back(element);
+                }
+            }
+        }
+    }
+
+    virtual
+    ~EvictorI()
+    {
+        for(size_t i = 0; i < _segments.size(); ++i)
+        {
+            delete _segments[i];
+        }
+    }
+
     void
     closeDbEnv()
     {
+        if(_loadPool.get() != 0)
+        {
+            _loadPool->destroy();
+            _loadPool.reset();
+        }
+
         for(typename StoreMap::iterator p = _storeMap.begin(); p != _storeMap.end(); ++p)
         {
             delete (*p).second;
         }
 
+        if(_colocatedDb.get() != 0)
+        {
+            try
+            {
+                _colocatedDb->close(0);
+            }
+            catch(const DbException& dx)
+            {
+                Ice::Error error(_communicator->getLogger());
+                error << "Freeze: closing \"" << _filename + "/" + colocatedDbName << "\" raised DbException: "
+                      << dx.what();
+            }
+            _colocatedDb.reset();
+        }
+
         _dbEnv = 0;
         _initializer = 0;
     }
 
+    Segment&
+    findSegment(const Ice::Identity& ident) const
+    {
+        CacheKeyHash<Ice::Identity> hash;
+        return *_segments[hash(ident) % _segments.size()];
+    }
+
+    //
+    // The share of _evictorSize of the given segment; must be called
+    // with _sizeMutex locked.
+    //
+    size_t
+    segmentSize(size_t index) const
+    {
+        size_t count = _segments.size();
+        return _evictorSize / count + (index < _evictorSize % count ? 1 : 0);
+    }
+
+    //
+    // The share of _evictorBytes of the given segment; must be called
+    // with _sizeMutex locked.
+    //
+    size_t
+    segmentBytes(size_t index) const
+    {
+        size_t count = _segments.size();
+        return _evictorBytes / count + (index < _evictorBytes % count ? 1 : 0);
+    }
+
     typedef std::map<std::string, ObjectStore<T>*> StoreMap;
     StoreMap _storeMap;
+
+    //
+    // Immutable
+    //
+    std::vector<Segment*> _segments;
 };
 
 inline DeactivateController&
@@ -315,12 +695,55 @@ EvictorIBase::deadlockWarning() const
     return _deadlockWarning;
 }
 
+inline size_t
+EvictorIBase::cacheShards() const
+{
+    return _cacheShards;
+}
+
 inline Ice::Int
 EvictorIBase::trace() const
 {
     return _trace;
 }
 
+inline FacetDirectory*
+EvictorIBase::facetDirectory() const
+{
+    return _facetDirectory.get();
+}
+
+inline bool
+EvictorIBase::colocateFacets() const
+{
+    return _colocateFacets;
+}
+
+inline bool
+EvictorIBase::keepDigests() const
+{
+    return _keepDigests;
+}
+
+inline bool
+EvictorIBase::multiversion() const
+{
+    return _multiversion;
+}
+
+inline Db*
+EvictorIBase::colocatedDb() const
+{
+    return _colocatedDb.get();
+}
+
+inline void
+EvictorIBase::colocatedDbOpened(Db* db)
+{
+    assert(_colocatedDb.get() == 0);
+    _colocatedDb.reset(db);
+}
+
 //
 // Helper function
 //
@@ -13,7 +13,8 @@ using namespace std;
 using namespace Freeze;
 using namespace Ice;
 
-Freeze::EvictorIteratorI::EvictorIteratorI(ObjectStoreBase* store, const TransactionIPtr& tx, Int batchSize) :
+Freeze::EvictorIteratorI::EvictorIteratorI(ObjectStoreBase* store, const TransactionIPtr& tx, Int batchSize,
+                                           const vector<UnsavedObject>& unsaved) :
     _store(store),
     _batchSize(static_cast<size_t>(batchSize)),
     _key(1024),
@@ -22,20 +23,27 @@ Freeze::EvictorIteratorI::EvictorIteratorI(ObjectStoreBase* store, const Transac
     _tx(tx)
 {
     _batchIterator = _batch.end();
+
+    for(vector<UnsavedObject>::const_iterator p = unsaved.begin(); p != unsaved.end(); ++p)
+    {
+        if(_unsaved.insert(p->ident).second && !p->value.empty())
+        {
+            _unsavedLive.push_back(p->ident);
+        }
+    }
 }
 
 bool
 Freeze::EvictorIteratorI::hasNext()
 {
-    if(_batchIterator != _batch.end())
-    {
-        return true;
-    }
-    else
+    //
+    // A batch can be empty when all its records are unsaved objects
+    //
+    while(_batchIterator == _batch.end() && (_more || !_unsavedLive.empty()))
     {
         _batchIterator = nextBatch();
-        return (_batchIterator != _batch.end());
     }
+    return _batchIterator != _batch.end();
 }
 
 Identity
@@ -58,7 +66,11 @@ Freeze::EvictorIteratorI::nextBatch()
 
     if(!_more)
     {
-        return _batch.end();
+        //
+        // Then the live objects not saved yet
+        //
+        _batch.swap(_unsavedLive);
+        return _batch.begin();
     }
 
     DeactivateController::Guard
@@ -66,9 +78,6 @@ Freeze::EvictorIteratorI::nextBatch()
 
     Key firstKey = _key;
 
-    const CommunicatorPtr& communicator = _store->communicator();
-    const EncodingVersion& encoding = _store->encoding();
-
     DbTxn* txn = _tx == 0 ? 0: _tx->dbTxn();
 
     try
@@ -128,18 +137,23 @@ Freeze::EvictorIteratorI::nextBatch()
 
                                 flags = DB_NEXT;
 
+                                //
+                                // Skip the other facets of a colocated database
+                                //
                                 Ice::Identity ident;
-                                ObjectStoreBase::unmarshal(ident, _key, communicator, encoding);
-                                if(_batch.size() < _batchSize)
-                                {
-                                    _batch.push_back(ident);
-                                }
-                                else
+                                if(_store->unmarshalKey(ident, &_key[0], _key.size()))
                                 {
-                                    //
-                                    // Keep the last element in _key
-                                    //
-                                    done = true;
+                                    if(_batch.size() < _batchSize)
+                                    {
+                                        _batch.push_back(ident);
+                                    }
+                                    else
+                                    {
+                                        //
+                                        // Keep the last element in _key
+                                        //
+                                        done = true;
+                                    }
                                 }
                             }
                             break;
@@ -221,6 +235,19 @@ Freeze::EvictorIteratorI::nextBatch()
         handleDbException(dx, __FILE__, __LINE__);
     }
 
+    if(!_unsaved.empty())
+    {
+        vector<Identity> batch;
+        for(vector<Identity>::const_iterator p = _batch.begin(); p != _batch.end(); ++p)
+        {
+            if(_unsaved.find(*p) == _unsaved.end())
+            {
+                batch.push_back(*p);
+            }
+        }
+        _batch.swap(batch);
+    }
+
     if(_batch.size() == 0)
     {
         return _batch.end();
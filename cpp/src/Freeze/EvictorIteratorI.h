@@ -10,6 +10,7 @@
 #include <Ice/Ice.h>
 #include <Freeze/Freeze.h>
 #include <vector>
+#include <set>
 
 namespace Freeze
 {
@@ -18,12 +19,13 @@ class TransactionI;
 typedef IceUtil::Handle<TransactionI> TransactionIPtr;
 
 class ObjectStoreBase;
+struct UnsavedObject;
 
 class EvictorIteratorI : public EvictorIterator
 {
 public:
 
-    EvictorIteratorI(ObjectStoreBase*, const TransactionIPtr&, Ice::Int);
+    EvictorIteratorI(ObjectStoreBase*, const TransactionIPtr&, Ice::Int, const std::vector<UnsavedObject>&);
 
     virtual bool hasNext();
     virtual Ice::Identity next();
@@ -42,6 +44,13 @@ private:
     bool _more;
     bool _initialized;
     TransactionIPtr _tx;
+
+    //
+    // The objects not saved yet replace the database records with the same
+    // identity; the live ones are returned after the database records
+    //
+    std::set<Ice::Identity> _unsaved;
+    std::vector<Ice::Identity> _unsavedLive;
 };
 
 }
@@ -0,0 +1,93 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#include <Freeze/FacetDirectory.h>
+
+using namespace std;
+using namespace Freeze;
+using namespace Ice;
+
+Freeze::FacetDirectory::FacetDirectory() :
+    _epoch(0)
+{
+}
+
+int
+Freeze::FacetDirectory::registerFacet(const string& facet)
+{
+    IceUtil::Mutex::Lock sync(_mutex);
+
+    map<string, int>::const_iterator p = _facetBits.find(facet);
+    if(p != _facetBits.end())
+    {
+        return p->second;
+    }
+
+    int index = static_cast<int>(_facetBits.size());
+    if(index >= maxFacets)
+    {
+        index = -1;
+    }
+    _facetBits.insert(map<string, int>::value_type(facet, index));
+    return index;
+}
+
+void
+Freeze::FacetDirectory::add(const Byte* key, size_t size, int index)
+{
+    IceUtil::Mutex::Lock sync(_mutex);
+    ++_epoch;
+
+    if(index >= 0)
+    {
+        _masks[Key(key, key + size)] |= bit(index);
+    }
+}
+
+Long
+Freeze::FacetDirectory::facets(const Byte* key, size_t size, Long& epoch) const
+{
+    IceUtil::Mutex::Lock sync(_mutex);
+    epoch = _epoch;
+
+    map<Key, Long>::const_iterator p = _masks.find(Key(key, key + size));
+    return p == _masks.end() ? 0 : p->second;
+}
+
+void
+Freeze::FacetDirectory::absent(const Byte* key, size_t size, int index, Long epoch)
+{
+    if(index < 0)
+    {
+        return;
+    }
+
+    IceUtil::Mutex::Lock sync(_mutex);
+    if(epoch != _epoch)
+    {
+        //
+        // This facet may have been added during the search
+        //
+        return;
+    }
+
+    map<Key, Long>::iterator p = _masks.find(Key(key, key + size));
+    if(p != _masks.end())
+    {
+        p->second &= ~bit(index);
+        if(p->second == 0)
+        {
+            _masks.erase(p);
+        }
+    }
+}
+
+size_t
+Freeze::FacetDirectory::size() const
+{
+    IceUtil::Mutex::Lock sync(_mutex);
+    return _masks.size();
+}
@@ -0,0 +1,72 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_FACET_DIRECTORY_H
+#define FREEZE_FACET_DIRECTORY_H
+
+#include <IceUtil/Mutex.h>
+#include <Freeze/DB.h>
+
+#include <map>
+#include <string>
+
+namespace Freeze
+{
+
+//
+// The facets of each identity of an evictor, kept in memory so that
+// hasAnotherFacet doesn't search every facet database.
+//
+// Each facet gets a bit of the mask of the identities, keyed by their
+// marshaled identity; facets beyond maxFacets have no bit and must always
+// be searched. A set bit means the facet may exist: facets are added
+// before they are written, and a bit is only cleared once a search did not
+// find the facet, and no facet was added during this search.
+//
+class FacetDirectory
+{
+public:
+
+    FacetDirectory();
+
+    //
+    // Returns the bit of this facet, or -1 when it has none
+    //
+    int registerFacet(const std::string&);
+
+    void add(const Ice::Byte*, size_t, int);
+
+    //
+    // Returns the mask of the given identity, and the epoch to pass to
+    // absent after a search
+    //
+    Ice::Long facets(const Ice::Byte*, size_t, Ice::Long&) const;
+
+    void absent(const Ice::Byte*, size_t, int, Ice::Long);
+
+    size_t size() const;
+
+    static const int maxFacets = 63;
+
+    static Ice::Long bit(int index)
+    {
+        return static_cast<Ice::Long>(1) << index;
+    }
+
+private:
+
+    //
+    // Protected by _mutex
+    //
+    mutable IceUtil::Mutex _mutex;
+    std::map<std::string, int> _facetBits;
+    std::map<Key, Ice::Long> _masks;
+    Ice::Long _epoch; // Incremented by add
+};
+
+}
+
+#endif
@@ -16,9 +16,10 @@ Freeze::Index::~Index()
     delete _impl;
 }
 
-Freeze::Index::Index(const string& name, const string& facet) :
+Freeze::Index::Index(const string& name, const string& facet, bool ordered) :
     _name(name),
     _facet(facet),
+    _ordered(ordered),
     _impl(new IndexI(*this))
 {
 }
@@ -41,6 +42,64 @@ Freeze::Index::untypedFindFirst(const Key& bytes, Int firstN) const
     return _impl->untypedFindFirst(bytes, firstN);
 }
 
+vector<IndexMatch>
+Freeze::Index::untypedFindFirstServants(const Key& bytes, Int firstN) const
+{
+    return _impl->untypedFindFirstServants(bytes, firstN);
+}
+
+int
+Freeze::Index::compare(const Key& k1, const Key& k2)
+{
+    if(k1 < k2)
+    {
+        return -1;
+    }
+    else if(k2 < k1)
+    {
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+vector<Identity>
+Freeze::Index::untypedFindRange(const Key& lower, const Key& upper, Int firstN, IndexPosition& position) const
+{
+    return _impl->untypedFindRange(lower, upper, firstN, position);
+}
+
+EvictorIteratorPtr
+Freeze::Index::untypedGetIterator(const Key& bytes, Int batchSize) const
+{
+    return _impl->untypedGetIterator(bytes, Key(), true, batchSize);
+}
+
+EvictorIteratorPtr
+Freeze::Index::untypedGetRangeIterator(const Key& lower, const Key& upper, Int batchSize) const
+{
+    return _impl->untypedGetIterator(lower, upper, false, batchSize);
+}
+
+bool
+Freeze::Index::prefixUpperBound(const string& prefix, string& upper)
+{
+    upper = prefix;
+    while(!upper.empty() && static_cast<unsigned char>(upper[upper.size() - 1]) == 0xFF)
+    {
+        upper.erase(upper.size() - 1);
+    }
+
+    if(upper.empty())
+    {
+        return false;
+    }
+    upper[upper.size() - 1] = static_cast<char>(static_cast<unsigned char>(upper[upper.size() - 1]) + 1);
+    return true;
+}
+
 vector<Identity>
 Freeze::Index::untypedFind(const Key& bytes) const
 {
@@ -5,16 +5,71 @@
 // **********************************************************************
 
 #include <Freeze/IndexI.h>
+#include <Freeze/IndexIteratorI.h>
 #include <Freeze/Util.h>
 #include <Freeze/ObjectStore.h>
 #include <Freeze/EvictorI.h>
 
 #include <Ice/StringConverter.h>
 
+#include <set>
+#include <algorithm>
+
 using namespace Freeze;
 using namespace Ice;
 using namespace std;
 
+extern "C"
+{
+#if (DB_VERSION_MAJOR <= 5)
+    static int customIndexCompare(DB* db, const DBT* dbt1, const DBT* dbt2)
+#else
+    static int customIndexCompare(DB* db, const DBT* dbt1, const DBT* dbt2, size_t*)
+#endif
+    {
+        IndexI* me = static_cast<IndexI*>(db->app_private);
+        Byte* first = static_cast<Byte*>(dbt1->data);
+        Key k1(first, first + dbt1->size);
+        first = static_cast<Byte*>(dbt2->data);
+        Key k2(first, first + dbt2->size);
+
+        return me->compare(k1, k2);
+    }
+}
+
+namespace
+{
+
+//
+// Orders index entries like the index database: by key, then by primary key
+//
+class EntryLess
+{
+public:
+
+    EntryLess(const IndexI& index) :
+        _index(index)
+    {
+    }
+
+    bool operator()(const IndexPosition& lhs, const IndexPosition& rhs) const
+    {
+        int c = _index.compare(lhs.key, rhs.key);
+        return c < 0 || (c == 0 && lhs.primaryKey < rhs.primaryKey);
+    }
+
+    bool operator()(const pair<IndexPosition, Identity>& lhs, const pair<IndexPosition, Identity>& rhs) const
+    {
+        return (*this)(lhs.first, rhs.first);
+    }
+
+private:
+
+    const IndexI& _index;
+};
+
+}
+
 static int
 callback(Db* secondary, const Dbt* key, const Dbt* value, Dbt* result)
 {
@@ -36,6 +91,47 @@ Freeze::IndexI::untypedFindFirst(const Key& bytes, Int firstN) const
     DeactivateController::Guard
         deactivateGuard(_store->evictor()->deactivateController());
 
+    vector<UnsavedObject> unsaved;
+    return findFirst(bytes, firstN, unsaved);
+}
+
+vector<IndexMatch>
+Freeze::IndexI::untypedFindFirstServants(const Key& bytes, Int firstN) const
+{
+    DeactivateController::Guard
+        deactivateGuard(_store->evictor()->deactivateController());
+
+    vector<UnsavedObject> unsaved;
+    vector<Identity> identities = findFirst(bytes, firstN, unsaved);
+
+    //
+    // The objects are pinned through the cache, which reads them again
+    // after reserving them: records read by the index cursor could be
+    // older than an object saved and evicted since. The unsaved objects
+    // are cached, so this returns their servants.
+    //
+    map<Identity, ObjectPtr> servants;
+    _store->evictor()->pinServants(_store, identities, servants);
+
+    vector<IndexMatch> result;
+    result.reserve(identities.size());
+    for(vector<Identity>::const_iterator p = identities.begin(); p != identities.end(); ++p)
+    {
+        IndexMatch match;
+        match.ident = *p;
+        map<Identity, ObjectPtr>::const_iterator q = servants.find(*p);
+        if(q != servants.end())
+        {
+            match.servant = q->second;
+        }
+        result.push_back(match);
+    }
+    return result;
+}
+
+vector<Identity>
+Freeze::IndexI::findFirst(const Key& bytes, Int firstN, vector<UnsavedObject>& unsaved) const
+{
     Dbt dbKey;
     initializeInDbt(bytes, dbKey);
 #if (DB_VERSION_MAJOR <= 4) || (DB_VERSION_MAJOR == 5 && DB_VERSION_MINOR <= 1)
@@ -68,6 +164,17 @@ Freeze::IndexI::untypedFindFirst(const Key& bytes, Int firstN) const
     TransactionIPtr transaction = _store->evictor()->beforeQuery();
     DbTxn* tx = transaction == 0 ? 0 : transaction->dbTxn();
 
+    //
+    // The unsaved objects can replace database records, so we may need
+    // more records
+    //
+    _store->evictor()->unsavedObjects(_store, unsaved);
+    Int dbFirstN = firstN;
+    if(firstN > 0 && !unsaved.empty())
+    {
+        dbFirstN += static_cast<Int>(unsaved.size());
+    }
+
     vector<Identity> identities;
 
     try
@@ -121,7 +228,7 @@ Freeze::IndexI::untypedFindFirst(const Key& bytes, Int firstN) const
                         }
                     }
                 }
-                while((firstN <= 0 || identities.size() < static_cast<size_t>(firstN)) && found);
+                while((dbFirstN <= 0 || identities.size() < static_cast<size_t>(dbFirstN)) && found);
 
                 Dbc* toClose = dbc;
                 dbc = 0;
@@ -189,6 +296,15 @@ Freeze::IndexI::untypedFindFirst(const Key& bytes, Int firstN) const
         handleDbException(dx, __FILE__, __LINE__);
     }
 
+    if(!unsaved.empty())
+    {
+        merge(identities, bytes, unsaved);
+        if(firstN > 0 && identities.size() > static_cast<size_t>(firstN))
+        {
+            identities.resize(static_cast<size_t>(firstN));
+        }
+    }
+
     return identities;
 }
 
@@ -229,6 +345,15 @@ Freeze::IndexI::untypedCount(const Key& bytes) const
     TransactionIPtr transaction = _store->evictor()->beforeQuery();
     DbTxn* tx = transaction == 0 ? 0 : transaction->dbTxn();
 
+    //
+    // With unsaved objects, we need to know which records they replace
+    //
+    vector<UnsavedObject> unsaved;
+    if(_store->evictor()->unsavedObjects(_store, unsaved) && !unsaved.empty())
+    {
+        return static_cast<Int>(untypedFindFirst(bytes, 0).size());
+    }
+
     Int result = 0;
 
     try
@@ -324,6 +449,393 @@ Freeze::IndexI::untypedCount(const Key& bytes) const
     return result;
 }
 
+vector<Identity>
+Freeze::IndexI::untypedFindRange(const Key& lower, const Key& upper, Int firstN, IndexPosition& position) const
+{
+    DeactivateController::Guard
+        deactivateGuard(_store->evictor()->deactivateController());
+
+    const IndexPosition start = position;
+
+    TransactionIPtr transaction = _store->evictor()->beforeQuery();
+
+    //
+    // The unsaved objects replace their database records; those in range
+    // are merged with the records of the page by key position
+    //
+    vector<UnsavedObject> unsaved;
+    _store->evictor()->unsavedObjects(_store, unsaved);
+
+    vector<Identity> identities;
+    vector<IndexPosition> positions;
+    bool more = scan(transaction, lower, upper, false, firstN, position, identities,
+                     unsaved.empty() ? 0 : &positions);
+
+    if(!unsaved.empty())
+    {
+        EntryLess less(*this);
+
+        set<Identity> unsavedIdentities;
+        vector<pair<IndexPosition, Identity> > entries;
+        for(vector<UnsavedObject>::const_iterator p = unsaved.begin(); p != unsaved.end(); ++p)
+        {
+            unsavedIdentities.insert(p->ident);
+
+            IndexPosition entry;
+            if(!marshalKey(*p, entry.key) ||
+               (!lower.empty() && _index.compare(entry.key, lower) < 0) ||
+               (!upper.empty() && _index.compare(entry.key, upper) >= 0))
+            {
+                continue;
+            }
+
+            Dbt dbKey;
+            ObjectStoreBase::KeyMarshaler km(p->ident, *_store);
+            km.getDbt(dbKey);
+            const Byte* data = static_cast<const Byte*>(dbKey.get_data());
+            entry.primaryKey.assign(data, data + dbKey.get_size());
+
+            //
+            // In this page: after the position it resumes from, and not
+            // after the last record read when more records remain
+            //
+            if((!start.key.empty() && !less(start, entry)) || (more && less(position, entry)))
+            {
+                continue;
+            }
+            entries.push_back(make_pair(entry, p->ident));
+        }
+
+        for(size_t i = 0; i < identities.size(); ++i)
+        {
+            if(unsavedIdentities.find(identities[i]) == unsavedIdentities.end())
+            {
+                entries.push_back(make_pair(positions[i], identities[i]));
+            }
+        }
+        sort(entries.begin(), entries.end(), less);
+
+        //
+        // The next page resumes after the last entry returned
+        //
+        if(firstN > 0 && entries.size() > static_cast<size_t>(firstN))
+        {
+            entries.resize(static_cast<size_t>(firstN));
+            position = entries.back().first;
+            more = true;
+        }
+
+        identities.clear();
+        for(vector<pair<IndexPosition, Identity> >::const_iterator p = entries.begin(); p != entries.end(); ++p)
+        {
+            identities.push_back(p->second);
+        }
+    }
+
+    if(!more)
+    {
+        position = IndexPosition();
+    }
+    return identities;
+}
+
+EvictorIteratorPtr
+Freeze::IndexI::untypedGetIterator(const Key& lower, const Key& upper, bool exact, Int batchSize) const
+{
+    DeactivateController::Guard
+        deactivateGuard(_store->evictor()->deactivateController());
+
+    TransactionIPtr transaction = _store->evictor()->beforeQuery();
+    vector<UnsavedObject> unsaved;
+    _store->evictor()->unsavedObjects(_store, unsaved);
+
+    set<Identity> unsavedIdentities;
+    vector<Identity> unsavedLive;
+    for(vector<UnsavedObject>::const_iterator p = unsaved.begin(); p != unsaved.end(); ++p)
+    {
+        if(unsavedIdentities.insert(p->ident).second && matches(*p, lower, upper, exact))
+        {
+            unsavedLive.push_back(p->ident);
+        }
+    }
+
+    return new IndexIteratorI(&_index, transaction, lower, upper, exact, batchSize, unsavedIdentities, unsavedLive);
+}
+
+bool
+Freeze::IndexI::scan(const TransactionIPtr& transaction, const Key& lower, const Key& upper, bool exact,
+                     Int firstN, IndexPosition& position, vector<Identity>& identities,
+                     vector<IndexPosition>* positions) const
+{
+    DbTxn* tx = transaction == 0 ? 0 : transaction->dbTxn();
+
+    //
+    // The identities are unmarshaled once the cursor is closed
+    //
+    vector<Key> primaryKeys;
+    Key lastKey;
+    bool more = false;
+
+    try
+    {
+        for(;;)
+        {
+            const Key& start = position.key.empty() ? lower : position.key;
+
+            Key key(start);
+            key.reserve(1024);
+            Dbt dbKey;
+            initializeOutDbt(key, dbKey);
+            dbKey.set_size(static_cast<u_int32_t>(start.size()));
+
+            Key pkey(1024);
+            Dbt pdbKey;
+            initializeOutDbt(pkey, pdbKey);
+
+            Dbt dbValue;
+            dbValue.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+            Dbc* dbc = 0;
+            try
+            {
+                _db->cursor(tx, &dbc, 0);
+                u_int32_t flags = start.empty() ? DB_FIRST : DB_SET_RANGE;
+
+                for(;;)
+                {
+                    bool found;
+                    for(;;)
+                    {
+                        try
+                        {
+                            //
+                            // It is critical to set key size to key capacity before the
+                            // get, as a resize that increases the size inserts 0
+                            //
+                            key.resize(key.capacity());
+                            pkey.resize(pkey.capacity());
+
+                            found = (dbc->pget(&dbKey, &pdbKey, &dbValue, flags) == 0);
+                            if(found)
+                            {
+                                key.resize(dbKey.get_size());
+                                pkey.resize(pdbKey.get_size());
+                                flags = DB_NEXT;
+                            }
+                            break; // for(;;)
+                        }
+                        catch(const DbDeadlockException&)
+                        {
+                            throw;
+                        }
+                        catch(const DbException& dx)
+                        {
+                            handleDbException(dx, key, dbKey, pkey, pdbKey, __FILE__, __LINE__);
+                        }
+                    }
+
+                    if(!found ||
+                       (exact && !equal(key, lower)) ||
+                       (!exact && !upper.empty() && _index.compare(key, upper) >= 0))
+                    {
+                        more = false;
+                        break;
+                    }
+
+                    //
+                    // Skip the records up to the position; the duplicates of
+                    // a key are sorted by primary key
+                    //
+                    if(!position.key.empty() && pkey <= position.primaryKey && equal(key, position.key))
+                    {
+                        continue;
+                    }
+
+                    if(firstN > 0 && primaryKeys.size() >= static_cast<size_t>(firstN))
+                    {
+                        more = true;
+                        break;
+                    }
+
+                    primaryKeys.push_back(pkey);
+                    if(key != lastKey)
+                    {
+                        lastKey = key;
+                    }
+                    if(positions != 0)
+                    {
+                        IndexPosition read;
+                        read.key = key;
+                        read.primaryKey = pkey;
+                        positions->push_back(read);
+                    }
+                }
+
+                Dbc* toClose = dbc;
+                dbc = 0;
+                toClose->close();
+                break; // for (;;)
+            }
+            catch(const DbDeadlockException&)
+            {
+                if(dbc != 0)
+                {
+                    try
+                    {
+                        dbc->close();
+                    }
+                    catch(const DbDeadlockException&)
+                    {
+                        if(tx != 0)
+                        {
+                            throw;
+                        }
+                        // Else ignored
+                    }
+                }
+
+                if(_store->evictor()->deadlockWarning())
+                {
+                    Warning out(_store->communicator()->getLogger());
+                    out << "Deadlock in Freeze::IndexI::scan while searching \""
+                        << _store->evictor()->filename() + "/" + _dbName << "\"; resuming ...";
+                }
+
+                if(tx != 0)
+                {
+                    throw;
+                }
+
+                //
+                // Resume after the last record read
+                //
+                if(!primaryKeys.empty())
+                {
+                    position.key = lastKey;
+                    position.primaryKey = primaryKeys.back();
+                }
+            }
+            catch(...)
+            {
+                if(dbc != 0)
+                {
+                    try
+                    {
+                        dbc->close();
+                    }
+                    catch(const DbDeadlockException&)
+                    {
+                        if(tx != 0)
+                        {
+                            throw;
+                        }
+                        // Else ignored
+                    }
+                }
+                throw;
+            }
+        }
+    }
+    catch(const DbDeadlockException& dx)
+    {
+        throw DeadlockException(__FILE__, __LINE__, dx.what(), transaction);
+    }
+    catch(const DbException& dx)
+    {
+        handleDbException(dx, __FILE__, __LINE__);
+    }
+
+    if(!primaryKeys.empty())
+    {
+        position.key = lastKey;
+        position.primaryKey = primaryKeys.back();
+    }
+
+    const Ice::CommunicatorPtr& communicator = _store->communicator();
+    const Ice::EncodingVersion& encoding = _store->encoding();
+
+    identities.reserve(identities.size() + primaryKeys.size());
+    for(vector<Key>::const_iterator p = primaryKeys.begin(); p != primaryKeys.end(); ++p)
+    {
+        Ice::Identity ident;
+        ObjectStoreBase::unmarshal(ident, *p, communicator, encoding);
+        identities.push_back(ident);
+    }
+    return more;
+}
+
+bool
+Freeze::IndexI::matches(const UnsavedObject& object, const Key& lower, const Key& upper, bool exact) const
+{
+    Key key;
+    if(!marshalKey(object, key))
+    {
+        return false;
+    }
+
+    if(exact)
+    {
+        return equal(key, lower);
+    }
+    else
+    {
+        return (lower.empty() || _index.compare(key, lower) >= 0) && (upper.empty() || _index.compare(key, upper) < 0);
+    }
+}
+
+bool
+Freeze::IndexI::equal(const Key& k1, const Key& k2) const
+{
+    return k1 == k2 || (_index._ordered && _index.compare(k1, k2) == 0);
+}
+
+void
+Freeze::IndexI::merge(vector<Identity>& identities, const Key& bytes, const vector<UnsavedObject>& unsaved) const
+{
+    set<Identity> unsavedIdentities;
+    for(vector<UnsavedObject>::const_iterator p = unsaved.begin(); p != unsaved.end(); ++p)
+    {
+        unsavedIdentities.insert(p->ident);
+    }
+
+    vector<Identity> result;
+    for(vector<Identity>::const_iterator p = identities.begin(); p != identities.end(); ++p)
+    {
+        if(unsavedIdentities.find(*p) == unsavedIdentities.end())
+        {
+            result.push_back(*p);
+        }
+    }
+
+    for(vector<UnsavedObject>::const_iterator p = unsaved.begin(); p != unsaved.end(); ++p)
+    {
+        Key key;
+        if(marshalKey(*p, key) && key == bytes)
+        {
+            result.push_back(p->ident);
+        }
+    }
+
+    identities.swap(result);
+}
+
+bool
+Freeze::IndexI::marshalKey(const UnsavedObject& object, Key& key) const
+{
+    if(object.value.empty())
+    {
+        return false;
+    }
+
+    //
+    // The key of an unsaved object is computed from a private copy of the
+    // object as streamed by the evictor, so we don't lock its servant
+    //
+    ObjectRecord rec;
+    ObjectStoreBase::unmarshal(rec, object.value, _store->communicator(), _store->encoding(), _store->keepStats());
+    return _index.marshalKey(rec.servant, key);
+}
+
 void
 Freeze::IndexI::associate(ObjectStoreBase* store, DbTxn* txn,
                           bool createDb, bool populateIndex)
@@ -337,6 +849,11 @@ Freeze::IndexI::associate(ObjectStoreBase* store, DbTxn* txn,
     _db->set_flags(DB_DUP | DB_DUPSORT);
     _db->set_app_private(this);
 
+    if(_index._ordered)
+    {
+        _db->set_bt_compare(&customIndexCompare);
+    }
+
     _dbName = EvictorIBase::indexPrefix + store->dbName() + "." + _index.name();
 
     Ice::PropertiesPtr properties = store->communicator()->getProperties();
@@ -372,6 +889,10 @@ Freeze::IndexI::associate(ObjectStoreBase* store, DbTxn* txn,
     {
         flags = DB_CREATE;
     }
+    if(store->evictor()->multiversion())
+    {
+        flags |= DB_MULTIVERSION;
+    }
 
     //
     //
@@ -394,16 +915,27 @@ Freeze::IndexI::associate(ObjectStoreBase* store, DbTxn* txn,
 }
 
 int
-Freeze::IndexI::secondaryKeyCreate(Db* /*secondary*/, const Dbt* /*dbKey*/,
+Freeze::IndexI::secondaryKeyCreate(Db* /*secondary*/, const Dbt* dbKey,
                                    const Dbt* dbValue, Dbt* result)
 {
-    const Ice::CommunicatorPtr& communicator = _store->communicator();
-    const Ice::EncodingVersion& encoding = _store->encoding();
+    if(_store->colocated())
+    {
+        //
+        // Only index the facet of this index
+        //
+        Identity ident;
+        if(!_store->unmarshalKey(ident, static_cast<const Byte*>(dbKey->get_data()), dbKey->get_size()))
+        {
+            return DB_DONOTINDEX;
+        }
+    }
 
-    ObjectRecord rec;
-    Byte* first = static_cast<Byte*>(dbValue->get_data());
-    Value value(first, first + dbValue->get_size());
-    ObjectStoreBase::unmarshal(rec, value, communicator, encoding, _store->keepStats());
+    //
+    // The first index unmarshals the record for all the indices of the
+    // store
+    //
+    ObjectRecord scratch;
+    const ObjectRecord& rec = _store->decodedRecord(*dbValue, scratch);
 
     Key bytes;
     if(_index.marshalKey(rec.servant, bytes))
@@ -440,3 +972,9 @@ Freeze::IndexI::close()
         _db.reset(0);
     }
 }
+
+int
+Freeze::IndexI::compare(const Key& k1, const Key& k2) const
+{
+    return _index.compare(k1, k2);
+}
@@ -24,8 +24,30 @@ public:
 
     std::vector<Ice::Identity> untypedFindFirst(const Key&, Ice::Int) const;
 
+    std::vector<IndexMatch> untypedFindFirstServants(const Key&, Ice::Int) const;
+
     std::vector<Ice::Identity> untypedFind(const Key&) const;
 
+    std::vector<Ice::Identity> untypedFindRange(const Key&, const Key&, Ice::Int, IndexPosition&) const;
+
+    EvictorIteratorPtr untypedGetIterator(const Key&, const Key&, bool, Ice::Int) const;
+
+    //
+    // Reads the identities of up to firstN records after the position,
+    // either with a key in [lower, upper), or equal to lower when exact is
+    // true, and moves the position to the last record read. Returns true
+    // when more records remain. A deadlock outside a transaction resumes
+    // the scan at the position instead of starting over. The positions of
+    // the records read are returned too when positions is not null.
+    //
+    bool scan(const TransactionIPtr&, const Key&, const Key&, bool, Ice::Int, IndexPosition&,
+              std::vector<Ice::Identity>&, std::vector<IndexPosition>* = 0) const;
+
+    ObjectStoreBase* store() const
+    {
+        return _store;
+    }
+
     Ice::Int untypedCount(const Key&) const;
 
     void
@@ -37,8 +59,21 @@ public:
     void
     close();
 
+    int
+    compare(const Key&, const Key&) const;
+
 private:
 
+    std::vector<Ice::Identity> findFirst(const Key&, Ice::Int, std::vector<UnsavedObject>&) const;
+
+    void merge(std::vector<Ice::Identity>&, const Key&, const std::vector<UnsavedObject>&) const;
+
+    bool marshalKey(const UnsavedObject&, Key&) const;
+
+    bool matches(const UnsavedObject&, const Key&, const Key&, bool) const;
+
+    bool equal(const Key&, const Key&) const;
+
     Index& _index;
     std::string _dbName;
     IceInternal::UniquePtr<Db> _db;
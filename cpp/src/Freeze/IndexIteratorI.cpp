@@ -0,0 +1,93 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#include <Freeze/IndexIteratorI.h>
+#include <Freeze/IndexI.h>
+#include <Freeze/ObjectStore.h>
+#include <Freeze/EvictorI.h>
+
+using namespace std;
+using namespace Freeze;
+using namespace Ice;
+
+Freeze::IndexIteratorI::IndexIteratorI(const IndexPtr& index, const TransactionIPtr& tx, const Key& lower,
+                                       const Key& upper, bool exact, Int batchSize, const set<Identity>& unsaved,
+                                       const vector<Identity>& unsavedLive) :
+    _index(index),
+    _tx(tx),
+    _lower(lower),
+    _upper(upper),
+    _exact(exact),
+    _batchSize(batchSize > 0 ? batchSize : 1),
+    _more(true),
+    _unsaved(unsaved),
+    _unsavedLive(unsavedLive)
+{
+    _batchIterator = _batch.end();
+}
+
+bool
+Freeze::IndexIteratorI::hasNext()
+{
+    //
+    // A batch can be empty when all its records are unsaved objects
+    //
+    while(_batchIterator == _batch.end() && (_more || !_unsavedLive.empty()))
+    {
+        _batchIterator = nextBatch();
+    }
+    return _batchIterator != _batch.end();
+}
+
+Identity
+Freeze::IndexIteratorI::next()
+{
+    if(hasNext())
+    {
+        return *_batchIterator++;
+    }
+    else
+    {
+        throw Freeze::NoSuchElementException(__FILE__, __LINE__);
+    }
+}
+
+vector<Identity>::const_iterator
+Freeze::IndexIteratorI::nextBatch()
+{
+    _batch.clear();
+
+    if(!_more)
+    {
+        //
+        // Then the live objects not saved yet
+        //
+        _batch.swap(_unsavedLive);
+        return _batch.begin();
+    }
+
+    const IndexI& index = *_index->_impl;
+
+    DeactivateController::Guard
+        deactivateGuard(index.store()->evictor()->deactivateController());
+
+    _more = index.scan(_tx, _lower, _upper, _exact, _batchSize, _position, _batch);
+
+    if(!_unsaved.empty())
+    {
+        vector<Identity> batch;
+        for(vector<Identity>::const_iterator p = _batch.begin(); p != _batch.end(); ++p)
+        {
+            if(_unsaved.find(*p) == _unsaved.end())
+            {
+                batch.push_back(*p);
+            }
+        }
+        _batch.swap(batch);
+    }
+
+    return _batch.begin();
+}
@@ -0,0 +1,64 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_INDEX_ITERATOR_I_H
+#define FREEZE_INDEX_ITERATOR_I_H
+
+#include <Ice/Ice.h>
+#include <Freeze/Freeze.h>
+#include <Freeze/Index.h>
+#include <vector>
+#include <set>
+
+namespace Freeze
+{
+
+class TransactionI;
+typedef IceUtil::Handle<TransactionI> TransactionIPtr;
+
+//
+// Iterates over the objects found by an index query one batch at a time;
+// each batch resumes the scan after the last record of the previous one
+//
+class IndexIteratorI : public EvictorIterator
+{
+public:
+
+    IndexIteratorI(const IndexPtr&, const TransactionIPtr&, const Key&, const Key&, bool, Ice::Int,
+                   const std::set<Ice::Identity>&, const std::vector<Ice::Identity>&);
+
+    virtual bool hasNext();
+    virtual Ice::Identity next();
+
+private:
+
+    std::vector<Ice::Identity>::const_iterator
+    nextBatch();
+
+    const IndexPtr _index;
+    const TransactionIPtr _tx;
+    const Key _lower;
+    const Key _upper;
+    const bool _exact;
+    const Ice::Int _batchSize;
+
+    IndexPosition _position;
+    std::vector<Ice::Identity> _batch;
+    std::vector<Ice::Identity>::const_iterator _batchIterator;
+    bool _more;
+
+    //
+    // The objects not saved yet replace the database records with the same
+    // identity; the live ones that match are returned after the database
+    // records
+    //
+    std::set<Ice::Identity> _unsaved;
+    std::vector<Ice::Identity> _unsavedLive;
+};
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#include <Freeze/KeyFilter.h>
+
+using namespace std;
+using namespace Freeze;
+using namespace Ice;
+
+Freeze::KeyFilter::KeyFilter(size_t bloomFilterBits, size_t missCacheSize) :
+    _missCacheSize(missCacheSize),
+    _bits(bloomFilterBits, false),
+    _epoch(0)
+{
+}
+
+void
+Freeze::KeyFilter::add(const Byte* key, size_t size)
+{
+    unsigned int h1;
+    unsigned int h2;
+    hash(key, size, h1, h2);
+
+    IceUtil::Mutex::Lock sync(_mutex);
+    ++_epoch;
+
+    if(!_bits.empty())
+    {
+        for(size_t i = 0; i < hashCount; ++i)
+        {
+            _bits[(h1 + i * h2) % _bits.size()] = true;
+        }
+    }
+
+    if(!_misses.empty())
+    {
+        _misses.erase(Key(key, key + size));
+    }
+}
+
+bool
+Freeze::KeyFilter::missing(const Byte* key, size_t size) const
+{
+    unsigned int h1;
+    unsigned int h2;
+    hash(key, size, h1, h2);
+
+    IceUtil::Mutex::Lock sync(_mutex);
+
+    if(!_bits.empty())
+    {
+        for(size_t i = 0; i < hashCount; ++i)
+        {
+            if(!_bits[(h1 + i * h2) % _bits.size()])
+            {
+                return true;
+            }
+        }
+    }
+
+    return !_misses.empty() && _misses.find(Key(key, key + size)) != _misses.end();
+}
+
+Long
+Freeze::KeyFilter::lookupStarted() const
+{
+    IceUtil::Mutex::Lock sync(_mutex);
+    return _epoch;
+}
+
+void
+Freeze::KeyFilter::missed(const Byte* key, size_t size, Long epoch)
+{
+    if(_missCacheSize == 0)
+    {
+        return;
+    }
+
+    IceUtil::Mutex::Lock sync(_mutex);
+    if(epoch != _epoch)
+    {
+        //
+        // This key may have been added during the lookup
+        //
+        return;
+    }
+
+    Key k(key, key + size);
+    if(_misses.insert(k).second)
+    {
+        _missOrder.push_back(k);
+
+        //
+        // The oldest entry can be a key added since, which is already out
+        // of the cache
+        //
+        while(_missOrder.size() > _missCacheSize)
+        {
+            _misses.erase(_missOrder.front());
+            _missOrder.pop_front();
+        }
+    }
+}
+
+size_t
+Freeze::KeyFilter::bloomFilterBits() const
+{
+    return _bits.size();
+}
+
+void
+Freeze::KeyFilter::hash(const Byte* key, size_t size, unsigned int& h1, unsigned int& h2) const
+{
+    //
+    // Double hashing with FNV-1a and sdbm; h2 is odd so that it never
+    // degenerates to a single bit
+    //
+    h1 = 2166136261U;
+    h2 = 0;
+    for(size_t i = 0; i < size; ++i)
+    {
+        h1 = (h1 ^ key[i]) * 16777619U;
+        h2 = key[i] + (h2 << 6) + (h2 << 16) - h2;
+    }
+    h2 |= 1;
+}
@@ -0,0 +1,70 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_KEY_FILTER_H
+#define FREEZE_KEY_FILTER_H
+
+#include <IceUtil/Mutex.h>
+#include <Freeze/DB.h>
+
+#include <vector>
+#include <deque>
+#include <set>
+
+namespace Freeze
+{
+
+//
+// Answers definite misses for the keys of a database without touching the
+// database, with a Bloom filter of all its keys and a bounded cache of keys
+// recently looked up and not found. Either can be disabled with a 0 size.
+//
+// Keys must be added before they are written to the database. A miss is
+// only cached when no key was added during the lookup, which the caller
+// brackets with lookupStarted and missed.
+//
+class KeyFilter
+{
+public:
+
+    KeyFilter(size_t, size_t);
+
+    void add(const Ice::Byte*, size_t);
+
+    //
+    // Returns true when the key is definitely not in the database
+    //
+    bool missing(const Ice::Byte*, size_t) const;
+
+    Ice::Long lookupStarted() const;
+    void missed(const Ice::Byte*, size_t, Ice::Long);
+
+    //
+    // Number of bits of the Bloom filter, 0 when disabled
+    //
+    size_t bloomFilterBits() const;
+
+private:
+
+    void hash(const Ice::Byte*, size_t, unsigned int&, unsigned int&) const;
+
+    static const size_t hashCount = 7;
+
+    const size_t _missCacheSize;
+
+    //
+    // Protected by _mutex
+    //
+    mutable IceUtil::Mutex _mutex;
+    std::vector<bool> _bits;
+    std::set<Key> _misses;
+    std::deque<Key> _missOrder;
+    Ice::Long _epoch; // Incremented by add
+};
+
+}
+
+#endif
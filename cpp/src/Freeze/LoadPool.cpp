@@ -0,0 +1,179 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#include <Freeze/LoadPool.h>
+
+using namespace std;
+using namespace Freeze;
+using namespace Ice;
+
+class Freeze::LoadPool::LoadThread : public IceUtil::Thread
+{
+public:
+
+    //
+    // The pool joins this thread in destroy
+    //
+    LoadThread(LoadPool* pool) :
+        IceUtil::Thread("Freeze evictor load thread"),
+        _pool(pool)
+    {
+    }
+
+    virtual void run()
+    {
+        _pool->run();
+    }
+
+private:
+
+    LoadPool* _pool;
+};
+
+Freeze::LoadPool::LoadPool(const CommunicatorPtr& communicator, Int threads, size_t maxQueued) :
+    _communicator(communicator),
+    _maxQueued(maxQueued),
+    _maxRunning(threads > 0 ? static_cast<size_t>(threads) : 1),
+    _destroyed(false),
+    _running(0),
+    _waiting(0)
+{
+    for(Int i = 0; i < threads; ++i)
+    {
+        IceUtil::ThreadPtr thread = new LoadThread(this);
+        _threads.push_back(thread->start());
+    }
+}
+
+bool
+Freeze::LoadPool::submit(const TaskPtr& task)
+{
+    Lock sync(*this);
+    if(_destroyed || _tasks.size() >= _maxQueued)
+    {
+        return false;
+    }
+
+    _tasks.push_back(task);
+
+    //
+    // The threads waiting for a running slot wait on this monitor too
+    //
+    if(_waiting > 0)
+    {
+        notifyAll();
+    }
+    else
+    {
+        notify();
+    }
+    return true;
+}
+
+Freeze::LoadPool::Slot::Slot(LoadPool& pool) :
+    _pool(pool)
+{
+    _pool.acquireSlot();
+}
+
+Freeze::LoadPool::Slot::~Slot()
+{
+    _pool.release();
+}
+
+void
+Freeze::LoadPool::destroy()
+{
+    {
+        Lock sync(*this);
+        _destroyed = true;
+        notifyAll();
+    }
+
+    for(vector<IceUtil::ThreadControl>::iterator p = _threads.begin(); p != _threads.end(); ++p)
+    {
+        p->join();
+    }
+    _threads.clear();
+}
+
+size_t
+Freeze::LoadPool::threadCount() const
+{
+    return _threads.size();
+}
+
+void
+Freeze::LoadPool::run()
+{
+    for(;;)
+    {
+        TaskPtr task;
+        {
+            Lock sync(*this);
+            while(!_destroyed && _tasks.empty())
+            {
+                wait();
+            }
+            if(_tasks.empty())
+            {
+                return;
+            }
+            task = _tasks.front();
+            _tasks.pop_front();
+            acquire();
+        }
+
+        try
+        {
+            task->run();
+        }
+        catch(const std::exception& ex)
+        {
+            Error out(_communicator->getLogger());
+            out << "Freeze evictor load thread: " << ex.what();
+        }
+        catch(...)
+        {
+            Error out(_communicator->getLogger());
+            out << "Freeze evictor load thread: unknown exception";
+        }
+        release();
+    }
+}
+
+void
+Freeze::LoadPool::acquire()
+{
+    //
+    // Once destroyed, the remaining tasks run right away
+    //
+    while(!_destroyed && _running >= _maxRunning)
+    {
+        ++_waiting;
+        wait();
+        --_waiting;
+    }
+    ++_running;
+}
+
+void
+Freeze::LoadPool::acquireSlot()
+{
+    Lock sync(*this);
+    acquire();
+}
+
+void
+Freeze::LoadPool::release()
+{
+    Lock sync(*this);
+    --_running;
+    if(_waiting > 0)
+    {
+        notifyAll();
+    }
+}
@@ -0,0 +1,106 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_LOAD_POOL_H
+#define FREEZE_LOAD_POOL_H
+
+#include <IceUtil/IceUtil.h>
+#include <Ice/Ice.h>
+
+#include <deque>
+#include <vector>
+
+namespace Freeze
+{
+
+//
+// Bounds the number of concurrent database reads of an evictor, so that
+// it doesn't grow with the number of dispatch threads. The dispatch
+// threads load their cache misses themselves, once they get a load slot;
+// the threads of the pool only run the prefetches.
+//
+class LoadPool : private IceUtil::Monitor<IceUtil::Mutex>
+{
+public:
+
+    //
+    // Holds a load slot, waiting for one if they are all taken
+    //
+    class Slot
+    {
+    public:
+
+        Slot(LoadPool&);
+        ~Slot();
+
+    private:
+
+        Slot(const Slot&);
+        void operator=(const Slot&);
+
+        LoadPool& _pool;
+    };
+
+    class Task : public IceUtil::Shared
+    {
+    public:
+
+        //
+        // Must not throw
+        //
+        virtual void run() = 0;
+    };
+    typedef IceUtil::Handle<Task> TaskPtr;
+
+    LoadPool(const Ice::CommunicatorPtr&, Ice::Int, size_t);
+
+    //
+    // Returns false when the queue is full, in which case the caller runs
+    // the task itself
+    //
+    bool submit(const TaskPtr&);
+
+    //
+    // Runs the queued tasks and joins the threads; must be called before
+    // the pool is deleted
+    //
+    void destroy();
+
+    size_t threadCount() const;
+
+private:
+
+    class LoadThread;
+    friend class LoadThread;
+    friend class Slot;
+
+    void run();
+
+    //
+    // acquire is called with this monitor locked
+    //
+    void acquire();
+    void acquireSlot();
+    void release();
+
+    const Ice::CommunicatorPtr _communicator;
+    const size_t _maxQueued;
+    const size_t _maxRunning;
+
+    //
+    // Protected by this monitor
+    //
+    std::deque<TaskPtr> _tasks;
+    bool _destroyed;
+    size_t _running;
+    size_t _waiting; // for a load slot
+
+    std::vector<IceUtil::ThreadControl> _threads;
+};
+
+}
+
+#endif
@@ -9,11 +9,14 @@
 #include <Freeze/BackgroundSaveEvictorI.h>
 #include <Freeze/Util.h>
 #include <Freeze/Catalog.h>
+#include <Freeze/CatalogIndexList.h>
 #include <Freeze/TransactionI.h>
 #include <Freeze/IndexI.h>
 
 #include <Ice/StringConverter.h>
 
+#include <algorithm>
+
 using namespace std;
 using namespace Ice;
 using namespace Freeze;
@@ -22,12 +25,16 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
                                          bool createDb,  EvictorIBase* evictor,
                                          const vector<IndexPtr>& indices,
                                          bool populateEmptyIndices) :
+    _db(0),
     _facet(facet),
     _evictor(evictor),
     _indices(indices),
     _communicator(evictor->communicator()),
     _encoding(evictor->encoding()),
-    _keepStats(false)
+    _keepStats(false),
+    _facetIndex(-1),
+    _colocated(evictor->colocateFacets()),
+    _facetKeySize(0)
 {
     if(facet == "")
     {
@@ -75,27 +82,46 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
 
     DbEnv* dbEnv = evictor->dbEnv()->getEnv();
 
+    //
+    // With colocated facets, the first store opens the database of all
+    // the facets, where the keys are followed by the facet
+    //
+    string dbName = _dbName;
+    IceInternal::UniquePtr<Db> db;
+    if(_colocated)
+    {
+        dbName = EvictorIBase::colocatedDbName;
+        _db = evictor->colocatedDb();
+
+        Ice::OutputStream os(_communicator, _encoding);
+        os.write(_facet);
+        _facetKeySize = os.b.size();
+    }
+
     try
     {
-        _db.reset(new Db(dbEnv, 0));
+        if(_db == 0)
+        {
+            db.reset(new Db(dbEnv, 0));
+        }
 
         Ice::PropertiesPtr properties = evictor->communicator()->getProperties();
         string propPrefix = "Freeze.Evictor." + evictor->filename() + ".";
 
-        int btreeMinKey = properties->getPropertyAsInt(propPrefix + _dbName + ".BtreeMinKey");
-        if(btreeMinKey > 2)
+        int btreeMinKey = properties->getPropertyAsInt(propPrefix + dbName + ".BtreeMinKey");
+        if(db.get() != 0 && btreeMinKey > 2)
         {
             if(evictor->trace() >= 1)
             {
                 Trace out(evictor->communicator()->getLogger(), "Freeze.Evictor");
-                out << "Setting \"" << evictor->filename() + "." + _dbName << "\"'s btree minkey to " << btreeMinKey;
+                out << "Setting \"" << evictor->filename() + "." + dbName << "\"'s btree minkey to " << btreeMinKey;
             }
 
-            _db->set_bt_minkey(btreeMinKey);
+            db->set_bt_minkey(btreeMinKey);
         }
 
         bool checksum = properties->getPropertyAsInt(propPrefix + "Checksum") > 0;
-        if(checksum)
+        if(db.get() != 0 && checksum)
         {
             if(evictor->trace() >= 1)
             {
@@ -103,11 +129,11 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
                 out << "Turning checksum on for \"" << evictor->filename() << "\"";
             }
 
-            _db->set_flags(DB_CHKSUM);
+            db->set_flags(DB_CHKSUM);
         }
 
         int pageSize = properties->getPropertyAsInt(propPrefix + "PageSize");
-        if(pageSize > 0)
+        if(db.get() != 0 && pageSize > 0)
         {
             if(evictor->trace() >= 1)
             {
@@ -115,7 +141,7 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
                 out << "Setting \"" << evictor->filename() << "\"'s pagesize to " << pageSize;
             }
 
-            _db->set_pagesize(pageSize);
+            db->set_pagesize(pageSize);
         }
 
         TransactionPtr tx = catalogConnection->beginTransaction();
@@ -126,6 +152,10 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
         {
             flags |= DB_CREATE;
         }
+        if(evictor->multiversion())
+        {
+            flags |= DB_MULTIVERSION;
+        }
 
         //
         // Berkeley DB expects file paths to be UTF8 encoded. We keep
@@ -134,9 +164,13 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
         // possible without potentially breaking backward compatibility
         // with deployed databases.
         //
-        _db->open(txn,
-                  nativeToUTF8(evictor->filename(), getProcessStringConverter()).c_str(),
-                  _dbName.c_str(), DB_BTREE, flags, FREEZE_DB_MODE);
+        if(db.get() != 0)
+        {
+            db->open(txn,
+                     nativeToUTF8(evictor->filename(), getProcessStringConverter()).c_str(),
+                     dbName.c_str(), DB_BTREE, flags, FREEZE_DB_MODE);
+            _db = db.get();
+        }
 
         for(size_t i = 0; i < _indices.size(); ++i)
         {
@@ -152,7 +186,39 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
             catalog.put(Catalog::value_type(evictor->filename(), catalogData));
         }
 
+        if(_colocated)
+        {
+            //
+            // List this facet in the catalog, where the evictor finds the
+            // colocated facets when it's opened
+            //
+            CatalogIndexList catalogIndexList(catalogConnection, catalogIndexListName());
+            CatalogIndexList::iterator q = catalogIndexList.find(evictor->colocatedFacetsKey());
+            StringSeq facets;
+            if(q != catalogIndexList.end())
+            {
+                facets = q->second;
+            }
+            if(find(facets.begin(), facets.end(), _dbName) == facets.end())
+            {
+                facets.push_back(_dbName);
+                catalogIndexList.put(CatalogIndexList::value_type(evictor->colocatedFacetsKey(), facets));
+            }
+        }
+
         tx->commit();
+
+        if(db.get() != 0)
+        {
+            if(_colocated)
+            {
+                evictor->colocatedDbOpened(db.release());
+            }
+            else
+            {
+                _ownDb.reset(db.release());
+            }
+        }
     }
     catch(const DbException& dx)
     {
@@ -196,13 +262,43 @@ Freeze::ObjectStoreBase::ObjectStoreBase(const string& facet, const string& face
         }
         throw;
     }
+
+    //
+    // By default, every lookup goes to the database
+    //
+    Ice::PropertiesPtr properties = _communicator->getProperties();
+    string propPrefix = "Freeze.Evictor." + evictor->dbEnv()->getEnvName() + "." + evictor->filename() + ".";
+    Int bloomFilterSize = properties->getPropertyAsInt(propPrefix + "BloomFilterSize");
+    Int negativeCacheSize = properties->getPropertyAsInt(propPrefix + "NegativeCacheSize");
+    if(bloomFilterSize > 0 || negativeCacheSize > 0)
+    {
+        //
+        // 10 bits per key give about 1% of false positives
+        //
+        _keyFilter.reset(new KeyFilter(bloomFilterSize > 0 ? 10 * static_cast<size_t>(bloomFilterSize) : 0,
+                                       negativeCacheSize > 0 ? static_cast<size_t>(negativeCacheSize) : 0));
+    }
+
+    FacetDirectory* facetDirectory = evictor->facetDirectory();
+    if(facetDirectory != 0)
+    {
+        _facetIndex = facetDirectory->registerFacet(facet);
+    }
+
+    if((_keyFilter.get() != 0 && _keyFilter->bloomFilterBits() > 0) || _facetIndex >= 0)
+    {
+        loadKeys();
+    }
 }
 
 Freeze::ObjectStoreBase::~ObjectStoreBase()
 {
     try
     {
-        _db->close(0);
+        if(_ownDb.get() != 0)
+        {
+            _ownDb->close(0);
+        }
 
         for(size_t i = 0; i < _indices.size(); ++i)
         {
@@ -239,9 +335,15 @@ Freeze::ObjectStoreBase::dbHasObject(const Identity& ident, const TransactionIPt
     }
 
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
+    Long epoch = 0;
+    if(missing(dbKey, epoch))
+    {
+        return false;
+    }
+
     //
     // Keep 0 length since we're not interested in the data
     //
@@ -260,6 +362,14 @@ Freeze::ObjectStoreBase::dbHasObject(const Identity& ident, const TransactionIPt
             }
             else if(err == DB_NOTFOUND)
             {
+                //
+                // A transaction can see its own uncommitted removal, which
+                // may be rolled back; only non-transactional misses are cached
+                //
+                if(tx == 0)
+                {
+                    missed(dbKey, epoch);
+                }
                 return false;
             }
             else
@@ -302,6 +412,8 @@ Freeze::ObjectStoreBase::save(Dbt& key, Dbt& value, Byte status, DbTxn* tx)
         case modified:
         {
             u_int32_t flags = (status == created) ? DB_NOOVERWRITE : 0;
+            added(key);
+            DecodedPut decodedPut(*this, value);
             int err = _db->put(tx, &key, &value, flags);
             if(err != 0)
             {
@@ -338,6 +450,35 @@ Freeze::ObjectStoreBase::Marshaler::getDbt(Dbt& dbt) const
     initializeInDbt(const_cast<Ice::OutputStream&>(_os), dbt);
 }
 
+size_t
+Freeze::ObjectStoreBase::Marshaler::size() const
+{
+    return _os.b.size();
+}
+
+Freeze::ObjectStoreBase::Digest
+Freeze::ObjectStoreBase::Marshaler::digest() const
+{
+    return ObjectStoreBase::digest(_os.b.begin(), _os.b.size());
+}
+
+Freeze::ObjectStoreBase::Digest
+Freeze::ObjectStoreBase::digest(const Byte* bytes, size_t size)
+{
+    //
+    // Two independent 32-bit hashes (FNV-1a and sdbm) over the same bytes
+    //
+    Digest result;
+    result.size = size;
+    result.fnv = 2166136261U;
+    for(const Byte* p = bytes; p != bytes + size; ++p)
+    {
+        result.fnv = (result.fnv ^ *p) * 16777619U;
+        result.sdbm = *p + (result.sdbm << 6) + (result.sdbm << 16) - result.sdbm;
+    }
+    return result;
+}
+
 Freeze::ObjectStoreBase::KeyMarshaler::KeyMarshaler(const Identity& ident,
                                                     const CommunicatorPtr& communicator,
                                                     const EncodingVersion& encoding) :
@@ -346,6 +487,16 @@ Freeze::ObjectStoreBase::KeyMarshaler::KeyMarshaler(const Identity& ident,
     _os.write(ident);
 }
 
+Freeze::ObjectStoreBase::KeyMarshaler::KeyMarshaler(const Identity& ident, const ObjectStoreBase& store) :
+    Marshaler(store.communicator(), store.encoding())
+{
+    _os.write(ident);
+    if(store.colocated())
+    {
+        _os.write(store.facet());
+    }
+}
+
 Freeze::ObjectStoreBase::ValueMarshaler::ValueMarshaler(const ObjectRecord& rec,
                                                         const CommunicatorPtr& communicator,
                                                         const EncodingVersion& encoding,
@@ -366,6 +517,68 @@ Freeze::ObjectStoreBase::ValueMarshaler::ValueMarshaler(const ObjectRecord& rec,
     _os.endEncapsulation();
 }
 
+Freeze::ObjectStoreBase::DecodedPut::DecodedPut(ObjectStoreBase& store, const Dbt& value) :
+    _store(store),
+    _data(value.get_data()),
+    _registered(false)
+{
+    //
+    // With a single index, there is nothing to share
+    //
+    if(_store._indices.size() > 1)
+    {
+        DecodedRecord decoded;
+        decoded.size = value.get_size();
+        decoded.decoded = false;
+
+        IceUtil::Mutex::Lock sync(_store._decodedMutex);
+        _registered = _store._decoded.insert(make_pair(_data, decoded)).second;
+    }
+}
+
+Freeze::ObjectStoreBase::DecodedPut::~DecodedPut()
+{
+    if(_registered)
+    {
+        IceUtil::Mutex::Lock sync(_store._decodedMutex);
+        _store._decoded.erase(_data);
+    }
+}
+
+const ObjectRecord&
+Freeze::ObjectStoreBase::decodedRecord(const Dbt& dbValue, ObjectRecord& rec)
+{
+    DecodedRecord* decoded = 0;
+    if(_indices.size() > 1)
+    {
+        IceUtil::Mutex::Lock sync(_decodedMutex);
+        map<const void*, DecodedRecord>::iterator p = _decoded.find(dbValue.get_data());
+        if(p != _decoded.end() && p->second.size == dbValue.get_size())
+        {
+            decoded = &p->second;
+        }
+    }
+
+    if(decoded != 0 && decoded->decoded)
+    {
+        return decoded->rec;
+    }
+
+    //
+    // Berkeley DB also calls the indices with the previous value of a
+    // record it replaces, which is never registered
+    //
+    ObjectRecord& target = decoded != 0 ? decoded->rec : rec;
+    const Byte* first = static_cast<const Byte*>(dbValue.get_data());
+    Value value(first, first + dbValue.get_size());
+    unmarshal(target, value, _communicator, _encoding, _keepStats);
+    if(decoded != 0)
+    {
+        decoded->decoded = true;
+    }
+    return target;
+}
+
 void
 Freeze::ObjectStoreBase::unmarshal(Identity& ident,
                                    const Key& bytes,
@@ -376,6 +589,20 @@ Freeze::ObjectStoreBase::unmarshal(Identity& ident,
     stream.read(ident);
 }
 
+bool
+Freeze::ObjectStoreBase::unmarshalKey(Identity& ident, const Byte* key, size_t size) const
+{
+    Ice::InputStream stream(_communicator, _encoding, make_pair(key, key + size));
+    stream.read(ident);
+    if(_colocated)
+    {
+        string facet;
+        stream.read(facet);
+        return facet == _facet;
+    }
+    return true;
+}
+
 void
 Freeze::ObjectStoreBase::unmarshal(ObjectRecord& v,
                                    const Value& bytes,
@@ -401,7 +628,21 @@ Freeze::ObjectStoreBase::unmarshal(ObjectRecord& v,
 }
 
 bool
-Freeze::ObjectStoreBase::load(const Identity& ident, const TransactionIPtr& transaction, ObjectRecord& rec)
+Freeze::ObjectStoreBase::load(const Identity& ident, const TransactionIPtr& transaction, ObjectRecord& rec,
+                               bool forUpdate)
+{
+    Value value;
+    if(loadValue(ident, transaction, value, forUpdate))
+    {
+        decode(ident, value, rec);
+        return true;
+    }
+    return false;
+}
+
+bool
+Freeze::ObjectStoreBase::loadValue(const Identity& ident, const TransactionIPtr& transaction, Value& value,
+                                    bool forUpdate)
 {
     if(transaction == 0)
     {
@@ -416,22 +657,31 @@ Freeze::ObjectStoreBase::load(const Identity& ident, const TransactionIPtr& tran
     }
 
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
     const size_t defaultValueSize = 4096;
-    Value value(defaultValueSize);
+    value.resize(defaultValueSize);
 
     Dbt dbValue;
     initializeOutDbt(value, dbValue);
 
+    Long epoch = 0;
+    if(missing(dbKey, epoch))
+    {
+        return false;
+    }
+
     for(;;)
     {
         try
         {
-            int rs =_db->get(txn, &dbKey, &dbValue, 0);
+            int rs =_db->get(txn, &dbKey, &dbValue, forUpdate ? DB_RMW : 0);
             if(rs == DB_NOTFOUND)
             {
+                //
+                // Not cached as missing, see dbHasObject
+                //
                 return false;
             }
             else if(rs != 0)
@@ -457,12 +707,358 @@ Freeze::ObjectStoreBase::load(const Identity& ident, const TransactionIPtr& tran
         }
     }
 
+    value.resize(dbValue.get_size());
+    return true;
+}
+
+void
+Freeze::ObjectStoreBase::decode(const Identity& ident, const Value& value, ObjectRecord& rec)
+{
     unmarshal(rec, value, _communicator, _encoding, _keepStats);
     _evictor->initialize(ident, _facet, rec.servant);
-    return true;
 }
 
 void
+Freeze::ObjectStoreBase::lockForUpdate(const vector<Identity>& idents, const TransactionIPtr& transaction)
+{
+    if(transaction == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "no active transaction");
+    }
+
+    DbTxn* txn = transaction->dbTxn();
+
+    if(txn == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "inactive transaction");
+    }
+
+    //
+    // Transactions that lock their objects in the same order can't wait for
+    // each other; the keys are sorted in the byte order of the database
+    //
+    vector<Key> keys;
+    keys.reserve(idents.size());
+    for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+    {
+        Dbt dbKey;
+        KeyMarshaler km(*p, *this);
+        km.getDbt(dbKey);
+
+        Long epoch = 0;
+        if(!missing(dbKey, epoch))
+        {
+            const Byte* data = static_cast<const Byte*>(dbKey.get_data());
+            keys.push_back(Key(data, data + dbKey.get_size()));
+        }
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    //
+    // Keep 0 length since we're not interested in the data
+    //
+    Dbt dbValue;
+    dbValue.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+    for(vector<Key>::const_iterator p = keys.begin(); p != keys.end(); ++p)
+    {
+        Dbt dbKey;
+        initializeInDbt(*p, dbKey);
+
+        try
+        {
+            _db->get(txn, &dbKey, &dbValue, DB_RMW);
+        }
+        catch(const DbDeadlockException& dx)
+        {
+            if(_evictor->deadlockWarning())
+            {
+                Warning out(_communicator->getLogger());
+                out << "Deadlock in Freeze::ObjectStoreBase::lockForUpdate while locking \""
+                    << _evictor->filename() + "/" + _dbName << "\"";
+            }
+            throw DeadlockException(__FILE__, __LINE__, dx.what(), transaction);
+        }
+        catch(const DbException& dx)
+        {
+            handleDbException(dx, __FILE__, __LINE__);
+        }
+    }
+}
+
+void
+Freeze::ObjectStoreBase::loadFacets(const Identity& ident, vector<FacetRecord>& records)
+{
+    assert(_colocated);
+
+    //
+    // The keys of all the facets of this identity start with the key of
+    // the identity, and are therefore contiguous
+    //
+    KeyMarshaler km(ident, _communicator, _encoding);
+    Dbt dbPrefix;
+    km.getDbt(dbPrefix);
+    const Byte* prefix = static_cast<const Byte*>(dbPrefix.get_data());
+    const size_t prefixSize = dbPrefix.get_size();
+
+    for(;;)
+    {
+        records.clear();
+
+        Key key(prefix, prefix + prefixSize);
+        key.reserve(1024);
+        Dbt dbKey;
+        initializeOutDbt(key, dbKey);
+        dbKey.set_size(static_cast<u_int32_t>(prefixSize));
+
+        Value value(4096);
+        Dbt dbValue;
+        initializeOutDbt(value, dbValue);
+
+        Dbc* dbc = 0;
+        try
+        {
+            _db->cursor(0, &dbc, 0);
+
+            u_int32_t flags = DB_SET_RANGE;
+            bool more = true;
+            while(more)
+            {
+                try
+                {
+                    //
+                    // It is critical to set key size to key capacity before the
+                    // get, as a resize that increases the size inserts 0
+                    //
+                    key.resize(key.capacity());
+                    value.resize(value.capacity());
+
+                    more = (dbc->get(&dbKey, &dbValue, flags) == 0);
+                    if(more)
+                    {
+                        flags = DB_NEXT;
+                        key.resize(dbKey.get_size());
+
+                        more = key.size() > prefixSize && equal(prefix, prefix + prefixSize, key.begin());
+                        if(more)
+                        {
+                            FacetRecord facetRecord;
+                            Ice::InputStream stream(_communicator, _encoding, key);
+                            Identity keyIdent;
+                            stream.read(keyIdent);
+                            stream.read(facetRecord.facet);
+
+                            value.resize(dbValue.get_size());
+                            unmarshal(facetRecord.rec, value, _communicator, _encoding, _keepStats);
+                            facetRecord.digest = loadedDigest(value);
+                            records.push_back(facetRecord);
+                        }
+                    }
+                }
+                catch(const DbDeadlockException&)
+                {
+                    throw;
+                }
+                catch(const DbException& dx)
+                {
+                    handleDbException(dx, key, dbKey, value, dbValue, __FILE__, __LINE__);
+                }
+            }
+
+            Dbc* toClose = dbc;
+            dbc = 0;
+            toClose->close();
+            break; // for(;;)
+        }
+        catch(const DbDeadlockException&)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbDeadlockException&)
+                {
+                    // Ignored
+                }
+            }
+
+            if(_evictor->deadlockWarning())
+            {
+                Warning out(_communicator->getLogger());
+                out << "Deadlock in Freeze::ObjectStoreBase::loadFacets while searching \""
+                    << _evictor->filename() + "/" + EvictorIBase::colocatedDbName << "\"; retrying ...";
+            }
+            //
+            // Start over
+            //
+        }
+        catch(const DbException& dx)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbException&)
+                {
+                    // Ignored
+                }
+            }
+            handleDbException(dx, __FILE__, __LINE__);
+        }
+    }
+
+    for(vector<FacetRecord>::iterator p = records.begin(); p != records.end(); ++p)
+    {
+        _evictor->initialize(ident, p->facet, p->rec.servant);
+    }
+}
+
+namespace
+{
+
+struct KeyIdentity
+{
+    Key key;
+    Identity ident;
+
+    bool operator<(const KeyIdentity& rhs) const
+    {
+        return key < rhs.key;
+    }
+};
+
+}
+
+void
+Freeze::ObjectStoreBase::loadMany(const vector<Identity>& idents, vector<LoadedRecord>& records)
+{
+    //
+    // Sorted like the B-tree, so that the cursor moves forward only
+    //
+    vector<KeyIdentity> keys;
+    keys.reserve(idents.size());
+    for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+    {
+        Dbt dbKey;
+        KeyMarshaler km(*p, *this);
+        km.getDbt(dbKey);
+
+        Long epoch;
+        if(!missing(dbKey, epoch))
+        {
+            const Byte* data = static_cast<const Byte*>(dbKey.get_data());
+            KeyIdentity ki;
+            ki.key.assign(data, data + dbKey.get_size());
+            ki.ident = *p;
+            keys.push_back(ki);
+        }
+    }
+    sort(keys.begin(), keys.end());
+
+    for(;;)
+    {
+        records.clear();
+
+        Value value(4096);
+        Dbt dbValue;
+        initializeOutDbt(value, dbValue);
+
+        Dbc* dbc = 0;
+        try
+        {
+            _db->cursor(0, &dbc, 0);
+
+            for(vector<KeyIdentity>::iterator p = keys.begin(); p != keys.end(); ++p)
+            {
+                Dbt dbKey;
+                initializeInDbt(p->key, dbKey);
+
+                for(;;)
+                {
+                    try
+                    {
+                        value.resize(value.capacity());
+                        if(dbc->get(&dbKey, &dbValue, DB_SET) == 0)
+                        {
+                            value.resize(dbValue.get_size());
+
+                            LoadedRecord loaded;
+                            loaded.ident = p->ident;
+                            unmarshal(loaded.rec, value, _communicator, _encoding, _keepStats);
+                            loaded.digest = loadedDigest(value);
+                            records.push_back(loaded);
+                        }
+                        break;
+                    }
+                    catch(const DbDeadlockException&)
+                    {
+                        throw;
+                    }
+                    catch(const DbException& dx)
+                    {
+                        handleDbException(dx, value, dbValue, __FILE__, __LINE__);
+                    }
+                }
+            }
+
+            Dbc* toClose = dbc;
+            dbc = 0;
+            toClose->close();
+            break; // for(;;)
+        }
+        catch(const DbDeadlockException&)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbDeadlockException&)
+                {
+                    // Ignored
+                }
+            }
+
+            if(_evictor->deadlockWarning())
+            {
+                Warning out(_communicator->getLogger());
+                out << "Deadlock in Freeze::ObjectStoreBase::loadMany while searching \""
+                    << _evictor->filename() + "/" + _dbName << "\"; retrying ...";
+            }
+            //
+            // Start over
+            //
+        }
+        catch(const DbException& dx)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbException&)
+                {
+                    // Ignored
+                }
+            }
+            handleDbException(dx, __FILE__, __LINE__);
+        }
+    }
+
+    for(vector<LoadedRecord>::iterator p = records.begin(); p != records.end(); ++p)
+    {
+        _evictor->initialize(p->ident, _facet, p->rec.servant);
+    }
+}
+
+Freeze::ObjectStoreBase::Digest
 Freeze::ObjectStoreBase::update(const Identity& ident, const ObjectRecord& rec, const TransactionIPtr& transaction)
 {
     if(transaction == 0)
@@ -478,7 +1074,7 @@ Freeze::ObjectStoreBase::update(const Identity& ident, const ObjectRecord& rec,
     }
 
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
     Dbt dbValue;
@@ -487,6 +1083,9 @@ Freeze::ObjectStoreBase::update(const Identity& ident, const ObjectRecord& rec,
 
     u_int32_t flags = 0;
 
+    added(dbKey);
+    DecodedPut decodedPut(*this, dbValue);
+
     try
     {
         _db->put(txn, &dbKey, &dbValue, flags);
@@ -505,6 +1104,14 @@ Freeze::ObjectStoreBase::update(const Identity& ident, const ObjectRecord& rec,
     {
         handleDbException(dx, __FILE__, __LINE__);
     }
+
+    if(_evictor->keepDigests())
+    {
+        return vm.digest();
+    }
+    Digest digest;
+    digest.size = vm.size();
+    return digest;
 }
 
 bool
@@ -521,7 +1128,7 @@ Freeze::ObjectStoreBase::insert(const Identity& ident, const ObjectRecord& rec,
     }
 
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
     Dbt dbValue;
@@ -534,6 +1141,9 @@ Freeze::ObjectStoreBase::insert(const Identity& ident, const ObjectRecord& rec,
         flags |= DB_AUTO_COMMIT;
     }
 
+    added(dbKey);
+    DecodedPut decodedPut(*this, dbValue);
+
     for(;;)
     {
         try
@@ -577,7 +1187,7 @@ Freeze::ObjectStoreBase::remove(const Identity& ident, const TransactionIPtr& tr
     }
 
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
     for(;;)
@@ -615,14 +1225,217 @@ Freeze::ObjectStoreBase::dbName() const
     return _dbName;
 }
 
+size_t
+Freeze::ObjectStoreBase::cacheShards(const EvictorIBase* evictor)
+{
+    return evictor->cacheShards();
+}
+
+bool
+Freeze::ObjectStoreBase::keepDigests() const
+{
+    return _evictor->keepDigests();
+}
+
+Freeze::ObjectStoreBase::Digest
+Freeze::ObjectStoreBase::loadedDigest(const Value& value) const
+{
+    if(_evictor->keepDigests())
+    {
+        return digest(&value[0], value.size());
+    }
+    Digest result;
+    result.size = value.size();
+    return result;
+}
+
+void
+Freeze::ObjectStoreBase::loadKeys()
+{
+    //
+    // Add all the keys of the database to the Bloom filter and to the
+    // facet directory
+    //
+    size_t count = 0;
+    for(;;)
+    {
+        Key key(1024);
+        Dbt dbKey;
+        initializeOutDbt(key, dbKey);
+
+        Dbt dbValue;
+        dbValue.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+        Dbc* dbc = 0;
+        try
+        {
+            _db->cursor(0, &dbc, 0);
+
+            bool more = true;
+            while(more)
+            {
+                try
+                {
+                    //
+                    // It is critical to set key size to key capacity before the
+                    // get, as a resize that increases the size inserts 0
+                    //
+                    key.resize(key.capacity());
+
+                    more = (dbc->get(&dbKey, &dbValue, DB_NEXT) == 0);
+                    if(more)
+                    {
+                        key.resize(dbKey.get_size());
+
+                        //
+                        // Each store of colocated facets scans the keys of
+                        // all the facets
+                        //
+                        Identity ident;
+                        if(!_colocated || unmarshalKey(ident, &key[0], key.size()))
+                        {
+                            added(dbKey);
+                            ++count;
+                        }
+                    }
+                }
+                catch(const DbDeadlockException&)
+                {
+                    throw;
+                }
+                catch(const DbException& dx)
+                {
+                    handleDbException(dx, key, dbKey, __FILE__, __LINE__);
+                }
+            }
+
+            Dbc* toClose = dbc;
+            dbc = 0;
+            toClose->close();
+            break; // for(;;)
+        }
+        catch(const DbDeadlockException&)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbDeadlockException&)
+                {
+                    // Ignored
+                }
+            }
+
+            //
+            // Start over; adding a key again has no effect
+            //
+            count = 0;
+        }
+        catch(const DbException& dx)
+        {
+            if(dbc != 0)
+            {
+                try
+                {
+                    dbc->close();
+                }
+                catch(const DbException&)
+                {
+                    // Ignored
+                }
+            }
+            handleDbException(dx, __FILE__, __LINE__);
+        }
+    }
+
+    size_t bloomFilterBits = _keyFilter.get() != 0 ? _keyFilter->bloomFilterBits() : 0;
+    if(bloomFilterBits > 0 && count * 10 > bloomFilterBits)
+    {
+        Warning out(_communicator->getLogger());
+        out << "\"" << _evictor->filename() + "/" + _dbName << "\" has " << count
+            << " objects, more than its Bloom filter size";
+    }
+
+    if(_evictor->trace() >= 1)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "loaded " << count << " keys of \"" << _evictor->filename() + "/" + _dbName << "\"";
+        if(bloomFilterBits > 0)
+        {
+            out << " in a Bloom filter of " << bloomFilterBits << " bits";
+        }
+        if(_facetIndex >= 0)
+        {
+            out << " in the facet directory";
+        }
+    }
+}
+
+bool
+Freeze::ObjectStoreBase::missing(const Dbt& key, Long& epoch) const
+{
+    if(_keyFilter.get() == 0)
+    {
+        return false;
+    }
+
+    const Byte* data = static_cast<const Byte*>(key.get_data());
+    if(_keyFilter->missing(data, key.get_size()))
+    {
+        return true;
+    }
+    epoch = _keyFilter->lookupStarted();
+    return false;
+}
+
+void
+Freeze::ObjectStoreBase::missed(const Dbt& key, Long epoch) const
+{
+    if(_keyFilter.get() != 0)
+    {
+        _keyFilter->missed(static_cast<const Byte*>(key.get_data()), key.get_size(), epoch);
+    }
+}
+
+void
+Freeze::ObjectStoreBase::added(const Dbt& key) const
+{
+    const Byte* data = static_cast<const Byte*>(key.get_data());
+    if(_keyFilter.get() != 0)
+    {
+        _keyFilter->add(data, key.get_size());
+    }
+    if(_facetIndex >= 0)
+    {
+        //
+        // The facet directory is keyed by identity
+        //
+        _evictor->facetDirectory()->add(data, key.get_size() - _facetKeySize, _facetIndex);
+    }
+}
+
+void
+Freeze::ObjectStoreBase::facetAdded(const Identity& ident) const
+{
+    if(_facetIndex >= 0)
+    {
+        Dbt dbKey;
+        KeyMarshaler km(ident, _communicator, _encoding);
+        km.getDbt(dbKey);
+        _evictor->facetDirectory()->add(static_cast<const Byte*>(dbKey.get_data()), dbKey.get_size(), _facetIndex);
+    }
+}
+
 //
 // Non transactional load
 //
 bool
-Freeze::ObjectStoreBase::loadImpl(const Identity& ident, ObjectRecord& rec)
+Freeze::ObjectStoreBase::loadImpl(const Identity& ident, ObjectRecord& rec, Digest& digest)
 {
     Dbt dbKey;
-    KeyMarshaler km(ident, _communicator, _encoding);
+    KeyMarshaler km(ident, *this);
     km.getDbt(dbKey);
 
     const size_t defaultValueSize = 4096;
@@ -631,6 +1444,12 @@ Freeze::ObjectStoreBase::loadImpl(const Identity& ident, ObjectRecord& rec)
     Dbt dbValue;
     initializeOutDbt(value, dbValue);
 
+    Long epoch = 0;
+    if(missing(dbKey, epoch))
+    {
+        return false;
+    }
+
     for(;;)
     {
         try
@@ -638,6 +1457,7 @@ Freeze::ObjectStoreBase::loadImpl(const Identity& ident, ObjectRecord& rec)
             int rs = _db->get(0, &dbKey, &dbValue, 0);
             if(rs == DB_NOTFOUND)
             {
+                missed(dbKey, epoch);
                 return false;
             }
             else if(rs != 0)
@@ -665,6 +1485,8 @@ Freeze::ObjectStoreBase::loadImpl(const Identity& ident, ObjectRecord& rec)
         }
     }
 
+    value.resize(dbValue.get_size());
+    digest = loadedDigest(value);
     unmarshal(rec, value, _communicator, _encoding, _keepStats);
     _evictor->initialize(ident, _facet, rec.servant);
     return true;
@@ -14,9 +14,11 @@
 #include <Freeze/Index.h>
 #include <Freeze/TransactionI.h>
 #include <Freeze/Cache.h>
+#include <Freeze/KeyFilter.h>
 
 #include <vector>
 #include <list>
+#include <map>
 #include <db_cxx.h>
 
 namespace Freeze
@@ -26,6 +28,20 @@ template<class T> class EvictorI;
 
 class EvictorIBase;
 
+//
+// An object with changes not saved yet, which queries merge with the
+// database; value is the object as last streamed by the evictor, and is
+// empty when the object was destroyed
+//
+struct UnsavedObject
+{
+    Ice::Identity ident;
+    Value value;
+};
+
+struct FacetRecord;
+struct LoadedRecord;
+
 class ObjectStoreBase
 {
 public:
@@ -40,6 +56,34 @@ public:
     bool dbHasObject(const Ice::Identity&, const TransactionIPtr&) const;
     void save(Dbt&, Dbt&, Ice::Byte, DbTxn*);
 
+    //
+    // Records in the facet directory a facet about to be added, before it
+    // is written to the database
+    //
+    void facetAdded(const Ice::Identity&) const;
+
+    //
+    // Size and hashes of marshaled bytes, to detect unchanged values
+    //
+    struct Digest
+    {
+        Digest() :
+            size(0), fnv(0), sdbm(0)
+        {
+        }
+
+        bool operator==(const Digest& rhs) const
+        {
+            return size == rhs.size && fnv == rhs.fnv && sdbm == rhs.sdbm;
+        }
+
+        size_t size;
+        unsigned int fnv;
+        unsigned int sdbm;
+    };
+
+    static Digest digest(const Ice::Byte*, size_t);
+
     //
     // This base class encapsulates a stream, which allows us to avoid
     // making any extra copies of marshaled data when updating the database.
@@ -52,6 +96,13 @@ public:
 
         void getDbt(Dbt&) const;
 
+        //
+        // Number of marshaled bytes
+        //
+        size_t size() const;
+
+        Digest digest() const;
+
     protected:
 
         Ice::OutputStream _os;
@@ -62,6 +113,12 @@ public:
     public:
 
         KeyMarshaler(const Ice::Identity&, const Ice::CommunicatorPtr&, const Ice::EncodingVersion&);
+
+        //
+        // The key of the given identity in the database of this store,
+        // followed by the facet when the facets are colocated
+        //
+        KeyMarshaler(const Ice::Identity&, const ObjectStoreBase&);
     };
 
     class ValueMarshaler : public Marshaler
@@ -71,17 +128,88 @@ public:
         ValueMarshaler(const ObjectRecord&, const Ice::CommunicatorPtr&, const Ice::EncodingVersion&, bool);
     };
 
+    //
+    // Registers a value for the duration of its put, so that the indices of
+    // this store share one unmarshaled record
+    //
+    class DecodedPut
+    {
+    public:
+
+        DecodedPut(ObjectStoreBase&, const Dbt&);
+        ~DecodedPut();
+
+    private:
+
+        ObjectStoreBase& _store;
+        const void* _data;
+        bool _registered;
+    };
+    friend class DecodedPut;
+
+    //
+    // For IndexI: returns the record of the value being put, unmarshaled
+    // by the first index; values not registered are unmarshaled into the
+    // given record
+    //
+    const ObjectRecord& decodedRecord(const Dbt&, ObjectRecord&);
+
     static void unmarshal(Ice::Identity&, const Key&, const Ice::CommunicatorPtr&, const Ice::EncodingVersion&);
     static void unmarshal(ObjectRecord&, const Value&, const Ice::CommunicatorPtr&, const Ice::EncodingVersion&, bool);
 
-    bool load(const Ice::Identity&, const TransactionIPtr&, ObjectRecord&);
-    void update(const Ice::Identity&, const ObjectRecord&, const TransactionIPtr&);
+    //
+    // Returns false when the key is the key of another facet of the
+    // colocated database
+    //
+    bool unmarshalKey(Ice::Identity&, const Ice::Byte*, size_t) const;
+
+    //
+    // Transactional loads take a read lock, or a write lock (DB_RMW) when
+    // the object is loaded for update
+    //
+    bool load(const Ice::Identity&, const TransactionIPtr&, ObjectRecord&, bool = false);
+
+    //
+    // The two halves of the transactional load: loadValue reads the
+    // marshaled record, and decode unmarshals and initializes its servant
+    //
+    bool loadValue(const Ice::Identity&, const TransactionIPtr&, Value&, bool = false);
+    void decode(const Ice::Identity&, const Value&, ObjectRecord&);
+
+    //
+    // Write-locks the records of the given objects in key order, without
+    // reading them; the objects not found are skipped
+    //
+    void lockForUpdate(const std::vector<Ice::Identity>&, const TransactionIPtr&);
+
+    //
+    // With colocated facets, loads the records of all the facets of the
+    // given identity with a single cursor pass over the colocated database
+    //
+    void loadFacets(const Ice::Identity&, std::vector<FacetRecord>&);
+
+    //
+    // Loads the given objects with a single cursor, in key order; the
+    // objects not found are skipped
+    //
+    void loadMany(const std::vector<Ice::Identity>&, std::vector<LoadedRecord>&);
+    //
+    // Returns the digest of the marshaled record; only its size is set
+    // unless the evictor keeps digests
+    //
+    Digest update(const Ice::Identity&, const ObjectRecord&, const TransactionIPtr&);
 
     bool insert(const Ice::Identity&, const ObjectRecord&, const TransactionIPtr&);
     bool remove(const Ice::Identity&, const TransactionIPtr&);
 
     EvictorIBase* evictor() const;
 
+    //
+    // For ObjectStore, which can't use the incomplete EvictorIBase
+    //
+    static size_t cacheShards(const EvictorIBase*);
+    bool keepDigests() const;
+
     //
     // For IndexI and Iterator
     //
@@ -93,13 +221,47 @@ public:
     const std::string& facet() const;
     bool keepStats() const;
 
+    //
+    // The bit of this facet in the facet directory, -1 when none
+    //
+    int facetIndex() const;
+
+    bool colocated() const;
+
 protected:
 
-    bool loadImpl(const Ice::Identity&, ObjectRecord&);
+    bool loadImpl(const Ice::Identity&, ObjectRecord&, Digest&);
 
 private:
 
-    IceInternal::UniquePtr<Db> _db;
+    void loadKeys();
+
+    //
+    // Returns true when the key is definitely not in the database;
+    // otherwise, sets the epoch to pass to missed
+    //
+    bool missing(const Dbt&, Ice::Long&) const;
+    void missed(const Dbt&, Ice::Long) const;
+    void added(const Dbt&) const;
+
+    //
+    // The digest of a record read from the database; only its size is
+    // set unless the evictor keeps digests
+    //
+    Digest loadedDigest(const Value&) const;
+
+    struct DecodedRecord
+    {
+        size_t size;
+        bool decoded;
+        ObjectRecord rec;
+    };
+
+    //
+    // The colocated database belongs to the evictor
+    //
+    Db* _db;
+    IceInternal::UniquePtr<Db> _ownDb;
     std::string _facet;
     std::string _dbName;
     EvictorIBase* _evictor;
@@ -108,6 +270,47 @@ private:
     Ice::EncodingVersion _encoding;
     Ice::ObjectPtr _sampleServant;
     bool _keepStats;
+
+    //
+    // Null unless BloomFilterSize or NegativeCacheSize is set
+    //
+    IceInternal::UniquePtr<KeyFilter> _keyFilter;
+
+    //
+    // Immutable
+    //
+    int _facetIndex;
+    bool _colocated;
+    size_t _facetKeySize; // Size of the facet at the end of the colocated keys
+
+    //
+    // The values being put, by data pointer; only the thread putting a
+    // value reads or writes its record
+    //
+    IceUtil::Mutex _decodedMutex;
+    std::map<const void*, DecodedRecord> _decoded;
+};
+
+//
+// A facet of an identity loaded with its other facets, and the digest of
+// its marshaled record
+//
+struct FacetRecord
+{
+    std::string facet;
+    ObjectRecord rec;
+    ObjectStoreBase::Digest digest;
+};
+
+//
+// An object loaded with other objects of the same facet, and the digest
+// of its marshaled record
+//
+struct LoadedRecord
+{
+    Ice::Identity ident;
+    ObjectRecord rec;
+    ObjectStoreBase::Digest digest;
 };
 
 template<class T>
@@ -119,7 +322,8 @@ class ObjectStore : public ObjectStoreBase, public Cache<Ice::Identity, T>
                 bool createDb, EvictorIBase* evictor,
                 const std::vector<IndexPtr>& indices = std::vector<IndexPtr>(),
                 bool populateEmptyIndices = false) :
-        ObjectStoreBase(facet, facetType, createDb, evictor, indices, populateEmptyIndices)
+        ObjectStoreBase(facet, facetType, createDb, evictor, indices, populateEmptyIndices),
+        Cache<Ice::Identity, T>(cacheShards(evictor))
     {
     }
 
@@ -127,15 +331,146 @@ class ObjectStore : public ObjectStoreBase, public Cache<Ice::Identity, T>
 
     typedef Cache<Ice::Identity, T> ObjectCache;
 
+    //
+    // Pins an element for a record loaded by the caller; returns the
+    // element already cached, if any, or 0 when it is being loaded.
+    // Nothing prevents the record from being older than the database, so
+    // this is only for records just committed; see fillLoaded otherwise.
+    //
+    IceUtil::Handle<T>
+    pinLoaded(const Ice::Identity& ident, ObjectRecord& rec, size_t size, const Digest& digest = Digest())
+    {
+        IceUtil::Handle<T> element = new T(rec, *this);
+        element->policyEntry.footprint = size;
+        if(keepDigests())
+        {
+            element->marshaled = digest;
+        }
+        if(ObjectCache::pin(ident, element))
+        {
+            return element;
+        }
+        return this->getIfPinned(ident);
+    }
+
+    //
+    // Installs a record loaded by the caller at a position it reserved
+    //
+    IceUtil::Handle<T>
+    fillLoaded(typename ObjectCache::Position p, ObjectRecord& rec, const Digest& digest)
+    {
+        IceUtil::Handle<T> element = new T(rec, *this);
+        element->policyEntry.footprint = digest.size;
+        if(keepDigests())
+        {
+            element->marshaled = digest;
+        }
+        ObjectCache::fill(p, element);
+        return element;
+    }
+
+    //
+    // Pins the given objects, loading those not in the cache with a
+    // single cursor. The misses are reserved before they are read, so that
+    // an object saved, evicted or removed meanwhile is not reinstalled from
+    // an older record.
+    //
+    void
+    pinMany(const std::vector<Ice::Identity>& idents,
+            std::vector<std::pair<Ice::Identity, IceUtil::Handle<T> > >& elements)
+    {
+        std::vector<Ice::Identity> misses;
+        std::map<Ice::Identity, typename ObjectCache::Position> reserved;
+        std::vector<Ice::Identity> busy;
+        for(std::vector<Ice::Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+        {
+            IceUtil::Handle<T> element = this->getIfPinned(*p);
+            if(element != 0)
+            {
+                elements.push_back(std::make_pair(*p, element));
+                continue;
+            }
+
+            typename ObjectCache::Position pos;
+            if(this->reserve(*p, pos))
+            {
+                misses.push_back(*p);
+                reserved.insert(std::make_pair(*p, pos));
+            }
+            else
+            {
+                busy.push_back(*p);
+            }
+        }
+
+        if(!misses.empty())
+        {
+            std::vector<LoadedRecord> records;
+            try
+            {
+                loadMany(misses, records);
+            }
+            catch(...)
+            {
+                for(typename std::map<Ice::Identity, typename ObjectCache::Position>::iterator p = reserved.begin();
+                    p != reserved.end(); ++p)
+                {
+                    this->fill(p->second, 0);
+                }
+                throw;
+            }
+
+            for(std::vector<LoadedRecord>::iterator p = records.begin(); p != records.end(); ++p)
+            {
+                typename std::map<Ice::Identity, typename ObjectCache::Position>::iterator q = reserved.find(p->ident);
+                assert(q != reserved.end());
+                elements.push_back(std::make_pair(p->ident, fillLoaded(q->second, p->rec, p->digest)));
+                reserved.erase(q);
+            }
+
+            //
+            // Not found
+            //
+            for(typename std::map<Ice::Identity, typename ObjectCache::Position>::iterator p = reserved.begin();
+                p != reserved.end(); ++p)
+            {
+                this->fill(p->second, 0);
+            }
+        }
+
+        //
+        // The objects being loaded by other threads are waited for only once
+        // ours are filled, as these threads may be waiting for ours
+        //
+        for(std::vector<Ice::Identity>::const_iterator p = busy.begin(); p != busy.end(); ++p)
+        {
+            IceUtil::Handle<T> element = ObjectCache::pin(*p);
+            if(element != 0)
+            {
+                elements.push_back(std::make_pair(*p, element));
+            }
+        }
+    }
+
 protected:
 
     virtual IceUtil::Handle<T>
     load(const Ice::Identity& ident)
     {
         ObjectRecord rec;
-        if(loadImpl(ident, rec))
+        Digest digest;
+        if(loadImpl(ident, rec, digest))
         {
-            return new T(rec, *this);
+            //
+            // The marshaled size is our estimate of the element's footprint
+            //
+            IceUtil::Handle<T> element = new T(rec, *this);
+            element->policyEntry.footprint = digest.size;
+            if(keepDigests())
+            {
+                element->marshaled = digest;
+            }
+            return element;
         }
         else
         {
@@ -157,7 +492,7 @@ protected:
 inline Db*
 ObjectStoreBase::db() const
 {
-    return _db.get();
+    return _db;
 }
 
 inline const Ice::CommunicatorPtr&
@@ -190,6 +525,18 @@ ObjectStoreBase::keepStats() const
     return _keepStats;
 }
 
+inline int
+ObjectStoreBase::facetIndex() const
+{
+    return _facetIndex;
+}
+
+inline bool
+ObjectStoreBase::colocated() const
+{
+    return _colocated;
+}
+
 inline const Ice::ObjectPtr&
 ObjectStoreBase::sampleServant() const
 {
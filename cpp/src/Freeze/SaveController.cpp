@@ -0,0 +1,93 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#include <Freeze/SaveController.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace Freeze;
+using namespace Ice;
+
+namespace
+{
+
+//
+// Bounds of the tuned values
+//
+const Int maxTxSizeLimit = 100000;
+const Int maxSaveSizeTrigger = 1000000;
+const IceUtil::Time minSavePeriod = IceUtil::Time::milliSeconds(10);
+
+//
+// Weight of the last commit in the average commit latency
+//
+const double latencyWeight = 0.2;
+
+}
+
+Freeze::SaveController::SaveController(Int saveSizeTrigger, Int maxTxSize, const IceUtil::Time& maxAge,
+                                       const IceUtil::Time& latencyBudget) :
+    _maxAge(maxAge),
+    _latencyBudget(latencyBudget),
+    _saveSizeTrigger(saveSizeTrigger),
+    _savePeriod(maxAge),
+    _maxTxSize(maxTxSize),
+    _commitLatency(0),
+    _deadlocks(0),
+    _batchDeadlocks(0)
+{
+}
+
+void
+Freeze::SaveController::committed(size_t objects, const IceUtil::Time& latency)
+{
+    double ms = latency.toMilliSecondsDouble();
+    _commitLatency = _commitLatency == 0 ? ms : (1 - latencyWeight) * _commitLatency + latencyWeight * ms;
+
+    double budget = _latencyBudget.toMilliSecondsDouble();
+    if(ms > budget)
+    {
+        //
+        // Shrink in proportion to the overshoot
+        //
+        _maxTxSize = max(1, static_cast<Int>(_maxTxSize * budget / ms));
+    }
+    else if(ms < budget / 2 && static_cast<Int>(objects) >= _maxTxSize)
+    {
+        //
+        // Full transaction well within the budget: grow by 10%
+        //
+        _maxTxSize = min(maxTxSizeLimit, _maxTxSize + max(1, _maxTxSize / 10));
+    }
+}
+
+void
+Freeze::SaveController::deadlocked()
+{
+    _batchDeadlocks++;
+    _maxTxSize = (_maxTxSize + 1) / 2;
+}
+
+void
+Freeze::SaveController::batchSaved(size_t objects, const IceUtil::Time& interval, const IceUtil::Time& duration)
+{
+    _deadlocks = _batchDeadlocks;
+    _batchDeadlocks = 0;
+
+    //
+    // An object modified just after a swap waits for the next swap and then
+    // for the save of its batch
+    //
+    _savePeriod = max(minSavePeriod, _maxAge - duration);
+
+    if(interval > IceUtil::Time())
+    {
+        double rate = objects / interval.toMilliSecondsDouble();
+        double trigger = rate * _maxAge.toMilliSecondsDouble() / 2;
+        _saveSizeTrigger = static_cast<Int>(min(static_cast<double>(maxSaveSizeTrigger), max(1.0, trigger)));
+    }
+}
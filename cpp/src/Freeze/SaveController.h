@@ -0,0 +1,108 @@
+// **********************************************************************
+//
+// Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+//
+// **********************************************************************
+
+#ifndef FREEZE_SAVE_CONTROLLER_H
+#define FREEZE_SAVE_CONTROLLER_H
+
+#include <IceUtil/Time.h>
+#include <Ice/Config.h>
+
+namespace Freeze
+{
+
+//
+// Tunes the save size trigger, the save period and the transaction size of
+// a background save evictor. The goal is to save each modified object within
+// a maximum age, while keeping each commit within a latency budget:
+//
+// - the transaction size shrinks when a commit exceeds the latency budget or
+//   deadlocks, and grows back when commits are well within the budget
+// - the save period is the maximum age minus the time needed to save a batch
+// - the save size trigger is the number of objects modified, at the measured
+//   rate, in half the maximum age
+//
+// Not thread-safe: only the writer thread of the evictor uses it.
+//
+class SaveController
+{
+public:
+
+    SaveController(Ice::Int, Ice::Int, const IceUtil::Time&, const IceUtil::Time&);
+
+    //
+    // A transaction with the given number of objects committed
+    //
+    void committed(size_t, const IceUtil::Time&);
+
+    //
+    // A transaction deadlocked and was rolled back
+    //
+    void deadlocked();
+
+    //
+    // A batch with the given number of objects was saved; the first time
+    // is the time since the previous batch, the second the time it took to
+    // stream and save this batch.
+    //
+    void batchSaved(size_t, const IceUtil::Time&, const IceUtil::Time&);
+
+    Ice::Int saveSizeTrigger() const;
+    IceUtil::Time savePeriod() const;
+    Ice::Int maxTxSize() const;
+
+    //
+    // Average commit latency, and number of deadlocks during the last batch
+    //
+    IceUtil::Time commitLatency() const;
+    Ice::Int deadlocks() const;
+
+private:
+
+    const IceUtil::Time _maxAge;
+    const IceUtil::Time _latencyBudget;
+
+    Ice::Int _saveSizeTrigger;
+    IceUtil::Time _savePeriod;
+    Ice::Int _maxTxSize;
+
+    double _commitLatency; // Moving average, in ms
+    Ice::Int _deadlocks;
+    Ice::Int _batchDeadlocks;
+};
+
+inline Ice::Int
+SaveController::saveSizeTrigger() const
+{
+    return _saveSizeTrigger;
+}
+
+inline IceUtil::Time
+SaveController::savePeriod() const
+{
+    return _savePeriod;
+}
+
+inline Ice::Int
+SaveController::maxTxSize() const
+{
+    return _maxTxSize;
+}
+
+inline IceUtil::Time
+SaveController::commitLatency() const
+{
+    return IceUtil::Time::microSeconds(static_cast<IceUtil::Int64>(_commitLatency * 1000));
+}
+
+inline Ice::Int
+SaveController::deadlocks() const
+{
+    return _deadlocks;
+}
+
+}
+
+#endif
@@ -343,11 +343,11 @@ Freeze::SharedDbEnv::__decRef()
 }
 
 Freeze::TransactionalEvictorContextPtr
-Freeze::SharedDbEnv::createCurrent()
+Freeze::SharedDbEnv::createCurrent(bool snapshot)
 {
     assert(getCurrent() == 0);
 
-    Freeze::TransactionalEvictorContextPtr ctx = new TransactionalEvictorContext(this);
+    Freeze::TransactionalEvictorContextPtr ctx = new TransactionalEvictorContext(this, snapshot);
 #ifdef _WIN32
     if(TlsSetValue(_tsdKey, ctx.get()) == 0)
     {
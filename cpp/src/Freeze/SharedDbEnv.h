@@ -59,7 +59,11 @@ public:
     //
     // EvictorContext factory/manager
     //
-    TransactionalEvictorContextPtr createCurrent();
+    //
+    // Snapshot contexts are for the read-only dispatches of evictors with
+    // multiversion databases
+    //
+    TransactionalEvictorContextPtr createCurrent(bool = false);
     TransactionalEvictorContextPtr getCurrent();
     void setCurrentTransaction(const TransactionPtr& tx);
 
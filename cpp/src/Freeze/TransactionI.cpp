@@ -208,7 +208,7 @@ Freeze::TransactionI::setPostCompletionCallback(const Freeze::PostCompletionCall
 // transaction or the connection are not assigned to a Ptr in
 // user-code.
 //
-Freeze::TransactionI::TransactionI(ConnectionI* connection) :
+Freeze::TransactionI::TransactionI(ConnectionI* connection, bool snapshot) :
     _communicator(connection->communicator()),
     _connection(connection),
     _txTrace(connection->txTrace()),
@@ -219,13 +219,13 @@ Freeze::TransactionI::TransactionI(ConnectionI* connection) :
 {
     try
     {
-        _connection->dbEnv()->getEnv()->txn_begin(0, &_txn, 0);
+        _connection->dbEnv()->getEnv()->txn_begin(0, &_txn, snapshot ? DB_TXN_SNAPSHOT : 0);
 
         if(_txTrace >= 1)
         {
             long txnId = (_txn->id() & 0x7FFFFFFF) + 0x80000000L;
             Trace out(_communicator->getLogger(), "Freeze.Transaction");
-            out << "started transaction " << hex << txnId << dec;
+            out << "started " << (snapshot ? "snapshot " : "") << "transaction " << hex << txnId << dec;
         }
     }
     catch(const ::DbException& dx)
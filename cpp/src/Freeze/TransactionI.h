@@ -51,7 +51,11 @@ public:
     void rollbackInternal(bool);
     void setPostCompletionCallback(const PostCompletionCallbackPtr&);
 
-    TransactionI(ConnectionI*);
+    //
+    // A snapshot transaction reads the databases opened with
+    // DB_MULTIVERSION without locking them
+    //
+    TransactionI(ConnectionI*, bool = false);
     ~TransactionI();
 
     DbTxn*
@@ -53,8 +53,9 @@ Freeze::TransactionalEvictorDeadlockException::ice_throw() const
 // TransactionalEvictorContext
 //
 
-Freeze::TransactionalEvictorContext::TransactionalEvictorContext(const SharedDbEnvPtr& dbEnv) :
-    _tx((new ConnectionI(dbEnv))->beginTransactionI()),
+Freeze::TransactionalEvictorContext::TransactionalEvictorContext(const SharedDbEnvPtr& dbEnv, bool snapshot) :
+    _tx((new ConnectionI(dbEnv))->beginTransactionI(snapshot)),
+    _snapshot(snapshot),
     _deadlockExceptionDetected(false),
     _userExceptionDetected(false)
 {
@@ -63,6 +64,7 @@ Freeze::TransactionalEvictorContext::TransactionalEvictorContext(const SharedDbE
 
 Freeze::TransactionalEvictorContext::TransactionalEvictorContext(const TransactionIPtr& tx) :
     _tx(tx),
+    _snapshot(false),
     _deadlockExceptionDetected(false)
 {
     _tx->setPostCompletionCallback(this);
@@ -278,10 +280,21 @@ Freeze::TransactionalEvictorContext::ServantHolder::~ServantHolder() ICE_NOEXCEP
                     EvictorIBase::updateStats(_body.rec.stats,
                                               IceUtil::Time::now(IceUtil::Time::Monotonic).toMilliSeconds());
                 }
-                _body.store->update(_body.current->id, _body.rec, ctx->_tx);
-            }
+                ObjectStoreBase::Digest digest = _body.store->update(_body.current->id, _body.rec, ctx->_tx);
 
-            if(!_body.readOnly || _body.removed)
+                TransactionalEvictorI* evictor = static_cast<TransactionalEvictorI*>(_body.store->evictor());
+                if(evictor->updateCacheOnCommit())
+                {
+                    Long stamp = evictor->nextStamp(_body.store, _body.current->id);
+                    ctx->_invalidateList.push_back(new ToInvalidate(_body.current->id, _body.store, _body.rec, digest,
+                                                                    stamp));
+                }
+                else
+                {
+                    ctx->_invalidateList.push_back(new ToInvalidate(_body.current->id, _body.store));
+                }
+            }
+            else if(_body.removed)
             {
                 ctx->_invalidateList.push_back(new ToInvalidate(_body.current->id, _body.store));
             }
@@ -293,7 +306,8 @@ Freeze::TransactionalEvictorContext::ServantHolder::~ServantHolder() ICE_NOEXCEP
 void
 Freeze::TransactionalEvictorContext::ServantHolder::init(const TransactionalEvictorContextPtr& ctx,
                                                          const Current& current,
-                                                         ObjectStore<TransactionalEvictorElement>* store)
+                                                         ObjectStore<TransactionalEvictorElement>* store,
+                                                         bool forUpdate)
 {
     assert(_ownBody && _body.ctx == 0);
 
@@ -311,12 +325,37 @@ Freeze::TransactionalEvictorContext::ServantHolder::init(const TransactionalEvic
             _body.readOnly = body->readOnly;
         }
     }
+    else if(store->keepDigests() && !forUpdate)
+    {
+        //
+        // Read the record in this transaction, which locks it as load does,
+        // but reuse the cached read-only servant when it was unmarshaled
+        // from the same bytes
+        //
+        if(store->loadValue(current.id, ctx->_tx, _body.value))
+        {
+            TransactionalEvictorElementPtr element = store->getIfPinned(current.id);
+            if(element != 0 && element->marshaled.size == _body.value.size() &&
+               element->marshaled == ObjectStoreBase::digest(&_body.value[0], _body.value.size()))
+            {
+                _body.rec.servant = element->servant();
+                _body.shared = true;
+            }
+            else
+            {
+                store->decode(current.id, _body.value, _body.rec);
+                Value().swap(_body.value);
+            }
+            ctx->_stack.push_front(&_body);
+            _body.ownServant = true;
+        }
+    }
     else
     {
         //
         // Let's load this servant
         //
-        if(store->load(current.id, ctx->_tx, _body.rec))
+        if(store->load(current.id, ctx->_tx, _body.rec, forUpdate))
         {
             ctx->_stack.push_front(&_body);
             _body.ownServant = true;
@@ -331,6 +370,17 @@ Freeze::TransactionalEvictorContext::ServantHolder::adopt(ServantHolder& other)
 
     _body = other._body;
     other._ownBody = false;
+
+    if(_body.ownServant)
+    {
+        //
+        // Nested calls must find the adopted body, which markReadWrite may
+        // give its own servant
+        //
+        const TransactionalEvictorContextPtr& ctx = *(_body.ctx);
+        assert(ctx->_stack.front() == &other._body);
+        ctx->_stack.front() = &_body;
+    }
 }
 
 void
@@ -340,6 +390,15 @@ Freeze::TransactionalEvictorContext::ServantHolder::markReadWrite()
 
     if(_body.ownServant)
     {
+        if(_body.shared)
+        {
+            //
+            // Writes can't use the cached read-only servant
+            //
+            _body.store->decode(_body.current->id, _body.value, _body.rec);
+            Value().swap(_body.value);
+            _body.shared = false;
+        }
         _body.readOnly = false;
     }
     else
@@ -355,6 +414,7 @@ Freeze::TransactionalEvictorContext::ServantHolder::Body::Body() :
     readOnly(true),
     removed(false),
     ownServant(false),
+    shared(false),
     ctx(0),
     current(0),
     store(0)
@@ -374,19 +434,52 @@ Freeze::TransactionalEvictorContext::ToInvalidate::ToInvalidate(const Identity&
     _ident(ident),
     _store(store),
     _evictor(store->evictor()),
-    _guard(_evictor->deactivateController())
+    _guard(_evictor->deactivateController()),
+    _refresh(false),
+    _stamp(0)
+{
+}
+
+Freeze::TransactionalEvictorContext::ToInvalidate::ToInvalidate(const Identity& ident,
+                                                                ObjectStore<TransactionalEvictorElement>* store,
+                                                                const ObjectRecord& rec,
+                                                                const ObjectStoreBase::Digest& digest, Long stamp) :
+    _ident(ident),
+    _store(store),
+    _evictor(store->evictor()),
+    _guard(_evictor->deactivateController()),
+    _refresh(true),
+    _rec(rec),
+    _digest(digest),
+    _stamp(stamp)
 {
 }
 
 void
 Freeze::TransactionalEvictorContext::ToInvalidate::invalidate(ToInvalidate* obj)
 {
-    dynamic_cast<TransactionalEvictorI*>(obj->_store->evictor())->evict(obj->_ident, obj->_store);
+    TransactionalEvictorI* evictor = dynamic_cast<TransactionalEvictorI*>(obj->_store->evictor());
+    if(obj->_refresh)
+    {
+        evictor->refresh(obj->_ident, obj->_store, obj->_rec, obj->_digest, obj->_stamp);
+    }
+    else
+    {
+        evictor->evict(obj->_ident, obj->_store);
+    }
     delete obj;
 }
 
 void
 Freeze::TransactionalEvictorContext::ToInvalidate::destroy(ToInvalidate* obj)
 {
+    if(obj->_refresh)
+    {
+        //
+        // Rolled back
+        //
+        TransactionalEvictorI* evictor = dynamic_cast<TransactionalEvictorI*>(obj->_store->evictor());
+        evictor->discardUpdate(obj->_store, obj->_ident, obj->_stamp);
+    }
     delete obj;
 }
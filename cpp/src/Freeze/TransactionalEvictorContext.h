@@ -33,7 +33,12 @@ public:
         ServantHolder();
         ~ServantHolder() ICE_NOEXCEPT_FALSE;
 
-        void init(const TransactionalEvictorContextPtr&, const Ice::Current&, ObjectStore<TransactionalEvictorElement>*);
+        //
+        // Loads the servant, with a write lock when the operation is known
+        // to update it
+        //
+        void init(const TransactionalEvictorContextPtr&, const Ice::Current&, ObjectStore<TransactionalEvictorElement>*,
+                  bool = false);
 
         void adopt(ServantHolder&);
 
@@ -62,6 +67,13 @@ public:
             bool removed;
             bool ownServant;
 
+            //
+            // When shared, rec.servant is the cached read-only servant and value
+            // the record read by this transaction, unmarshaled by markReadWrite
+            //
+            bool shared;
+            Value value;
+
             const TransactionalEvictorContextPtr* ctx;
             const Ice::Current* current;
             ObjectStore<TransactionalEvictorElement>* store;
@@ -74,11 +86,17 @@ public:
         bool _ownBody;
     };
 
+    //
+    // An object to evict from the cache upon commit, or to refresh with its
+    // committed record when the evictor updates its cache on commit
+    //
     class ToInvalidate
     {
     public:
 
         ToInvalidate(const Ice::Identity&, ObjectStore<TransactionalEvictorElement>*);
+        ToInvalidate(const Ice::Identity&, ObjectStore<TransactionalEvictorElement>*, const ObjectRecord&,
+                     const ObjectStoreBase::Digest&, Ice::Long);
 
         static void invalidate(ToInvalidate*);
         static void destroy(ToInvalidate*);
@@ -89,9 +107,14 @@ public:
         ObjectStore<TransactionalEvictorElement>* _store;
         EvictorIBasePtr _evictor; // for _guard
         DeactivateController::Guard _guard; // ensures store is not dangling
+
+        const bool _refresh;
+        ObjectRecord _rec;
+        const ObjectStoreBase::Digest _digest;
+        const Ice::Long _stamp;
     };
 
-    TransactionalEvictorContext(const SharedDbEnvPtr&);
+    TransactionalEvictorContext(const SharedDbEnvPtr&, bool = false);
     TransactionalEvictorContext(const TransactionIPtr&);
 
     virtual ~TransactionalEvictorContext();
@@ -118,6 +141,11 @@ public:
         return _tx;
     }
 
+    bool snapshot() const
+    {
+        return _snapshot;
+    }
+
 private:
 
     friend class ServantHolder;
@@ -138,6 +166,7 @@ private:
     std::list<ToInvalidate*> _invalidateList;
 
     TransactionIPtr _tx;
+    const bool _snapshot;
     IceUtil::ThreadControl _owner;
 
     IceInternal::UniquePtr<DeadlockException> _deadlockException;
@@ -29,6 +29,17 @@ const int supports = 0;
 const int mandatory = 1;
 const int required = 2;
 const int never = 3;
+
+//
+// The servants of a transactional evictor can always be evicted,
+// even when in use
+//
+bool
+isEvictable(const TransactionalEvictorElementPtr&)
+{
+    return true;
+}
+
 }
 
 //
@@ -60,6 +71,17 @@ Freeze::createTransactionalEvictor(const ObjectAdapterPtr& adapter,
     return new TransactionalEvictorI(adapter, envName, &dbEnv, filename, facetTypes, initializer, indices, createDb);
 }
 
+void
+Freeze::lockForUpdate(const TransactionalEvictorPtr& evictor, const IdentitySeq& idents, const string& facet)
+{
+    TransactionalEvictorI* evictorI = dynamic_cast<TransactionalEvictorI*>(evictor.get());
+    if(evictorI == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "lockForUpdate: invalid evictor");
+    }
+    evictorI->lockForUpdate(idents, facet);
+}
+
 //
 // TransactionalEvictorI
 //
@@ -73,7 +95,7 @@ Freeze::TransactionalEvictorI::TransactionalEvictorI(const ObjectAdapterPtr& ada
                                                      const vector<IndexPtr>& indices,
                                                      bool createDb) :
     EvictorI<TransactionalEvictorElement>(adapter, envName, dbEnv, filename, facetTypes, initializer, indices, createDb),
-    _currentEvictorSize(0)
+    _stamp(0)
 {
 
     class DispatchInterceptorAdapter : public Ice::DispatchInterceptor
@@ -101,6 +123,28 @@ Freeze::TransactionalEvictorI::TransactionalEvictorI(const ObjectAdapterPtr& ada
 
     _rollbackOnUserException = _communicator->getProperties()->
         getPropertyAsIntWithDefault(propertyPrefix + ".RollbackOnUserException", 0) > 0;
+
+    //
+    // By default, committed updates evict the cached read-only servants
+    //
+    _updateCacheOnCommit = _communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".UpdateCacheOnCommit", 0) > 0;
+
+    //
+    // Transactions reuse the cached read-only servants whose digest matches
+    // the record they read, until they write them
+    //
+    _keepDigests = _communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".ReuseCachedServants", 0) > 0;
+
+    //
+    // By default, freeze:write operations load their servant with a write
+    // lock, rather than upgrading a read lock when they save it
+    //
+    _loadForUpdate = _communicator->getProperties()->
+        getPropertyAsIntWithDefault(propertyPrefix + ".LoadForUpdate", 1) > 0;
+
+    registerMemoryBudget();
 }
 
 TransactionPtr
@@ -275,6 +319,138 @@ Freeze::TransactionalEvictorI::hasFacet(const Identity& ident, const string& fac
     }
 }
 
+Int
+Freeze::TransactionalEvictorI::preloadFacets(const Identity& ident)
+{
+    checkIdentity(ident);
+    DeactivateController::Guard deactivateGuard(_deactivateController);
+
+    vector<TransactionalEvictorElementPtr> elements;
+    pinFacets(ident, elements);
+
+    Int count = 0;
+    {
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        for(vector<TransactionalEvictorElementPtr>::const_iterator p = elements.begin(); p != elements.end(); ++p)
+        {
+            const TransactionalEvictorElementPtr& element = *p;
+            if(!element->stale())
+            {
+                fixEvictPosition(segment, element);
+                ++count;
+            }
+        }
+        evict(segment);
+    }
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "preloaded " << count << " facets of \"" << _communicator->identityToString(ident) << "\" from Db \""
+            << _filename << "\"";
+    }
+    return count;
+}
+
+void
+Freeze::TransactionalEvictorI::lockForUpdate(const vector<Identity>& idents, const string& facet)
+{
+    DeactivateController::Guard deactivateGuard(_deactivateController);
+
+    TransactionalEvictorContextPtr ctx = _dbEnv->getCurrent();
+    if(ctx == 0)
+    {
+        throw DatabaseException(__FILE__, __LINE__, "lockForUpdate: no current transaction");
+    }
+
+    ObjectStore<TransactionalEvictorElement>* store = findStore(facet, false);
+    if(store == 0)
+    {
+        return;
+    }
+
+    store->lockForUpdate(idents, ctx->transaction());
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "locked " << idents.size() << " objects of Db \"" << _filename << "\" for update";
+    }
+}
+
+void
+Freeze::TransactionalEvictorI::prefetchNow(const vector<Identity>& idents, const string& facet)
+{
+    ObjectStore<TransactionalEvictorElement>* store = findStore(facet, false);
+    if(store == 0)
+    {
+        return;
+    }
+
+    vector<pair<Identity, TransactionalEvictorElementPtr> > elements;
+    store->pinMany(idents, elements);
+
+    for(vector<pair<Identity, TransactionalEvictorElementPtr> >::const_iterator p = elements.begin(); p != elements.end(); ++p)
+    {
+        Segment& segment = findSegment(p->first);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        const TransactionalEvictorElementPtr& element = p->second;
+        if(!element->stale())
+        {
+            fixEvictPosition(segment, element);
+            evict(segment);
+        }
+    }
+
+    if(_trace >= 2)
+    {
+        Trace out(_communicator->getLogger(), "Freeze.Evictor");
+        out << "prefetched " << elements.size() << " of " << idents.size() << " objects";
+        if(!facet.empty())
+        {
+            out << " with facet \"" << facet << "\"";
+        }
+        out << " from Db \"" << _filename << "\"";
+    }
+}
+
+void
+Freeze::TransactionalEvictorI::pinServants(ObjectStoreBase* storeBase, const vector<Identity>& idents,
+                                           map<Identity, ObjectPtr>& servants)
+{
+    //
+    // Objects read by a transaction may be rolled back, so they are not
+    // cached
+    //
+    if(beforeQuery() != 0)
+    {
+        return;
+    }
+
+    ObjectStore<TransactionalEvictorElement>* store =
+        static_cast<ObjectStore<TransactionalEvictorElement>*>(storeBase);
+
+    vector<pair<Identity, TransactionalEvictorElementPtr> > elements;
+    store->pinMany(idents, elements);
+
+    for(vector<pair<Identity, TransactionalEvictorElementPtr> >::const_iterator p = elements.begin(); p != elements.end(); ++p)
+    {
+        Segment& segment = findSegment(p->first);
+        IceUtil::Mutex::Lock sync(segment.mutex);
+
+        const TransactionalEvictorElementPtr& element = p->second;
+        if(!element->stale())
+        {
+            fixEvictPosition(segment, element);
+            servants[p->first] = element->servant();
+            evict(segment);
+        }
+    }
+}
+
 bool
 Freeze::TransactionalEvictorI::hasAnotherFacet(const Identity& ident, const string& facet)
 {
@@ -284,32 +460,60 @@ Freeze::TransactionalEvictorI::hasAnotherFacet(const Identity& ident, const stri
     // If the object exists in another store, throw FacetNotExistException
     // instead of returning 0 (== ObjectNotExistException)
     //
-    StoreMap storeMapCopy;
+    // With a facet directory, only the stores of the facets it may have
+    // are searched
+    //
+    Dbt dbKey;
+    ObjectStoreBase::KeyMarshaler km(ident, _communicator, _encoding);
+    km.getDbt(dbKey);
+    const Byte* key = static_cast<const Byte*>(dbKey.get_data());
+
+    Long epoch = 0;
+    Long facets = 0;
+    if(_facetDirectory.get() != 0)
+    {
+        facets = _facetDirectory->facets(key, dbKey.get_size(), epoch);
+    }
+
+    vector<ObjectStore<TransactionalEvictorElement>*> stores;
     {
         Lock sync(*this);
-        storeMapCopy = _storeMap;
+        for(StoreMap::const_iterator p = _storeMap.begin(); p != _storeMap.end(); ++p)
+        {
+            //
+            // Do not check again the given facet
+            //
+            int index = p->second->facetIndex();
+            if(p->first != facet && (_facetDirectory.get() == 0 || index < 0 || (facets & FacetDirectory::bit(index))))
+            {
+                stores.push_back(p->second);
+            }
+        }
     }
 
     TransactionIPtr tx = beforeQuery();
 
-    for(StoreMap::iterator p = storeMapCopy.begin(); p != storeMapCopy.end(); ++p)
+    for(size_t i = 0; i < stores.size(); ++i)
     {
-        //
-        // Do not check again the given facet
-        //
-        if((*p).first != facet)
+        ObjectStore<TransactionalEvictorElement>* store = stores[i];
+
+        if(tx == 0 && store->getIfPinned(ident) != 0)
         {
-            ObjectStore<TransactionalEvictorElement>* store = (*p).second;
+            return true;
+        }
 
-            if(tx == 0 && store->getIfPinned(ident) != 0)
-            {
-                return true;
-            }
+        if(store->dbHasObject(ident, tx))
+        {
+            return true;
+        }
 
-            if(store->dbHasObject(ident, tx))
-            {
-                return true;
-            }
+        //
+        // Within a transaction, this facet may only be absent until the
+        // transaction rolls back
+        //
+        if(tx == 0 && _facetDirectory.get() != 0)
+        {
+            _facetDirectory->absent(key, dbKey.get_size(), store->facetIndex(), epoch);
         }
     }
 
@@ -394,7 +598,21 @@ Freeze::TransactionalEvictorI::dispatch(Request& request)
 
     if(sample == 0)
     {
-        if(ctx != 0)
+        TransactionalEvictorElementPtr element;
+        if(ctx != 0 && _loadForUpdate)
+        {
+            //
+            // The cached read-only servant tells whether the operation
+            // updates the servant before it is loaded
+            //
+            element = store->getIfPinned(current.id);
+        }
+
+        if(element != 0)
+        {
+            sample = element->servant();
+        }
+        else if(ctx != 0)
         {
             try
             {
@@ -481,6 +699,15 @@ Freeze::TransactionalEvictorI::dispatch(Request& request)
         }
     }
 
+    //
+    // A snapshot transaction reads the committed state as of its start, so
+    // an update within it could rely on values changed since (write skew)
+    //
+    if(!readOnly && ctx != 0 && ctx->snapshot())
+    {
+        throw DatabaseException(__FILE__, __LINE__, "update rejected within a snapshot transaction");
+    }
+
     if(ctx == 0 && !ownCtx)
     {
         //
@@ -514,7 +741,7 @@ Freeze::TransactionalEvictorI::dispatch(Request& request)
             {
                 if(ownCtx)
                 {
-                    ctx = _dbEnv->createCurrent();
+                    ctx = _dbEnv->createCurrent(_multiversion && readOnly);
                 }
 
 #ifndef NDEBUG
@@ -536,7 +763,7 @@ Freeze::TransactionalEvictorI::dispatch(Request& request)
                     }
                     else
                     {
-                        sh.init(ctx, current, store);
+                        sh.init(ctx, current, store, _loadForUpdate && !readOnly);
                     }
 
                     if(sh.servant() == 0)
@@ -647,16 +874,13 @@ Freeze::TransactionalEvictorI::deactivate(const string&)
 {
     if(_deactivateController.deactivate())
     {
-        {
-            Lock sync(*this);
+        unregisterMemoryBudget();
 
-            //
-            // Set the evictor size to zero, meaning that we will evict
-            // everything possible.
-            //
-            _evictorSize = 0;
-            evict();
-        }
+        //
+        // Set the evictor size to zero, meaning that we will evict
+        // everything possible.
+        //
+        resize(0);
 
         //
         // Break cycle
@@ -704,15 +928,41 @@ void
 Freeze::TransactionalEvictorI::evict()
 {
     //
-    // Must be called with this locked
+    // Must be called with _sizeMutex locked
+    //
+    for(size_t i = 0; i < _segments.size(); ++i)
+    {
+        Segment& segment = *_segments[i];
+        IceUtil::Mutex::Lock sync(segment.mutex);
+        segment.policy->setCapacity(segmentSize(i));
+        segment.policy->setByteCapacity(segmentBytes(i));
+        evict(segment);
+    }
+}
+
+void
+Freeze::TransactionalEvictorI::evict(Segment& segment)
+{
+    //
+    // Must be called with segment locked
     //
 
-    while(_currentEvictorSize > _evictorSize)
+    if(segment.policy->overflow())
     {
         //
         // Evict, no matter what!
         //
-        evict(*_evictorList.rbegin());
+        vector<TransactionalEvictorElementPtr> victims;
+        segment.policy->evict(isEvictable, victims);
+
+        for(vector<TransactionalEvictorElementPtr>::const_iterator p = victims.begin(); p != victims.end(); ++p)
+        {
+            const TransactionalEvictorElementPtr& element = *p;
+            assert(!element->_stale);
+            element->_inEvictor = false;
+            element->_stale = true;
+            element->_store.unpin(element->_cachePosition);
+        }
     }
 }
 
@@ -721,14 +971,15 @@ Freeze::TransactionalEvictorI::loadCachedServant(const Identity& ident, ObjectSt
 {
     for(;;)
     {
-        TransactionalEvictorElementPtr element = store->pin(ident);
+        TransactionalEvictorElementPtr element = pinElement(store, ident);
 
         if(element == 0)
         {
             return 0;
         }
 
-        Lock sync(*this);
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
         if(element->stale())
         {
             //
@@ -737,12 +988,12 @@ Freeze::TransactionalEvictorI::loadCachedServant(const Identity& ident, ObjectSt
             continue;
         }
 
-        fixEvictPosition(element);
+        fixEvictPosition(segment, element);
 
         //
         // if _evictorSize is 0, I may evict myself ... no big deal
         //
-        evict();
+        evict(segment);
         return element->servant();
     }
 }
@@ -751,16 +1002,17 @@ ObjectPtr
 Freeze::TransactionalEvictorI::evict(const Identity& ident, ObjectStore<TransactionalEvictorElement>* store)
 {
     //
-    // Important: we can't wait for the DB (even indirectly) with 'this' locked
+    // Important: we can't wait for the DB (even indirectly) with a segment locked
     //
     TransactionalEvictorElementPtr element = store->getIfPinned(ident, true);
 
     if(element != 0)
     {
-        Lock sync(*this);
+        Segment& segment = findSegment(ident);
+        IceUtil::Mutex::Lock sync(segment.mutex);
         if(!element->_stale)
         {
-            evict(element);
+            evict(segment, element);
             return element->servant();
         }
     }
@@ -768,10 +1020,90 @@ Freeze::TransactionalEvictorI::evict(const Identity& ident, ObjectStore<Transact
 }
 
 void
-Freeze::TransactionalEvictorI::evict(const TransactionalEvictorElementPtr& element)
+Freeze::TransactionalEvictorI::refresh(const Identity& ident, ObjectStore<TransactionalEvictorElement>* store,
+                                       ObjectRecord& rec, const ObjectStoreBase::Digest& digest, Long stamp)
+{
+    //
+    // Wait for a pending load, which may have read the previous record
+    //
+    store->getIfPinned(ident, true);
+
+    //
+    // The refreshes of an object are serialized by the segment mutex
+    //
+    Segment& segment = findSegment(ident);
+    IceUtil::Mutex::Lock sync(segment.mutex);
+
+    TransactionalEvictorElementPtr element = store->getIfPinned(ident);
+    if(element == 0 || element->_stale || element->_stamp >= stamp)
+    {
+        lastUpdate(store, ident, stamp);
+        return;
+    }
+
+    evict(segment, element);
+
+    if(!lastUpdate(store, ident, stamp))
+    {
+        //
+        // A later update may have committed, and a load may have read its
+        // record already: leave this object to the next load
+        //
+        return;
+    }
+
+    //
+    // A load started since the eviction reads this record, or a later one
+    //
+    element = store->pinLoaded(ident, rec, digest.size, digest);
+    if(element != 0 && !element->_stale)
+    {
+        if(element->_stamp < stamp)
+        {
+            element->_stamp = stamp;
+        }
+        fixEvictPosition(segment, element);
+        evict(segment);
+    }
+}
+
+Long
+Freeze::TransactionalEvictorI::nextStamp(const ObjectStoreBase* store, const Identity& ident)
+{
+    IceUtil::Mutex::Lock sync(_stampMutex);
+    _lastUpdates[make_pair(store, ident)] = ++_stamp;
+    return _stamp;
+}
+
+void
+Freeze::TransactionalEvictorI::discardUpdate(const ObjectStoreBase* store, const Identity& ident, Long stamp)
+{
+    lastUpdate(store, ident, stamp);
+}
+
+bool
+Freeze::TransactionalEvictorI::lastUpdate(const ObjectStoreBase* store, const Identity& ident, Long stamp)
+{
+    IceUtil::Mutex::Lock sync(_stampMutex);
+    map<pair<const ObjectStoreBase*, Identity>, Long>::iterator p = _lastUpdates.find(make_pair(store, ident));
+    if(p != _lastUpdates.end() && p->second == stamp)
+    {
+        _lastUpdates.erase(p);
+        return true;
+    }
+
+    //
+    // A later update, or none when the last update was already refreshed
+    // or rolled back
+    //
+    return false;
+}
+
+void
+Freeze::TransactionalEvictorI::evict(Segment& segment, const TransactionalEvictorElementPtr& element)
 {
     //
-    // Must be called with this locked!
+    // Must be called with segment locked!
     //
     assert(!element->_stale);
     element->_stale = true;
@@ -780,34 +1112,31 @@ Freeze::TransactionalEvictorI::evict(const TransactionalEvictorElementPtr& eleme
     if(element->_inEvictor)
     {
         element->_inEvictor = false;
-        _evictorList.erase(element->_evictPosition);
-        _currentEvictorSize--;
+        segment.policy->remove(element);
     }
 }
 
 void
-Freeze::TransactionalEvictorI::fixEvictPosition(const TransactionalEvictorElementPtr& element)
+Freeze::TransactionalEvictorI::fixEvictPosition(Segment& segment, const TransactionalEvictorElementPtr& element)
 {
     //
-    // Must be called with this locked!
+    // Must be called with segment locked!
     //
 
     assert(!element->_stale);
 
     if(element->_inEvictor)
     {
-        _evictorList.erase(element->_evictPosition);
+        segment.policy->touch(element);
     }
     else
     {
         //
         // New object
         //
-        _currentEvictorSize++;
         element->_inEvictor = true;
+        segment.policy->add(element);
     }
-    _evictorList.push_front(element);
-    element->_evictPosition = _evictorList.begin();
 }
 
 void
@@ -835,7 +1164,8 @@ Freeze::TransactionalEvictorElement::TransactionalEvictorElement(ObjectRecord& r
     _servant(r.servant),
     _store(s),
     _stale(true),
-    _inEvictor(false)
+    _inEvictor(false),
+    _stamp(0)
 {
 }
 
@@ -848,4 +1178,6 @@ Freeze::TransactionalEvictorElement::init(ObjectStore<TransactionalEvictorElemen
 {
     _stale = false;
     _cachePosition = p;
+    policyEntry.ident = &p->first;
+    policyEntry.store = &_store;
 }
@@ -38,6 +38,27 @@ public:
         return _stale;
     }
 
+    //
+    // The stamp of the update that installed the record of this element, or
+    // 0 when the record was loaded from the database
+    //
+    Ice::Long stamp() const
+    {
+        return _stamp;
+    }
+
+    //
+    // Used by the eviction policy; protected by the mutex of the evictor
+    // segment of this element
+    //
+    EvictionPolicyEntry<TransactionalEvictorElement> policyEntry;
+
+    //
+    // Digest of the record of the servant, with a 0 size unless the evictor
+    // keeps digests; immutable once the element is pinned
+    //
+    ObjectStoreBase::Digest marshaled;
+
 private:
 
     friend class TransactionalEvictorI;
@@ -55,11 +76,11 @@ private:
     ObjectStore<TransactionalEvictorElement>::Position _cachePosition;
 
     //
-    // Protected by TransactionalEvictorI
+    // Protected by the mutex of the evictor segment of this element
     //
-    std::list<TransactionalEvictorElementPtr>::iterator _evictPosition;
     bool _stale;
     bool _inEvictor;
+    Ice::Long _stamp;
 };
 
 class TransactionalEvictorI : public TransactionalEvictor, public EvictorI<TransactionalEvictorElement>
@@ -79,6 +100,11 @@ public:
 
     virtual bool hasFacet(const Ice::Identity&, const std::string&);
 
+    virtual Ice::Int preloadFacets(const Ice::Identity&);
+    virtual void prefetchNow(const std::vector<Ice::Identity>&, const std::string&);
+
+    virtual void pinServants(ObjectStoreBase*, const std::vector<Ice::Identity>&, std::map<Ice::Identity, Ice::ObjectPtr>&);
+
     virtual void finished(const Ice::Current&, const Ice::ObjectPtr&, const Ice::LocalObjectPtr&);
     virtual void deactivate(const std::string&);
 
@@ -86,8 +112,34 @@ public:
 
     bool dispatch(Ice::Request&);
 
+    void lockForUpdate(const std::vector<Ice::Identity>&, const std::string&);
+
     Ice::ObjectPtr evict(const Ice::Identity&, ObjectStore<TransactionalEvictorElement>*);
 
+    //
+    // Replaces the cached element of an object updated by a committed
+    // transaction with the committed record, when this update is the last
+    // update of the object; otherwise, or when the cached element may hold
+    // an older record, it only evicts the element. Objects not in the cache
+    // are left to the next load.
+    //
+    void refresh(const Ice::Identity&, ObjectStore<TransactionalEvictorElement>*, ObjectRecord&,
+                 const ObjectStoreBase::Digest&, Ice::Long);
+
+    //
+    // Stamps increase with each update; an update holds its write lock until
+    // commit, so the stamps of the updates of a given object follow the
+    // order of their commits. The evictor remembers the stamp of the last
+    // update of each object until it is refreshed or rolled back.
+    //
+    Ice::Long nextStamp(const ObjectStoreBase*, const Ice::Identity&);
+    void discardUpdate(const ObjectStoreBase*, const Ice::Identity&, Ice::Long);
+
+    bool updateCacheOnCommit() const
+    {
+        return _updateCacheOnCommit;
+    }
+
 protected:
 
     virtual bool hasAnotherFacet(const Ice::Identity&, const std::string&);
@@ -100,19 +152,25 @@ private:
 
     Ice::ObjectPtr loadCachedServant(const Ice::Identity&, ObjectStore<TransactionalEvictorElement>*);
 
-    void evict(const TransactionalEvictorElementPtr&);
-    void fixEvictPosition(const TransactionalEvictorElementPtr&);
+    void evict(Segment&);
+    void evict(Segment&, const TransactionalEvictorElementPtr&);
+    void fixEvictPosition(Segment&, const TransactionalEvictorElementPtr&);
 
     void servantNotFound(const char*, int, const Ice::Current&);
 
+    bool _rollbackOnUserException;
+    bool _updateCacheOnCommit;
+    bool _loadForUpdate;
+
     //
-    // The _evictorList contains a list of all objects we keep,
-    // with the most recently used first.
+    // Returns true when the given stamp is the stamp of the last update of
+    // the object, and forgets it
     //
-    std::list<TransactionalEvictorElementPtr> _evictorList;
-    std::list<TransactionalEvictorElementPtr>::size_type _currentEvictorSize;
+    bool lastUpdate(const ObjectStoreBase*, const Ice::Identity&, Ice::Long);
 
-    bool _rollbackOnUserException;
+    IceUtil::Mutex _stampMutex;
+    Ice::Long _stamp;
+    std::map<std::pair<const ObjectStoreBase*, Ice::Identity>, Ice::Long> _lastUpdates;
 
     Ice::DispatchInterceptorPtr _interceptor;
 };
@@ -179,6 +179,8 @@ struct Index
     string type;
     string member;
     bool caseSensitive;
+    bool sort;
+    string userCompare;
 };
 
 struct IndexType
@@ -223,12 +225,17 @@ usage(const char* n)
         "                         with the COMPARE functor class. COMPARE's default\n"
         "                         value is std::less<KEY>\n"
         "--index NAME,TYPE,MEMBER[,{case-sensitive|case-insensitive}]\n"
+        "                 [,sort[,COMPARE]]\n"
         "                         Create a Freeze evictor index with the name\n"
         "                         NAME for member MEMBER of class TYPE. This\n"
         "                         option may be specified multiple times for\n"
         "                         different names. NAME may be a scoped name.\n"
         "                         When member is a string, the case can be\n"
         "                         sensitive or insensitive (default is sensitive).\n"
+        "                         By default, keys are sorted using their binary\n"
+        "                         Ice-encoding representation. Use 'sort' to sort\n"
+        "                         with the COMPARE functor class. COMPARE's default\n"
+        "                         value is std::less<MEMBER type>\n"
         "--dict-index DICT[,MEMBER][,{case-sensitive|case-insensitive}]\n"
         "                 [,sort[,COMPARE]]\n"
         "                         Add an index to dictionary DICT. If MEMBER is \n"
@@ -544,6 +551,55 @@ writeDictH(const string& name, const Dict& dict, const vector<IndexType> indexTy
     H << eb << ';';
 }
 
+//
+// Skips the given members up to the member with the given name; strings and
+// sequences of fixed-size elements are skipped without being unmarshaled
+//
+void
+writeSkipMembers(Output& C, const DataMemberList& members, const string& member, const string& scope)
+{
+    size_t fixedSize = 0;
+    int skipped = 0;
+    for(DataMemberList::const_iterator p = members.begin(); p != members.end() && (*p)->name() != member; ++p)
+    {
+        TypePtr type = (*p)->type();
+        if(!type->isVariableLength())
+        {
+            fixedSize += type->minWireSize();
+            continue;
+        }
+
+        if(fixedSize > 0)
+        {
+            C << nl << "stream.skip(" << fixedSize << ");";
+            fixedSize = 0;
+        }
+
+        BuiltinPtr builtin = BuiltinPtr::dynamicCast(type);
+        SequencePtr seq = SequencePtr::dynamicCast(type);
+        if(builtin && builtin->kind() == Builtin::KindString)
+        {
+            C << nl << "stream.skip(static_cast<size_t>(stream.readSize()));";
+        }
+        else if(seq && !seq->type()->isVariableLength())
+        {
+            C << nl << "stream.skip(static_cast<size_t>(stream.readSize()) * " << seq->type()->minWireSize() << ");";
+        }
+        else
+        {
+            ostringstream os;
+            os << "skipped" << skipped++;
+            C << nl << typeToString(type, scope, (*p)->getMetaData()) << ' ' << os.str() << ';';
+            writeMarshalUnmarshalCode(C, type, false, 0, os.str(), false, (*p)->getMetaData(), 0, "stream", false);
+        }
+    }
+
+    if(fixedSize > 0)
+    {
+        C << nl << "stream.skip(" << fixedSize << ");";
+    }
+}
+
 void
 writeDictC(const string& name, const string& absolute, const Dict& dict, const vector<IndexType> indexTypes,
            const TypePtr& keyType, const StringList& keyMetaData, const TypePtr& valueType,
@@ -618,11 +674,26 @@ writeDictC(const string& name, const string& absolute, const Dict& dict, const v
 
         bool optimize = false;
 
+        StructPtr st = StructPtr::dynamicCast(valueType);
         if(dict.indices[i].member.empty() && dict.indices[i].caseSensitive)
         {
             optimize = true;
             C << nl << "k = v;";
         }
+        else if(st != 0 && !valueType->usesClasses())
+        {
+            //
+            // Skip the members before the indexed member instead of
+            // unmarshaling the whole value
+            //
+            C << nl << "Ice::InputStream stream(_communicator, _encoding, v);";
+            C << nl << "stream.startEncapsulation();";
+            writeSkipMembers(C, st->dataMembers(), dict.indices[i].member, scope);
+            C << nl << typeToString(indexTypes[i].type, scope, indexTypes[i].metaData) << " index;";
+            writeMarshalUnmarshalCode(C, indexTypes[i].type, false, 0, "index", false, indexTypes[i].metaData, 0,
+                                      "stream", false);
+            C << nl << "write(index, k, _communicator, _encoding);";
+        }
         else
         {
             //
@@ -1094,7 +1165,8 @@ writeDict(const string& n, const UnitPtr& u, const Dict& dict, Output& H, Output
 }
 
 void
-writeIndexH(const string& memberTypeString, const string& name, Output& H, const string& dllExport)
+writeIndexH(const string& memberTypeString, const string& name, const string& compare, bool prefix, Output& H,
+            const string& dllExport)
 {
     H << sp << nl << "class " << dllExport << name
       << " : public Freeze::Index";
@@ -1104,15 +1176,52 @@ writeIndexH(const string& memberTypeString, const string& name, Output& H, const
     H << sp;
     H.inc();
 
-    H << nl << name << "(const std::string&, const std::string& = \"\");";
+    if(compare.empty())
+    {
+        H << nl << name << "(const std::string&, const std::string& = \"\");";
+    }
+    else
+    {
+        H << nl << name << "(const std::string&, const std::string& = \"\", const " << compare << "& = "
+          << compare << "());";
+    }
     H << sp << nl << "std::vector<Ice::Identity>";
     H << nl << "findFirst(" << memberTypeString << ", Ice::Int) const;";
 
+    H << sp << nl << "std::vector<Freeze::IndexMatch>";
+    H << nl << "findFirstServants(" << memberTypeString << ", Ice::Int) const;";
+
     H << sp << nl << "std::vector<Ice::Identity>";
     H << nl << "find(" << memberTypeString << ") const;";
 
+    //
+    // Ranges are only meaningful in the order given by a compare functor,
+    // not in the order of the Ice encoding
+    //
+    if(!compare.empty())
+    {
+        H << sp << nl << "std::vector<Ice::Identity>";
+        H << nl << "findRange(" << memberTypeString << ", " << memberTypeString
+          << ", Ice::Int, Freeze::IndexPosition&) const;";
+    }
+
+    if(prefix)
+    {
+        H << sp << nl << "std::vector<Ice::Identity>";
+        H << nl << "findPrefix(const std::string&, Ice::Int, Freeze::IndexPosition&) const;";
+    }
+
     H << sp << nl << "Ice::Int";
     H << nl << "count(" << memberTypeString << ") const;";
+
+    H << sp << nl << "Freeze::EvictorIteratorPtr";
+    H << nl << "getIterator(" << memberTypeString << ", Ice::Int) const;";
+
+    if(!compare.empty())
+    {
+        H << sp << nl << "Freeze::EvictorIteratorPtr";
+        H << nl << "getRangeIterator(" << memberTypeString << ", " << memberTypeString << ", Ice::Int) const;";
+    }
     H.dec();
     H << sp << nl << "private:";
     H << sp;
@@ -1124,6 +1233,14 @@ writeIndexH(const string& memberTypeString, const string& name, Output& H, const
     H << sp << nl << "void";
     H << nl << "marshalKey(" << memberTypeString << ", Freeze::Key&) const;";
 
+    if(!compare.empty())
+    {
+        H << sp << nl << "virtual int";
+        H << nl << "compare(const Freeze::Key&, const Freeze::Key&);";
+
+        H << sp << nl << compare << " _compare;";
+    }
+
     H << eb << ';';
     H << sp;
     H << nl << "typedef IceUtil::Handle<" << name << "> " << name << "Ptr;";
@@ -1131,15 +1248,28 @@ writeIndexH(const string& memberTypeString, const string& name, Output& H, const
 
 void
 writeIndexC(const TypePtr& type, const TypePtr& memberType, const string& memberName,
-            bool caseSensitive, const string& fullName, const string& name, Output& C)
+            bool caseSensitive, const string& compare, bool prefix, const string& fullName, const string& name,
+            Output& C)
 {
     string inputType = inputTypeToString(memberType, false);
 
-    C << sp << nl << fullName << "::" << name
-      << "(const ::std::string& name, const ::std::string& facet)";
-    C.inc();
-    C << nl << ": Freeze::Index(name, facet)";
-    C.dec();
+    if(compare.empty())
+    {
+        C << sp << nl << fullName << "::" << name
+          << "(const ::std::string& name, const ::std::string& facet)";
+        C.inc();
+        C << nl << ": Freeze::Index(name, facet)";
+        C.dec();
+    }
+    else
+    {
+        C << sp << nl << fullName << "::" << name
+          << "(const ::std::string& name, const ::std::string& facet, const " << compare << "& compare)";
+        C.inc();
+        C << nl << ": Freeze::Index(name, facet, true),";
+        C << nl << "_compare(compare)";
+        C.dec();
+    }
     C << sb;
     C << eb;
 
@@ -1151,6 +1281,14 @@ writeIndexC(const TypePtr& type, const TypePtr& memberType, const string& member
     C << nl << "return untypedFindFirst(bytes, firstN);";
     C << eb;
 
+    C << sp << nl << "std::vector<Freeze::IndexMatch>";
+    C << nl << fullName << "::" << "findFirstServants(" << inputType << " index, ::Ice::Int firstN) const";
+    C << sb;
+    C << nl << "Freeze::Key bytes;";
+    C << nl << "marshalKey(index, bytes);";
+    C << nl << "return untypedFindFirstServants(bytes, firstN);";
+    C << eb;
+
     C << sp << nl << "std::vector<Ice::Identity>";
     C << nl << fullName << "::" << "find(" << inputType << " index) const";
     C << sb;
@@ -1159,6 +1297,48 @@ writeIndexC(const TypePtr& type, const TypePtr& memberType, const string& member
     C << nl << "return untypedFind(bytes);";
     C << eb;
 
+    if(!compare.empty())
+    {
+        C << sp << nl << "std::vector<Ice::Identity>";
+        C << nl << fullName << "::" << "findRange(" << inputType << " lower, " << inputType
+          << " upper, ::Ice::Int firstN, Freeze::IndexPosition& position) const";
+        C << sb;
+        C << nl << "Freeze::Key lowerBytes;";
+        C << nl << "marshalKey(lower, lowerBytes);";
+        C << nl << "Freeze::Key upperBytes;";
+        C << nl << "marshalKey(upper, upperBytes);";
+        C << nl << "return untypedFindRange(lowerBytes, upperBytes, firstN, position);";
+        C << eb;
+    }
+
+    if(prefix)
+    {
+        C << sp << nl << "std::vector<Ice::Identity>";
+        C << nl << fullName << "::"
+          << "findPrefix(const ::std::string& prefix, ::Ice::Int firstN, Freeze::IndexPosition& position) const";
+        C << sb;
+        string prefixS;
+        if(caseSensitive)
+        {
+            prefixS = "prefix";
+        }
+        else
+        {
+            C << nl << "::std::string lowerCasePrefix = IceUtilInternal::toLower(prefix);";
+            prefixS = "lowerCasePrefix";
+        }
+        C << nl << "Freeze::Key lowerBytes;";
+        C << nl << "marshalKey(" << prefixS << ", lowerBytes);";
+        C << nl << "Freeze::Key upperBytes;";
+        C << nl << "::std::string upper;";
+        C << nl << "if(prefixUpperBound(" << prefixS << ", upper))";
+        C << sb;
+        C << nl << "marshalKey(upper, upperBytes);";
+        C << eb;
+        C << nl << "return untypedFindRange(lowerBytes, upperBytes, firstN, position);";
+        C << eb;
+    }
+
     C << sp << nl << "Ice::Int";
     C << nl << fullName << "::" << "count(" << inputType << " index) const";
     C << sb;
@@ -1167,6 +1347,28 @@ writeIndexC(const TypePtr& type, const TypePtr& memberType, const string& member
     C << nl << "return untypedCount(bytes);";
     C << eb;
 
+    C << sp << nl << "Freeze::EvictorIteratorPtr";
+    C << nl << fullName << "::" << "getIterator(" << inputType << " index, ::Ice::Int batchSize) const";
+    C << sb;
+    C << nl << "Freeze::Key bytes;";
+    C << nl << "marshalKey(index, bytes);";
+    C << nl << "return untypedGetIterator(bytes, batchSize);";
+    C << eb;
+
+    if(!compare.empty())
+    {
+        C << sp << nl << "Freeze::EvictorIteratorPtr";
+        C << nl << fullName << "::" << "getRangeIterator(" << inputType << " lower, " << inputType
+          << " upper, ::Ice::Int batchSize) const";
+        C << sb;
+        C << nl << "Freeze::Key lowerBytes;";
+        C << nl << "marshalKey(lower, lowerBytes);";
+        C << nl << "Freeze::Key upperBytes;";
+        C << nl << "marshalKey(upper, upperBytes);";
+        C << nl << "return untypedGetRangeIterator(lowerBytes, upperBytes, batchSize);";
+        C << eb;
+    }
+
     string typeString = typeToString(type);
 
     C << sp << nl << "bool";
@@ -1207,6 +1409,44 @@ writeIndexC(const TypePtr& type, const TypePtr& memberType, const string& member
     }
     C << nl << "::std::vector<Ice::Byte>(stream.b.begin(), stream.b.end()).swap(bytes);";
     C << eb;
+
+    if(!compare.empty())
+    {
+        string memberTypeS = typeToString(memberType);
+
+        C << sp << nl << "int";
+        C << nl << fullName << "::" << "compare(const Freeze::Key& bytes1, const Freeze::Key& bytes2)";
+        C << sb;
+        for(int i = 1; i <= 2; ++i)
+        {
+            ostringstream os;
+            os << i;
+            string n = os.str();
+
+            C << nl << memberTypeS << " index" << n << ";";
+            C << sb;
+            C << nl << "Ice::InputStream stream(_communicator, _encoding, bytes" << n << ");";
+            writeMarshalUnmarshalCode(C, memberType, false, 0, "index" + n, false, StringList(), 0, "stream", false);
+            if(memberType->usesClasses())
+            {
+                C << nl << "stream.readPendingValues();";
+            }
+            C << eb;
+        }
+        C << nl << "if(_compare(index1, index2))";
+        C << sb;
+        C << nl << "return -1;";
+        C << eb;
+        C << nl << "else if(_compare(index2, index1))";
+        C << sb;
+        C << nl << "return 1;";
+        C << eb;
+        C << nl << "else";
+        C << sb;
+        C << nl << "return 0;";
+        C << eb;
+        C << eb;
+    }
 }
 
 void
@@ -1291,7 +1531,19 @@ writeIndex(const string& /*n*/, const UnitPtr& u, const Index& index, Output& H,
         H << nl << "namespace " << *q << nl << '{';
     }
 
-    writeIndexH(inputTypeToString(dataMember->type(), false), name, H, dllExport);
+    string compare;
+    if(index.sort)
+    {
+        compare = getCompare(index, typeToString(dataMember->type()));
+    }
+
+    //
+    // Prefixes only match a range of keys in the natural order of strings
+    //
+    BuiltinPtr builtin = BuiltinPtr::dynamicCast(dataMember->type());
+    bool prefix = builtin && builtin->kind() == Builtin::KindString && index.sort && index.userCompare.empty();
+
+    writeIndexH(inputTypeToString(dataMember->type(), false), name, compare, prefix, H, dllExport);
 
     for(vector<string>::const_iterator q = scope.begin(); q != scope.end(); ++q)
     {
@@ -1299,7 +1551,7 @@ writeIndex(const string& /*n*/, const UnitPtr& u, const Index& index, Output& H,
         H << nl << '}';
     }
 
-    writeIndexC(type, dataMember->type(), index.member, index.caseSensitive, absolute, name, C);
+    writeIndexC(type, dataMember->type(), index.member, index.caseSensitive, compare, prefix, absolute, name, C);
 }
 
 void
@@ -1712,17 +1964,48 @@ compile(int argc, char* argv[])
             s.erase(0, pos + 1);
         }
         pos = s.find(',');
-        string caseString;
         if(pos != string::npos)
         {
             index.member = s.substr(0, pos);
             s.erase(0, pos + 1);
-            caseString = s;
         }
         else
         {
             index.member = s;
-            caseString = "case-sensitive";
+            s.clear();
+        }
+
+        string caseString = "case-sensitive";
+        index.sort = false;
+        if(!s.empty())
+        {
+            pos = s.find(',');
+            string subs = s.substr(0, pos);
+            if(subs != "sort")
+            {
+                caseString = subs;
+                s = pos == string::npos ? string() : s.substr(pos + 1);
+                pos = s.find(',');
+            }
+
+            if(!s.empty())
+            {
+                if(s.substr(0, pos) != "sort")
+                {
+                    consoleErr << argv[0] << ": error: " << *i << ": nothing or ',sort' expected after the case"
+                               << endl;
+                    if(!validate)
+                    {
+                        usage(argv[0]);
+                    }
+                    return EXIT_FAILURE;
+                }
+                index.sort = true;
+                if(pos != string::npos)
+                {
+                    index.userCompare = s.substr(pos + 1);
+                }
+            }
         }
 
         if(index.name.empty())
@@ -812,6 +812,76 @@ allTests(const CommunicatorPtr& communicator, const string& envName)
     }
     cout << "ok" << endl;
 
+    cout << "testing index on a member after a variable-length member... " << flush;
+    {
+        IntIdentityMapWithIndex iim(connection, "intIdentityNames");
+
+        //
+        // Names of 0 to 299 characters, so that some of the name sizes
+        // are encoded on one byte and some on five bytes
+        //
+        {
+            TransactionHolder txHolder(connection);
+            for(int i = 0; i < 300; i++)
+            {
+                Ice::Identity ident;
+                ident.name = string(static_cast<size_t>(i), 'n');
+                ident.category = i % 3 == 0 ? "three" : "other";
+                iim.put(IntIdentityMapWithIndex::value_type(i, ident));
+            }
+            txHolder.commit();
+        }
+        test(iim.categoryCount("three") == 100);
+        test(iim.categoryCount("other") == 200);
+
+        {
+            int count = 0;
+            IntIdentityMapWithIndex::iterator p = iim.findByCategory("three");
+            while(p != iim.end())
+            {
+                test(p->first % 3 == 0);
+                test(p->second.name.size() == static_cast<size_t>(p->first));
+                ++p;
+                ++count;
+            }
+            test(count == 100);
+        }
+
+        //
+        // Changing the length of the name must not change the category key;
+        // changing the category must move the entry
+        //
+        {
+            TransactionHolder txHolder(connection);
+            for(int i = 0; i < 300; i++)
+            {
+                Ice::Identity ident;
+                ident.name = string(static_cast<size_t>(299 - i), 'm');
+                ident.category = i % 3 == 0 ? "three" : "other";
+                if(i == 1 || i == 260)
+                {
+                    ident.category = "moved";
+                }
+                iim.put(IntIdentityMapWithIndex::value_type(i, ident));
+            }
+            txHolder.commit();
+        }
+        test(iim.categoryCount("three") == 100);
+        test(iim.categoryCount("other") == 198);
+        test(iim.categoryCount("moved") == 2);
+
+        {
+            IntIdentityMapWithIndex::iterator p = iim.findByCategory("moved");
+            test(p != iim.end() && p->first == 1 && p->second.name.size() == 298);
+            ++p;
+            test(p != iim.end() && p->first == 260 && p->second.name.size() == 39);
+            ++p;
+            test(p == iim.end());
+        }
+        iim.destroy();
+    }
+    cout << "ok" << endl;
+
     cout << "testing sorting... " << flush;
     {
         SortedMap sm(connection, "sortedMap");
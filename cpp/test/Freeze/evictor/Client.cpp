@@ -10,6 +10,8 @@
 #include <TestHelper.h>
 #include <Test.h>
 
+#include <algorithm>
+
 using namespace std;
 using namespace IceUtil;
 
@@ -350,6 +352,60 @@ private:
     int _size;
 };
 
+class SetValueThread : public Thread
+{
+public:
+
+    SetValueThread(const Test::FacetPrx& facet, Ice::Int value) :
+        _facet(facet),
+        _value(value)
+    {
+    }
+
+    virtual void
+    run()
+    {
+        for(int loop = 1; loop <= 50; ++loop)
+        {
+            _facet->setValue(_value + loop);
+            ostringstream ostr;
+            ostr << _value + loop;
+            _facet->setData(ostr.str());
+        }
+    }
+
+private:
+
+    Test::FacetPrx _facet;
+    Ice::Int _value;
+};
+
+class GetValueThread : public Thread
+{
+public:
+
+    GetValueThread(const vector<Test::ServantPrx>& servants) :
+        _servants(servants)
+    {
+    }
+
+    virtual void
+    run()
+    {
+        for(int loop = 0; loop < 5; ++loop)
+        {
+            for(int i = 0; i < static_cast<int>(_servants.size()); ++i)
+            {
+                test(_servants[i]->getValue() == i);
+            }
+        }
+    }
+
+private:
+
+    const vector<Test::ServantPrx> _servants;
+};
+
 class TransferThread : public Thread
 {
 public:
@@ -409,13 +465,18 @@ public:
                         from->transfer3(100, to);
                         break;
                     }
+                    case 3:
+                    {
+                        from->transfer4(100, to);
+                        break;
+                    }
                     default:
                     {
                         test(false);
                     }
                 };
                 transferOp++;
-                transferOp = transferOp % 3;
+                transferOp = transferOp % 4;
             }
             catch(const Test::InsufficientFundsException&)
             {
@@ -452,7 +513,7 @@ private:
 };
 
 void
-allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shutdown)
+allTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional, bool shutdown)
 {
     string ref = "factory:default -p 12010";
     Ice::ObjectPrx base = communicator->stringToProxy(ref);
@@ -461,17 +522,22 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
 
     if(transactional)
     {
-        cout << "testing transactional Freeze Evictor... " << flush;
+        cout << "testing transactional Freeze Evictor";
     }
     else
     {
-        cout << "testing background-save Freeze Evictor... " << flush;
+        cout << "testing background-save Freeze Evictor";
+    }
+    if(name != "Test")
+    {
+        cout << " with " << name << " evictor";
     }
+    cout << "... " << flush;
 
     const Ice::Int size = 5;
     Ice::Int i;
 
-    Test::RemoteEvictorPrx evictor = factory->createEvictor("Test", transactional);
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
 
     evictor->setSize(size);
 
@@ -556,6 +622,43 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
         test(facet2->getValue() == 100 * i + 100);
     }
 
+    //
+    // Create, destroy and recreate many servants before they are saved: the
+    // background save evictor then streams batches with several entries for
+    // the same objects, split between its stream threads when large enough
+    //
+    {
+        const Ice::Int count = 100;
+        vector<Test::ServantPrx> many;
+        for(i = 0; i < count; i++)
+        {
+            ostringstream ostr;
+            ostr << "many" << i;
+            many.push_back(evictor->createServant(ostr.str(), i));
+        }
+        for(i = 0; i < count; i++)
+        {
+            many[i]->destroy();
+        }
+        for(i = 0; i < count; i++)
+        {
+            ostringstream ostr;
+            ostr << "many" << i;
+            evictor->createServant(ostr.str(), i + 1000);
+            many[i]->setValue(i + 2000);
+        }
+
+        evictor->saveNow();
+        evictor->setSize(0);
+        evictor->setSize(size);
+        for(i = 0; i < count; i++)
+        {
+            test(many[i]->getValue() == i + 2000);
+            many[i]->destroy();
+        }
+        evictor->saveNow();
+    }
+
     if(!transactional)
     {
         //
@@ -809,7 +912,7 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
     //
     evictor->deactivate();
 
-    evictor = factory->createEvictor("Test", transactional);
+    evictor = factory->createEvictor(name, transactional);
 
     evictor->setSize(size);
     for(i = 0; i < size; i++)
@@ -933,7 +1036,7 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
     //
     // Resurrect
     //
-    evictor = factory->createEvictor("Test", transactional);
+    evictor = factory->createEvictor(name, transactional);
     evictor->destroyAllServants("");
 
     //
@@ -969,7 +1072,7 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
     //
     // Clean up.
     //
-    evictor = factory->createEvictor("Test", transactional);
+    evictor = factory->createEvictor(name, transactional);
     evictor->destroyAllServants("");
     evictor->deactivate();
 
@@ -981,19 +1084,1566 @@ allTests(const Ice::CommunicatorPtr& communicator, bool transactional, bool shut
     }
 }
 
-class Client : public Test::TestHelper
+Test::RemoteEvictorFactoryPrx
+getFactory(const Ice::CommunicatorPtr& communicator)
 {
-public:
+    Test::RemoteEvictorFactoryPrx factory =
+        Test::RemoteEvictorFactoryPrx::checkedCast(communicator->stringToProxy("factory:default -p 12010"));
+    test(factory);
+    return factory;
+}
 
-    void run(int, char**);
-};
+string
+servantId(Ice::Int i)
+{
+    ostringstream ostr;
+    ostr << i;
+    return ostr.str();
+}
+
+vector<Test::ServantPrx>
+createServants(const Test::RemoteEvictorPrx& evictor, Ice::Int count)
+{
+    vector<Test::ServantPrx> servants;
+    for(Ice::Int i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->createServant(servantId(i), i));
+    }
+    return servants;
+}
+
+vector<Test::ServantPrx>
+getServants(const Test::RemoteEvictorPrx& evictor, Ice::Int count)
+{
+    vector<Test::ServantPrx> servants;
+    for(Ice::Int i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->getServant(servantId(i)));
+    }
+    return servants;
+}
 
 void
-Client::run(int argc, char** argv)
+pipelineTests(const Ice::CommunicatorPtr& communicator)
 {
-    Ice::CommunicatorHolder ich = initialize(argc, argv);
-    allTests(communicator(), false, false);
-    allTests(communicator(), true, true);
+    cout << "testing background saves in progress at deactivation... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 50;
+    Ice::Int i;
+
+    //
+    // The Pipeline evictor saves each modified object in its own batch, so
+    // that several batches are being streamed and written when it is
+    // deactivated; they must all be saved
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("Pipeline", false);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(int loop = 1; loop <= 3; ++loop)
+    {
+        for(i = 0; i < count; i++)
+        {
+            servants[i]->setValue(i + 1000 * loop);
+        }
+        evictor->deactivate();
+
+        evictor = factory->createEvictor("Pipeline", false);
+        servants = getServants(evictor, count);
+        for(i = 0; i < count; i++)
+        {
+            test(servants[i]->getValue() == i + 1000 * loop);
+        }
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+//
+// Waits until the background save evictor has saved all its modified
+// objects
+//
+void
+waitUntilSaved(const Test::RemoteEvictorPrx& evictor)
+{
+    IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+    while(evictor->getSaveStatus().unsavedObjects > 0)
+    {
+        test(IceUtil::Time::now(IceUtil::Time::Monotonic) - start < IceUtil::Time::seconds(30));
+        ThreadControl::sleep(Time::milliSeconds(50));
+    }
+}
+
+void
+adaptiveSaveTests(const Ice::CommunicatorPtr& communicator)
+{
+    cout << "testing adaptive background saves... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 50;
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("Test", false);
+    Test::SaveStatus status = evictor->getSaveStatus();
+    test(!status.adaptive);
+    test(status.savePeriod == 2);
+    evictor->deactivate();
+
+    //
+    // The Adaptive evictor must save each modified object within its
+    // MaxDirtyAge, well before its configured SavePeriod
+    //
+    evictor = factory->createEvictor("Adaptive", false);
+    status = evictor->getSaveStatus();
+    test(status.adaptive);
+    test(status.saveSizeTrigger > 0);
+    test(status.maxTxSize > 0);
+
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    waitUntilSaved(evictor);
+    status = evictor->getSaveStatus();
+    test(status.savePeriod <= 300);
+    test(status.saveSizeTrigger > 0);
+    test(status.maxTxSize > 0);
+
+    //
+    // Objects modified after the first batch must be saved within
+    // MaxDirtyAge as well, whatever the save size trigger
+    //
+    vector<Ice::Int> values(count);
+    for(int loop = 1; loop <= 3; ++loop)
+    {
+        for(i = 0; i < count; i += loop)
+        {
+            values[i] = i + 1000 * loop;
+            servants[i]->setValue(values[i]);
+        }
+        waitUntilSaved(evictor);
+    }
+
+    evictor->setSize(0);
+    evictor->setSize(10);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == values[i]);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+unchangedSaveTests(const Ice::CommunicatorPtr& communicator)
+{
+    cout << "testing background saves of unchanged objects... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 10;
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("Test", false);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    evictor->saveNow();
+
+    //
+    // Objects loaded from the database and modified back to their saved
+    // state are not written; the others must be
+    //
+    evictor->setSize(0);
+    evictor->setSize(count);
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 100);
+        if(i % 2 == 0)
+        {
+            servants[i]->setValue(i);
+        }
+    }
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == (i % 2 == 0 ? i : i + 100));
+    }
+
+    //
+    // An object saved with a new state, then modified back to its
+    // previous state, must be written again
+    //
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 200);
+    }
+    evictor->saveNow();
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i);
+    }
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+
+    //
+    // Same after the evictor is reopened
+    //
+    evictor->deactivate();
+    evictor = factory->createEvictor("Test", false);
+    servants = getServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 300);
+        servants[i]->setValue(i);
+    }
+    evictor->saveNow();
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 400);
+    }
+    evictor->deactivate();
+    evictor = factory->createEvictor("Test", false);
+    servants = getServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 400);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+backpressureTests(const Ice::CommunicatorPtr& communicator)
+{
+    cout << "testing background save backpressure... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 50;
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("Test", false);
+    test(evictor->getSaveStatus().heldBackCalls == 0);
+    evictor->deactivate();
+
+    //
+    // The Backpressure evictor only saves when it reaches its
+    // MaxModifiedObjects high-water mark, and holds back the callers
+    // that reach it until the modified objects are saved
+    //
+    evictor = factory->createEvictor("Backpressure", false);
+    test(evictor->getSaveStatus().heldBackCalls == 0);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 100);
+    }
+    Test::SaveStatus status = evictor->getSaveStatus();
+    test(status.heldBackCalls > 0);
+    test(status.unsavedObjects < count);
+
+    evictor->saveNow();
+    test(evictor->getSaveStatus().unsavedObjects == 0);
+    evictor->setSize(0);
+    evictor->setSize(10);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 100);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+snapshotStreamingTests(const Ice::CommunicatorPtr& communicator)
+{
+    cout << "testing background saves of servant snapshots... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 10;
+    Ice::Int i;
+
+    //
+    // The SnapshotStreaming evictor streams snapshots of the servants,
+    // which implement Freeze::Snapshot, while they are modified
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("SnapshotStreaming", false);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    vector<Test::FacetPrx> facets;
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->addFacet("facet1", "data");
+        facets.push_back(Test::FacetPrx::checkedCast(servants[i], "facet1"));
+        test(facets[i]);
+    }
+
+    {
+        vector<ThreadPtr> threads(count);
+        for(i = 0; i < count; i++)
+        {
+            threads[i] = new SetValueThread(facets[i], 1000 * i);
+            threads[i]->start();
+        }
+        for(i = 0; i < count; i++)
+        {
+            threads[i]->getThreadControl().join();
+        }
+    }
+
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+        test(facets[i]->getValue() == 1000 * i + 50);
+        ostringstream ostr;
+        ostr << 1000 * i + 50;
+        test(facets[i]->getData() == ostr.str());
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setValue(i + 100);
+    }
+
+    evictor->deactivate();
+    evictor = factory->createEvictor("SnapshotStreaming", false);
+    servants = getServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 100);
+        Test::FacetPrx facet = Test::FacetPrx::checkedCast(servants[i], "facet1");
+        test(facet);
+        test(facet->getValue() == 1000 * i + 50);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+//
+// The names of an index query result separated by spaces, sorted unless
+// the order of the result matters
+//
+string
+joined(Test::StringSeq names, bool sorted = true)
+{
+    if(sorted)
+    {
+        sort(names.begin(), names.end());
+    }
+    string result;
+    for(Test::StringSeq::const_iterator p = names.begin(); p != names.end(); ++p)
+    {
+        if(p != names.begin())
+        {
+            result += ' ';
+        }
+        result += *p;
+    }
+    return result;
+}
+
+void
+queryTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing index queries with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 10;
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createIndexedEvictor(name, transactional);
+    vector<Test::ServantPrx> servants;
+    for(i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->createServant(servantId(i), i % 5));
+    }
+
+    //
+    // The queries must see the objects created, modified and destroyed
+    // before they are saved
+    //
+    test(evictor->countServants() == count);
+    test(joined(evictor->findByValue(0)) == "0 5");
+    test(evictor->countByValue(4) == 2);
+
+    servants[0]->setValue(7);
+    test(joined(evictor->findByValue(0)) == "5");
+    test(joined(evictor->findByValue(7)) == "0");
+    test(evictor->countByValue(0) == 1);
+    test(evictor->countByValue(7) == 1);
+
+    servants[1]->destroy();
+    test(joined(evictor->findByValue(1)) == "6");
+    test(evictor->countByValue(1) == 1);
+    test(evictor->countServants() == count - 1);
+
+    //
+    // Same once saved
+    //
+    evictor->deactivate();
+    evictor = factory->createIndexedEvictor(name, transactional);
+    servants = getServants(evictor, count);
+    test(evictor->countServants() == count - 1);
+    test(joined(evictor->findByValue(0)) == "5");
+    test(joined(evictor->findByValue(7)) == "0");
+    test(joined(evictor->findByValue(1)) == "6");
+
+    //
+    // Saved objects modified, destroyed and recreated
+    //
+    servants[5]->setValue(8);
+    test(joined(evictor->findByValue(0)) == "");
+    test(evictor->countByValue(0) == 0);
+    test(joined(evictor->findByValue(8)) == "5");
+
+    servants[6]->destroy();
+    test(joined(evictor->findByValue(1)) == "");
+    test(evictor->countServants() == count - 2);
+
+    evictor->createServant(servantId(1), 1);
+    test(joined(evictor->findByValue(1)) == "1");
+    test(evictor->countByValue(1) == 1);
+    test(evictor->countServants() == count - 1);
+
+    evictor->destroyAllServants("");
+    test(evictor->countServants() == 0);
+    test(joined(evictor->findByValue(8)) == "");
+    test(evictor->countByValue(4) == 0);
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+testObjectNotExist(const Ice::ObjectPrx& proxy)
+{
+    try
+    {
+        proxy->ice_ping();
+        test(false);
+    }
+    catch(const Ice::ObjectNotExistException&)
+    {
+        // Expected
+    }
+}
+
+void
+testFacetNotExist(const Ice::ObjectPrx& proxy)
+{
+    try
+    {
+        proxy->ice_ping();
+        test(false);
+    }
+    catch(const Ice::FacetNotExistException&)
+    {
+        // Expected
+    }
+}
+
+void
+missingObjectTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing lookups of missing objects with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 20;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    //
+    // The Bloom filter and the negative cache of this evictor must forget
+    // the objects it doesn't find once they are created
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
+    vector<Test::ServantPrx> servants = getServants(evictor, count);
+    for(int loop = 0; loop < 2; ++loop)
+    {
+        for(i = 0; i < count; i++)
+        {
+            testObjectNotExist(servants[i]);
+        }
+    }
+    for(i = 0; i < count; i++)
+    {
+        evictor->createServant(servantId(i), i);
+        servants[i]->ice_ping();
+        test(servants[i]->getValue() == i);
+    }
+
+    //
+    // And remember the destroyed objects
+    //
+    for(i = 0; i < count; i += 2)
+    {
+        servants[i]->destroy();
+        testObjectNotExist(servants[i]);
+    }
+    evictor->setSize(0);
+    evictor->setSize(10);
+    for(i = 0; i < count; i++)
+    {
+        if(i % 2 == 0)
+        {
+            testObjectNotExist(servants[i]);
+        }
+        else
+        {
+            test(servants[i]->getValue() == i);
+        }
+    }
+
+    //
+    // Same once reopened
+    //
+    evictor->deactivate();
+    evictor = factory->createEvictor(name, transactional);
+    servants = getServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        if(i % 2 == 0)
+        {
+            testObjectNotExist(servants[i]);
+            evictor->createServant(servantId(i), i + 100);
+            test(servants[i]->getValue() == i + 100);
+        }
+        else
+        {
+            test(servants[i]->getValue() == i);
+        }
+    }
+
+    evictor->destroyAllServants("");
+    for(i = 0; i < count; i++)
+    {
+        testObjectNotExist(servants[i]);
+    }
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+facetDirectoryTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing lookups of missing facets with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 5;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    //
+    // A missing facet of an existing object raises FacetNotExistException,
+    // and ObjectNotExistException once the object has no facet left
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        testFacetNotExist(servants[i]->ice_facet("facet1"));
+        servants[i]->addFacet("facet1", "data");
+        servants[i]->ice_facet("facet1")->ice_ping();
+        servants[i]->addFacet("facet2", "moreData");
+        testFacetNotExist(servants[i]->ice_facet("facet3"));
+    }
+    testObjectNotExist(evictor->getServant(servantId(count)));
+    testObjectNotExist(evictor->getServant(servantId(count))->ice_facet("facet1"));
+
+    servants[0]->removeFacet("facet1");
+    testFacetNotExist(servants[0]->ice_facet("facet1"));
+    servants[0]->destroy();
+    testFacetNotExist(servants[0]);
+    Test::FacetPrx facet2 = Test::FacetPrx::uncheckedCast(servants[0], "facet2");
+    test(facet2->getData() == "moreData");
+    evictor->destroyAllServants("facet2");
+    testObjectNotExist(servants[0]);
+    testObjectNotExist(facet2);
+    testFacetNotExist(servants[1]->ice_facet("facet2"));
+
+    servants[1]->removeFacet("facet1");
+    testFacetNotExist(servants[1]->ice_facet("facet1"));
+    servants[1]->addFacet("facet1", "newData");
+    test(Test::FacetPrx::uncheckedCast(servants[1], "facet1")->getData() == "newData");
+
+    //
+    // Same once reopened
+    //
+    evictor->deactivate();
+    evictor = factory->createEvictor(name, transactional);
+    servants = getServants(evictor, count);
+    testObjectNotExist(servants[0]);
+    testObjectNotExist(servants[0]->ice_facet("facet2"));
+    for(i = 1; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+        test(Test::FacetPrx::uncheckedCast(servants[i], "facet1")->getData() == (i == 1 ? "newData" : "data"));
+        testFacetNotExist(servants[i]->ice_facet("facet3"));
+    }
+
+    servants[2]->destroy();
+    testFacetNotExist(servants[2]);
+    servants[2]->ice_facet("facet1")->ice_ping();
+
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    for(i = 0; i < count; i++)
+    {
+        testObjectNotExist(servants[i]);
+        testObjectNotExist(servants[i]->ice_facet("facet1"));
+    }
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+colocatedFacetTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing colocated facets with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 5;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->addFacet("facet1", "data");
+        Test::FacetPrx facet1 = Test::FacetPrx::uncheckedCast(servants[i], "facet1");
+        facet1->setValue(10 * i);
+        facet1->addFacet("facet2", "moreData");
+        Test::FacetPrx::uncheckedCast(servants[i], "facet2")->setValue(100 * i);
+    }
+    servants[0]->removeFacet("facet1");
+    servants[1]->destroy();
+
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count);
+    test(evictor->preloadFacets(servantId(0)) == 2);
+    test(evictor->preloadFacets(servantId(1)) == 2);
+    test(evictor->preloadFacets(servantId(2)) == 3);
+    test(evictor->preloadFacets(servantId(count)) == 0);
+
+    //
+    // Same once reopened
+    //
+    evictor->deactivate();
+    evictor = factory->createEvictor(name, transactional);
+    servants = getServants(evictor, count);
+    test(evictor->preloadFacets(servantId(0)) == 2);
+    test(evictor->preloadFacets(servantId(1)) == 2);
+    for(i = 0; i < count; i++)
+    {
+        Test::FacetPrx facet1 = Test::FacetPrx::uncheckedCast(servants[i], "facet1");
+        Test::FacetPrx facet2 = Test::FacetPrx::uncheckedCast(servants[i], "facet2");
+        if(i == 0)
+        {
+            testFacetNotExist(facet1);
+        }
+        else
+        {
+            test(facet1->getValue() == 10 * i);
+            test(facet1->getData() == "data");
+        }
+        if(i == 1)
+        {
+            testFacetNotExist(servants[i]);
+        }
+        else
+        {
+            test(servants[i]->getValue() == i);
+            test(evictor->preloadFacets(servantId(i)) == (i == 0 ? 2 : 3));
+        }
+        test(facet2->getValue() == 100 * i);
+    }
+
+    //
+    // An evictor can't open a file with facets stored the other way
+    //
+    evictor->deactivate();
+    string property = "Freeze.Evictor.db." + name + ".ColocateFacets";
+    factory->setProperty(property, "0");
+    try
+    {
+        factory->createEvictor(name, transactional);
+        test(false);
+    }
+    catch(const Ice::UnknownException&)
+    {
+        // Expected
+    }
+    factory->setProperty(property, "1");
+
+    evictor = factory->createEvictor(name, transactional);
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    evictor->destroyAllServants("facet2");
+    evictor->deactivate();
+
+    factory->setProperty("Freeze.Evictor.db.Test.ColocateFacets", "1");
+    try
+    {
+        factory->createEvictor("Test", transactional);
+        test(false);
+    }
+    catch(const Ice::UnknownException&)
+    {
+        // Expected
+    }
+    factory->setProperty("Freeze.Evictor.db.Test.ColocateFacets", "");
+
+    cout << "ok" << endl;
+}
+
+void
+loadTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing concurrent loads with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 50;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    //
+    // With a small cache, most calls load their object, with more
+    // concurrent loads than load threads and queued loads
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(5);
+
+    {
+        const int threadCount = 10;
+        vector<ThreadPtr> threads(threadCount);
+        for(i = 0; i < threadCount; i++)
+        {
+            threads[i] = new GetValueThread(servants);
+            threads[i]->start();
+        }
+        for(i = 0; i < threadCount; i++)
+        {
+            threads[i]->getThreadControl().join();
+        }
+    }
+
+    evictor->setSize(0);
+    evictor->setSize(5);
+    {
+        vector<Ice::AsyncResultPtr> results;
+        for(i = 0; i < count; i++)
+        {
+            results.push_back(servants[i]->begin_getValue());
+        }
+        for(i = 0; i < count; i++)
+        {
+            test(servants[i]->end_getValue(results[i]) == i);
+        }
+    }
+
+    //
+    // Missing objects and objects modified while others are loaded
+    //
+    for(i = 0; i < count; i++)
+    {
+        testObjectNotExist(evictor->getServant(servantId(count + i)));
+        servants[i]->setValue(i + 100);
+    }
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(5);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 100);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+prefetchTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing prefetch with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 20;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, transactional);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    Test::StringSeq ids;
+    Test::StringSeq facetIds;
+    for(i = 0; i < count; i++)
+    {
+        ids.push_back(servantId(i));
+        if(i % 2 == 0)
+        {
+            servants[i]->addFacet("facet1", "data");
+            Test::FacetPrx::uncheckedCast(servants[i], "facet1")->setValue(10 * i);
+            facetIds.push_back(servantId(i));
+        }
+    }
+
+    //
+    // Prefetch objects that are cached, not cached or missing
+    //
+    ids.push_back(servantId(count));
+    evictor->prefetch(ids, "");
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count * 2);
+    evictor->prefetch(ids, "");
+    evictor->prefetch(facetIds, "facet1");
+    evictor->prefetch(ids, "facet1");
+    evictor->prefetch(ids, "facet2");
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+        if(i % 2 == 0)
+        {
+            test(Test::FacetPrx::uncheckedCast(servants[i], "facet1")->getValue() == 10 * i);
+        }
+    }
+    testObjectNotExist(evictor->getServant(servantId(count)));
+
+    //
+    // Prefetched objects are then modified and destroyed like any other
+    //
+    evictor->setSize(0);
+    evictor->setSize(count * 2);
+    evictor->prefetch(ids, "");
+    servants[0]->destroy();
+    testObjectNotExist(servants[0]);
+    evictor->prefetch(ids, "");
+    testObjectNotExist(servants[0]);
+    for(i = 1; i < count; i++)
+    {
+        servants[i]->setValue(i + 100);
+    }
+
+    evictor->deactivate();
+    evictor = factory->createEvictor(name, transactional);
+    servants = getServants(evictor, count);
+    evictor->prefetch(ids, "");
+    testObjectNotExist(servants[0]);
+    for(i = 1; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 100);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+servantQueryTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing index queries returning servants with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 10;
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createIndexedEvictor(name, transactional);
+    evictor->setSize(count * 2);
+    vector<Test::ServantPrx> servants;
+    for(i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->createServant(servantId(i), i % 5));
+    }
+
+    //
+    // The servants found are those of the cache, loaded when necessary
+    //
+    test(joined(evictor->findFirstServants(2, count)) == "2 7");
+    test(evictor->findFirstServants(2, 1).size() == 1);
+    test(evictor->findFirstServants(5, count).empty());
+    if(!transactional)
+    {
+        test(servants[2]->getTransientValue() == 1002);
+        test(servants[7]->getTransientValue() == 1002);
+    }
+
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(count * 2);
+    test(joined(evictor->findFirstServants(3, count)) == "3 8");
+    if(!transactional)
+    {
+        test(servants[3]->getTransientValue() == 1003);
+        test(servants[8]->getTransientValue() == 1003);
+    }
+
+    servants[3]->setValue(9);
+    test(joined(evictor->findFirstServants(3, count)) == "8");
+    test(joined(evictor->findFirstServants(9, count)) == "3");
+    servants[8]->destroy();
+    test(evictor->findFirstServants(3, count).empty());
+
+    evictor->destroyAllServants("");
+    test(evictor->findFirstServants(4, count).empty());
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+rangeQueryTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing range and prefix queries with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 20;
+    Ice::Int i;
+
+    //
+    // The value of each object is twice its name, and the data of its
+    // facet its name after "a" when even and "b" when odd
+    //
+    Test::RemoteEvictorPrx evictor = factory->createIndexedEvictor(name, transactional);
+    vector<Test::ServantPrx> servants;
+    for(i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->createServant(servantId(i), 2 * i));
+        servants[i]->addFacet("facet1", (i % 2 == 0 ? "a" : "b") + servantId(i));
+    }
+
+    for(int loop = 0; loop < 2; ++loop)
+    {
+        test(joined(evictor->findRange(10, 20, 3), false) == "5 6 7 8 9");
+        test(joined(evictor->findRange(10, 19, 100), false) == "5 6 7 8 9");
+        test(joined(evictor->findRange(0, 2 * count, 7), false) ==
+             "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19");
+        test(evictor->findRange(11, 12, 3).empty());
+        test(evictor->findRange(20, 10, 3).empty());
+
+        test(joined(evictor->findDataPrefix("a1", 2), false) == "10 12 14 16 18");
+        test(joined(evictor->findDataPrefix("a", 3), false) == "0 10 12 14 16 18 2 4 6 8");
+        test(evictor->findDataPrefix("", 6).size() == static_cast<size_t>(count));
+        test(evictor->findDataPrefix("c", 3).empty());
+
+        //
+        // Same once saved
+        //
+        evictor->deactivate();
+        evictor = factory->createIndexedEvictor(name, transactional);
+        servants = getServants(evictor, count);
+    }
+
+    //
+    // Objects modified or destroyed in a range
+    //
+    servants[5]->setValue(100);
+    test(joined(evictor->findRange(10, 20, 3), false) == "6 7 8 9");
+    test(joined(evictor->findRange(100, 101, 3), false) == "5");
+    servants[6]->destroy();
+    test(joined(evictor->findRange(10, 20, 2), false) == "7 8 9");
+    servants[6] = evictor->createServant(servantId(6), 11);
+    test(joined(evictor->findRange(10, 20, 2), false) == "6 7 8 9");
+
+    Test::FacetPrx::uncheckedCast(servants[12], "facet1")->setData("c12");
+    test(joined(evictor->findDataPrefix("a1", 2), false) == "10 14 16 18");
+    test(joined(evictor->findDataPrefix("c", 3), false) == "12");
+    servants[14]->removeFacet("facet1");
+    test(joined(evictor->findDataPrefix("a1", 1), false) == "10 16 18");
+
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    test(evictor->findRange(0, 2 * count, 3).empty());
+    test(evictor->findDataPrefix("", 3).empty());
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+indexIteratorTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing index iterators with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 20;
+    const Ice::Int batchSizes[] = { 1, 3, 100 };
+    Ice::Int i;
+
+    //
+    // The value of each object is twice the quotient of its name by 4
+    //
+    Test::RemoteEvictorPrx evictor = factory->createIndexedEvictor(name, transactional);
+    vector<Test::ServantPrx> servants;
+    for(i = 0; i < count; i++)
+    {
+        servants.push_back(evictor->createServant(servantId(i), 2 * (i / 4)));
+    }
+
+    for(int loop = 0; loop < 3; ++loop)
+    {
+        for(size_t j = 0; j < sizeof(batchSizes) / sizeof(batchSizes[0]); ++j)
+        {
+            Ice::Int batchSize = batchSizes[j];
+            if(loop < 2)
+            {
+                test(joined(evictor->iterateByValue(2, batchSize)) == "4 5 6 7");
+                test(evictor->iterateByValue(3, batchSize).empty());
+                test(joined(evictor->iterateRange(2, 6, batchSize)) == "10 11 4 5 6 7 8 9");
+                test(evictor->iterateRange(0, 100, batchSize).size() == static_cast<size_t>(count));
+                test(evictor->iterateRange(3, 4, batchSize).empty());
+            }
+            else
+            {
+                test(joined(evictor->iterateByValue(2, batchSize)) == "4 6 7");
+                test(joined(evictor->iterateByValue(3, batchSize)) == "5");
+                test(joined(evictor->iterateRange(2, 6, batchSize)) == "10 11 19 4 5 6 7 8");
+                test(evictor->iterateRange(0, 100, batchSize).size() == static_cast<size_t>(count - 1));
+            }
+
+            //
+            // The range iterator returns the objects in key order
+            //
+            Test::StringSeq names = evictor->iterateRange(0, 100, batchSize);
+            Ice::Int previous = -1;
+            for(Test::StringSeq::const_iterator p = names.begin(); p != names.end(); ++p)
+            {
+                Ice::Int value = evictor->getServant(*p)->getValue();
+                test(value >= previous);
+                previous = value;
+            }
+        }
+
+        if(loop == 0)
+        {
+            evictor->deactivate();
+            evictor = factory->createIndexedEvictor(name, transactional);
+            servants = getServants(evictor, count);
+        }
+        else if(loop == 1)
+        {
+            servants[5]->setValue(3);
+            servants[9]->destroy();
+            servants[19]->setValue(4);
+        }
+    }
+
+    evictor->destroyAllServants("");
+    test(evictor->iterateRange(0, 100, 3).empty());
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+multipleIndexTests(const Ice::CommunicatorPtr& communicator, const string& name, bool transactional)
+{
+    cout << "testing several indices of the same facet with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    const Ice::Int count = 10;
+    Ice::Int i;
+
+    //
+    // The facet1 facets are indexed both by value and by data
+    //
+    Test::RemoteEvictorPrx evictor = factory->createIndexedEvictor(name, transactional);
+    vector<Test::FacetPrx> facets;
+    for(i = 0; i < count; i++)
+    {
+        Test::ServantPrx servant = evictor->createServant(servantId(i), i);
+        servant->addFacet("facet1", "d" + servantId(i));
+        facets.push_back(Test::FacetPrx::uncheckedCast(servant, "facet1"));
+    }
+    for(i = 0; i < count; i++)
+    {
+        test(joined(evictor->findFacetByValue(i)) == servantId(i));
+        test(joined(evictor->findDataPrefix("d" + servantId(i), 3)) == servantId(i));
+    }
+
+    facets[1]->setValue(100);
+    facets[2]->setData("e2");
+    facets[3]->setValue(100);
+    facets[3]->setData("e3");
+    test(joined(evictor->findFacetByValue(100)) == "1 3");
+    test(evictor->findFacetByValue(1).empty());
+    test(joined(evictor->findDataPrefix("d1", 3)) == "1");
+    test(joined(evictor->findFacetByValue(2)) == "2");
+    test(joined(evictor->findDataPrefix("e", 3)) == "2 3");
+    test(evictor->findDataPrefix("d3", 3).empty());
+
+    evictor->getServant(servantId(4))->removeFacet("facet1");
+    test(evictor->findFacetByValue(4).empty());
+    test(evictor->findDataPrefix("d4", 3).empty());
+    evictor->getServant(servantId(4))->addFacet("facet1", "e4");
+    test(joined(evictor->findFacetByValue(4)) == "4");
+    test(joined(evictor->findDataPrefix("e", 3)) == "2 3 4");
+
+    //
+    // Same once saved
+    //
+    evictor->deactivate();
+    evictor = factory->createIndexedEvictor(name, transactional);
+    test(joined(evictor->findFacetByValue(100)) == "1 3");
+    test(joined(evictor->findDataPrefix("d", 3)) == "0 1 5 6 7 8 9");
+    test(joined(evictor->findDataPrefix("e", 3)) == "2 3 4");
+    for(i = 5; i < count; i++)
+    {
+        test(joined(evictor->findFacetByValue(i)) == servantId(i));
+    }
+
+    evictor->destroyAllServants("");
+    evictor->destroyAllServants("facet1");
+    test(evictor->findFacetByValue(100).empty());
+    test(evictor->findDataPrefix("", 3).empty());
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+transactionalCacheTests(const Ice::CommunicatorPtr& communicator, const string& name)
+{
+    cout << "testing reads after commits with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 10;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    //
+    // Each read follows a committed write, rollback or eviction
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, true);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+        servants[i]->setValue(i + 100);
+        test(servants[i]->getValue() == i + 100);
+        servants[i]->setValue(i + 200);
+        servants[i]->setValue(i + 300);
+        test(servants[i]->getValue() == i + 300);
+    }
+    evictor->setSize(0);
+    evictor->setSize(count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i + 300);
+        servants[i]->setValue(i);
+        test(servants[i]->getValue() == i);
+    }
+
+    //
+    // A rolled back transfer leaves both balances unchanged
+    //
+    test(servants[0]->getTotalBalance() == 0);
+    Test::AccountPrxSeq accounts = servants[0]->getAccounts();
+    test(accounts.size() == 10);
+    test(servants[0]->getTotalBalance() == 10000);
+    for(i = 0; i < static_cast<Ice::Int>(accounts.size()); i++)
+    {
+        test(accounts[i]->getBalance() == 1000);
+    }
+
+    try
+    {
+        accounts[0]->transfer(2000, accounts[1]);
+        test(false);
+    }
+    catch(const Test::InsufficientFundsException&)
+    {
+        // Expected
+    }
+    test(accounts[0]->getBalance() == 1000);
+    test(accounts[1]->getBalance() == 1000);
+
+    accounts[0]->transfer(100, accounts[1]);
+    test(accounts[0]->getBalance() == 900);
+    test(accounts[1]->getBalance() == 1100);
+    accounts[1]->transfer2(100, accounts[0]);
+    test(accounts[0]->getBalance() == 1000);
+    test(accounts[1]->getBalance() == 1000);
+
+    try
+    {
+        accounts[2]->transfer4(2000, accounts[3]);
+        test(false);
+    }
+    catch(const Test::InsufficientFundsException&)
+    {
+        // Expected
+    }
+    accounts[2]->transfer4(100, accounts[3]);
+    test(accounts[2]->getBalance() == 900);
+    test(accounts[3]->getBalance() == 1100);
+
+    {
+        const int threadCount = static_cast<int>(accounts.size());
+        vector<ThreadPtr> threads(threadCount);
+        for(i = 0; i < threadCount; i++)
+        {
+            threads[i] = new TransferThread(accounts);
+            threads[i]->start();
+        }
+        for(i = 0; i < threadCount; i++)
+        {
+            threads[i]->getThreadControl().join();
+        }
+    }
+    test(servants[0]->getTotalBalance() == 10000);
+
+    //
+    // The balances read from the cache are the balances saved
+    //
+    vector<Ice::Int> balances;
+    for(i = 0; i < static_cast<Ice::Int>(accounts.size()); i++)
+    {
+        balances.push_back(accounts[i]->getBalance());
+    }
+    evictor->deactivate();
+    evictor = factory->createEvictor(name, true);
+    Ice::Int total = 0;
+    for(i = 0; i < static_cast<Ice::Int>(accounts.size()); i++)
+    {
+        test(accounts[i]->getBalance() == balances[i]);
+        total += balances[i];
+    }
+    test(total == 10000);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+snapshotTests(const Ice::CommunicatorPtr& communicator, const string& name, bool snapshot)
+{
+    cout << "testing updates within read-only transactions with " << name << " evictor... " << flush;
+
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, true);
+    Test::ServantPrx servant = evictor->createServant("0", 0);
+    Test::AccountPrxSeq accounts = servant->getAccounts();
+    test(accounts.size() == 10);
+
+    //
+    // A snapshot transaction rejects updates, which could rely on values
+    // changed since it started
+    //
+    try
+    {
+        accounts[0]->depositFromReader(100, accounts[1]);
+        test(!snapshot);
+        test(accounts[1]->getBalance() == 1100);
+    }
+    catch(const Ice::UnknownException&)
+    {
+        test(snapshot);
+        test(accounts[1]->getBalance() == 1000);
+    }
+    test(accounts[0]->getBalance() == 1000);
+
+    accounts[2]->transfer(100, accounts[3]);
+    test(accounts[2]->getBalance() == 900);
+    test(accounts[3]->getBalance() == 1100);
+    test(servant->getTotalBalance() == (snapshot ? 10000 : 10100));
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+bytesTests(const Ice::CommunicatorPtr& communicator)
+{
+    cout << "testing eviction by bytes... " << flush;
+
+    const Ice::Int count = 20;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    //
+    // Facets of about 1KB each, with a budget of 10KB and room for 1000
+    // objects
+    //
+    Test::RemoteEvictorPrx evictor = factory->createEvictor("Bytes", false);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    vector<Test::FacetPrx> facets;
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->addFacet("facet1", string(1000, 'x'));
+        facets.push_back(Test::FacetPrx::uncheckedCast(servants[i], "facet1"));
+    }
+    evictor->deactivate();
+
+    evictor = factory->createEvictor("Bytes", false);
+    evictor->setSize(1000);
+    test(evictor->getLoadCount() == 0);
+
+    //
+    // 20KB don't fit: reading them in a loop reloads them
+    //
+    for(i = 0; i < count; i++)
+    {
+        test(facets[i]->getData().size() == 1000);
+    }
+    Ice::Int loadCount = evictor->getLoadCount();
+    test(loadCount >= count);
+    for(i = 0; i < count; i++)
+    {
+        test(facets[i]->getData().size() == 1000);
+    }
+    test(evictor->getLoadCount() >= loadCount + count / 2);
+
+    //
+    // 5KB fit
+    //
+    for(i = 0; i < 5; i++)
+    {
+        test(facets[i]->getData().size() == 1000);
+    }
+    loadCount = evictor->getLoadCount();
+    for(i = 0; i < 5; i++)
+    {
+        test(facets[i]->getData().size() == 1000);
+    }
+    test(evictor->getLoadCount() == loadCount);
+
+    evictor->destroyAllServants("facet1");
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+pinnedEvictionTests(const Ice::CommunicatorPtr& communicator, const string& name)
+{
+    cout << "testing eviction of kept and busy objects with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 10;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, false);
+    evictor->setSize(2);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    for(i = 0; i < count; i++)
+    {
+        servants[i]->setTransientValue(i);
+    }
+
+    //
+    // Servant 0 is kept in the cache, and servant 1 is busy with a
+    // pending setValueAsync
+    //
+    servants[0]->keepInCache();
+    Ice::AsyncResultPtr result = servants[1]->begin_setValueAsync(100);
+    test(servants[1]->getValue() == 1);
+    evictor->saveNow();
+
+    //
+    // Scan the other servants several times with a cache of 2 objects
+    //
+    evictor->setSize(0);
+    evictor->setSize(2);
+    for(Ice::Int j = 0; j < 3; j++)
+    {
+        for(i = 2; i < count; i++)
+        {
+            test(servants[i]->getValue() == i);
+        }
+    }
+    test(servants[0]->getTransientValue() == 0);
+    test(servants[1]->getTransientValue() == 1);
+    for(i = 2; i < count; i++)
+    {
+        test(servants[i]->getTransientValue() == -1);
+    }
+
+    //
+    // Once released, they are evicted like the others
+    //
+    servants[1]->releaseAsync();
+    servants[1]->end_setValueAsync(result);
+    servants[0]->release();
+    evictor->saveNow();
+    evictor->setSize(0);
+    evictor->setSize(2);
+    test(servants[0]->getTransientValue() == -1);
+    test(servants[1]->getTransientValue() == -1);
+    test(servants[1]->getValue() == 100);
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+void
+segmentTests(const Ice::CommunicatorPtr& communicator, const string& name)
+{
+    cout << "testing evictor segments with " << name << " evictor... " << flush;
+
+    const Ice::Int count = 20;
+    Test::RemoteEvictorFactoryPrx factory = getFactory(communicator);
+    Ice::Int i;
+
+    Test::RemoteEvictorPrx evictor = factory->createEvictor(name, false);
+    vector<Test::ServantPrx> servants = createServants(evictor, count);
+    evictor->deactivate();
+
+    //
+    // All the objects fit in the share of each segment
+    //
+    evictor = factory->createEvictor(name, false);
+    evictor->setSize(100);
+    for(Ice::Int j = 0; j < 2; j++)
+    {
+        for(i = 0; i < count; i++)
+        {
+            test(servants[i]->getValue() == i);
+        }
+    }
+    test(evictor->getLoadCount() == count);
+
+    //
+    // Fewer objects than segments: at most one object per segment stays
+    // in the cache
+    //
+    evictor->setSize(2);
+    Ice::Int loadCount = evictor->getLoadCount();
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+    test(evictor->getLoadCount() >= loadCount + count - 2);
+
+    evictor->setSize(0);
+    loadCount = evictor->getLoadCount();
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+    test(evictor->getLoadCount() == loadCount + count);
+
+    //
+    // And back, with room for all the objects in each segment
+    //
+    evictor->setSize(4 * count);
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+    loadCount = evictor->getLoadCount();
+    for(i = 0; i < count; i++)
+    {
+        test(servants[i]->getValue() == i);
+    }
+    test(evictor->getLoadCount() == loadCount);
+
+    evictor->destroyAllServants("");
+    evictor->deactivate();
+
+    cout << "ok" << endl;
+}
+
+class Client : public Test::TestHelper
+{
+public:
+
+    void run(int, char**);
+};
+
+void
+Client::run(int argc, char** argv)
+{
+    Ice::CommunicatorHolder ich = initialize(argc, argv);
+    allTests(communicator(), "Test", false, false);
+    pipelineTests(communicator());
+    adaptiveSaveTests(communicator());
+    unchangedSaveTests(communicator());
+    backpressureTests(communicator());
+    snapshotStreamingTests(communicator());
+    queryTests(communicator(), "Query", false);
+    queryTests(communicator(), "StrictQuery", false);
+    queryTests(communicator(), "TxQuery", true);
+    missingObjectTests(communicator(), "Filter", false);
+    missingObjectTests(communicator(), "TxFilter", true);
+    facetDirectoryTests(communicator(), "Test", false);
+    facetDirectoryTests(communicator(), "Directory", false);
+    facetDirectoryTests(communicator(), "TxDirectory", true);
+    colocatedFacetTests(communicator(), "Colocated", false);
+    colocatedFacetTests(communicator(), "TxColocated", true);
+    loadTests(communicator(), "Load", false);
+    loadTests(communicator(), "TxLoad", true);
+    prefetchTests(communicator(), "Test", false);
+    prefetchTests(communicator(), "Load", false);
+    prefetchTests(communicator(), "TxLoad", true);
+    servantQueryTests(communicator(), "Query", false);
+    servantQueryTests(communicator(), "StrictQuery", false);
+    servantQueryTests(communicator(), "TxQuery", true);
+    rangeQueryTests(communicator(), "Query", false);
+    rangeQueryTests(communicator(), "StrictQuery", false);
+    rangeQueryTests(communicator(), "TxQuery", true);
+    indexIteratorTests(communicator(), "Query", false);
+    indexIteratorTests(communicator(), "StrictQuery", false);
+    indexIteratorTests(communicator(), "TxQuery", true);
+    multipleIndexTests(communicator(), "Query", false);
+    multipleIndexTests(communicator(), "StrictQuery", false);
+    multipleIndexTests(communicator(), "TxQuery", true);
+    transactionalCacheTests(communicator(), "Test");
+    transactionalCacheTests(communicator(), "TxUpdateCache");
+    transactionalCacheTests(communicator(), "TxReuse");
+    transactionalCacheTests(communicator(), "TxReuseUpdateCache");
+    transactionalCacheTests(communicator(), "TxReadLock");
+    transactionalCacheTests(communicator(), "TxSnapshot");
+    snapshotTests(communicator(), "Test", false);
+    snapshotTests(communicator(), "TxSnapshot", true);
+    bytesTests(communicator());
+    pinnedEvictionTests(communicator(), "Test");
+    const char* policies[] = { "Clock", "TwoQ", "Arc" };
+    for(size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i)
+    {
+        allTests(communicator(), policies[i], false, false);
+        allTests(communicator(), policies[i], true, false);
+        pinnedEvictionTests(communicator(), policies[i]);
+    }
+    allTests(communicator(), "Segments", false, false);
+    allTests(communicator(), "Segments", true, false);
+    pinnedEvictionTests(communicator(), "Segments");
+    segmentTests(communicator(), "Segments");
+    allTests(communicator(), "Test", true, true);
 }
 
 DEFINE_TEST(Client)
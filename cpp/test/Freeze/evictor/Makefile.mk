@@ -0,0 +1,21 @@
+# **********************************************************************
+#
+# Copyright (c) 2003-2018 ZeroC, Inc. All rights reserved.
+#
+# **********************************************************************
+
+$(test)_server_slice2freeze     := ValueIndex DataIndex FacetValueIndex
+
+$(test)_server_ValueIndex       := --index "Test::ValueIndex,Test::Servant,value,sort"
+$(test)_server_ValueIndex_slice := $(test)/Test.ice
+$(test)_server_ValueIndex_flags := -I$(ice_slicedir)
+
+$(test)_server_DataIndex        := --index "Test::DataIndex,Test::Facet,data,sort"
+$(test)_server_DataIndex_slice  := $(test)/Test.ice
+$(test)_server_DataIndex_flags  := -I$(ice_slicedir)
+
+$(test)_server_FacetValueIndex          := --index "Test::FacetValueIndex,Test::Facet,value"
+$(test)_server_FacetValueIndex_slice    := $(test)/Test.ice
+$(test)_server_FacetValueIndex_flags    := -I$(ice_slicedir)
+
+tests += $(test)
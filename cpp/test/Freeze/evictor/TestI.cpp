@@ -176,6 +176,28 @@ Test::AccountI::transfer3_async(const AMD_Account_transfer3Ptr& cb, int amount,
     thread->response();
 }
 
+void
+Test::AccountI::transfer4(int amount, const Test::AccountPrx& toAccount, const Current& current)
+{
+    test(_evictor->getCurrentTransaction() != 0);
+
+    Ice::IdentitySeq ids;
+    ids.push_back(current.id);
+    ids.push_back(toAccount->ice_getIdentity());
+    Freeze::lockForUpdate(_evictor, ids);
+
+    toAccount->deposit(amount); // collocated call
+    deposit(-amount, current); // direct call
+}
+
+void
+Test::AccountI::depositFromReader(int amount, const Test::AccountPrx& toAccount, const Current&)
+{
+    test(_evictor->getCurrentTransaction() != 0);
+
+    toAccount->deposit(amount); // collocated call
+}
+
 Test::AccountI::AccountI(int initialBalance, const Freeze::TransactionalEvictorPtr& evictor) :
     Account(initialBalance),
     _evictor(evictor)
@@ -440,6 +462,14 @@ Test::ServantI::destroy(const Current& current)
     }
 }
 
+Ice::ObjectPtr
+Test::ServantI::ice_snapshot() const
+{
+    ServantPtr snapshot = new ServantI(_remoteEvictor, _evictor, value);
+    snapshot->accounts = accounts;
+    return snapshot;
+}
+
 Test::FacetI::FacetI()
 {
 }
@@ -465,6 +495,14 @@ Test::FacetI::setData(const string& d, const Current&)
     data = d;
 }
 
+Ice::ObjectPtr
+Test::FacetI::ice_snapshot() const
+{
+    FacetPtr snapshot = new FacetI(_remoteEvictor, _evictor, value, data);
+    snapshot->accounts = accounts;
+    return snapshot;
+}
+
 class Initializer : public Freeze::ServantInitializer
 {
 public:
@@ -478,6 +516,8 @@ public:
     virtual void
     initialize(const ObjectAdapterPtr&, const Identity&, const string&, const ObjectPtr& servant)
     {
+        _remoteEvictor->servantLoaded();
+
         Test::ServantI* servantI = dynamic_cast<Test::ServantI*>(servant.get());
         if(servantI != 0)
         {
@@ -498,21 +538,42 @@ private:
 };
 
 Test::RemoteEvictorI::RemoteEvictorI(const CommunicatorPtr& communicator, const string& envName,
-                                     const string& category, bool transactional) :
+                                     const string& category, bool transactional, bool indexed) :
     _envName(envName),
-    _category(category)
+    _category(category),
+    _loadCount(0)
 {
     _evictorAdapter = communicator->createObjectAdapterWithEndpoints(Ice::generateUUID(), "default");
 
     Initializer* initializer = new Initializer;
 
-    if(transactional)
+    vector<Freeze::IndexPtr> indices;
+    if(indexed)
     {
-        _evictor = Freeze::createTransactionalEvictor(_evictorAdapter, envName, category, Freeze::FacetTypeMap(), initializer);
+        _valueIndex = new Test::ValueIndex("value");
+        indices.push_back(_valueIndex);
+        _dataIndex = new Test::DataIndex("data", "facet1");
+        indices.push_back(_dataIndex);
+        _facetValueIndex = new Test::FacetValueIndex("facetValue", "facet1");
+        indices.push_back(_facetValueIndex);
     }
-    else
+
+    try
     {
-        _evictor = Freeze::createBackgroundSaveEvictor(_evictorAdapter, envName, category, initializer);
+        if(transactional)
+        {
+            _evictor = Freeze::createTransactionalEvictor(_evictorAdapter, envName, category, Freeze::FacetTypeMap(),
+                                                          initializer, indices);
+        }
+        else
+        {
+            _evictor = Freeze::createBackgroundSaveEvictor(_evictorAdapter, envName, category, initializer, indices);
+        }
+    }
+    catch(...)
+    {
+        _evictorAdapter->destroy();
+        throw;
     }
 
     //
@@ -574,6 +635,193 @@ Test::RemoteEvictorI::saveNow(const Current&)
     _evictor->getIterator("", 1);
 }
 
+Int
+Test::RemoteEvictorI::getLoadCount(const Current&)
+{
+    IceUtil::Mutex::Lock sync(_loadCountMutex);
+    return _loadCount;
+}
+
+void
+Test::RemoteEvictorI::servantLoaded()
+{
+    IceUtil::Mutex::Lock sync(_loadCountMutex);
+    ++_loadCount;
+}
+
+Test::SaveStatus
+Test::RemoteEvictorI::getSaveStatus(const Current&)
+{
+    Freeze::BackgroundSaveStatus status =
+        Freeze::getBackgroundSaveStatus(Freeze::BackgroundSaveEvictorPtr::dynamicCast(_evictor));
+
+    Test::SaveStatus result;
+    result.adaptive = status.adaptive;
+    result.saveSizeTrigger = status.saveSizeTrigger;
+    result.savePeriod = status.savePeriod;
+    result.maxTxSize = status.maxTxSize;
+    result.unsavedObjects = status.unsavedObjects;
+    result.heldBackCalls = status.heldBackCalls;
+    return result;
+}
+
+Int
+Test::RemoteEvictorI::preloadFacets(const string& id, const Current&)
+{
+    Identity ident;
+    ident.category = _category;
+    ident.name = id;
+    return Freeze::preloadFacets(_evictor, ident);
+}
+
+void
+Test::RemoteEvictorI::prefetch(const Test::StringSeq& ids, const string& facet, const Current&)
+{
+    Ice::IdentitySeq idents;
+    for(Test::StringSeq::const_iterator p = ids.begin(); p != ids.end(); ++p)
+    {
+        Identity ident;
+        ident.category = _category;
+        ident.name = *p;
+        idents.push_back(ident);
+    }
+    Freeze::prefetch(_evictor, idents, facet);
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::findByValue(Int value, const Current&)
+{
+    test(_valueIndex);
+    vector<Identity> idents = _valueIndex->find(value);
+
+    Test::StringSeq names;
+    for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+    {
+        names.push_back(p->name);
+    }
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::findFirstServants(Int value, Int firstN, const Current&)
+{
+    test(_valueIndex);
+    vector<Freeze::IndexMatch> matches = _valueIndex->findFirstServants(value, firstN);
+
+    Test::StringSeq names;
+    for(vector<Freeze::IndexMatch>::const_iterator p = matches.begin(); p != matches.end(); ++p)
+    {
+        ServantIPtr servant = ServantIPtr::dynamicCast(p->servant);
+        test(servant);
+        test(servant->getValue() == value);
+        servant->setTransientValue(1000 + value);
+        names.push_back(p->ident.name);
+    }
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::findFacetByValue(Int value, const Current&)
+{
+    test(_facetValueIndex);
+    vector<Identity> idents = _facetValueIndex->find(value);
+
+    Test::StringSeq names;
+    for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+    {
+        names.push_back(p->name);
+    }
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::findRange(Int lower, Int upper, Int pageSize, const Current&)
+{
+    test(_valueIndex);
+
+    Test::StringSeq names;
+    Freeze::IndexPosition position;
+    do
+    {
+        vector<Identity> idents = _valueIndex->findRange(lower, upper, pageSize, position);
+        test(static_cast<Int>(idents.size()) <= pageSize);
+        for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+        {
+            names.push_back(p->name);
+        }
+    }
+    while(!position.key.empty());
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::findDataPrefix(const string& prefix, Int pageSize, const Current&)
+{
+    test(_dataIndex);
+
+    Test::StringSeq names;
+    Freeze::IndexPosition position;
+    do
+    {
+        vector<Identity> idents = _dataIndex->findPrefix(prefix, pageSize, position);
+        test(static_cast<Int>(idents.size()) <= pageSize);
+        for(vector<Identity>::const_iterator p = idents.begin(); p != idents.end(); ++p)
+        {
+            names.push_back(p->name);
+        }
+    }
+    while(!position.key.empty());
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::iterateByValue(Int value, Int batchSize, const Current&)
+{
+    test(_valueIndex);
+
+    Test::StringSeq names;
+    Freeze::EvictorIteratorPtr p = _valueIndex->getIterator(value, batchSize);
+    while(p->hasNext())
+    {
+        names.push_back(p->next().name);
+    }
+    return names;
+}
+
+Test::StringSeq
+Test::RemoteEvictorI::iterateRange(Int lower, Int upper, Int batchSize, const Current&)
+{
+    test(_valueIndex);
+
+    Test::StringSeq names;
+    Freeze::EvictorIteratorPtr p = _valueIndex->getRangeIterator(lower, upper, batchSize);
+    while(p->hasNext())
+    {
+        names.push_back(p->next().name);
+    }
+    return names;
+}
+
+Int
+Test::RemoteEvictorI::countByValue(Int value, const Current&)
+{
+    test(_valueIndex);
+    return _valueIndex->count(value);
+}
+
+Int
+Test::RemoteEvictorI::countServants(const Current&)
+{
+    Int count = 0;
+    Freeze::EvictorIteratorPtr p = _evictor->getIterator("", 3);
+    while(p->hasNext())
+    {
+        p->next();
+        ++count;
+    }
+    return count;
+}
+
 void
 Test::RemoteEvictorI::deactivate(const Current& current)
 {
@@ -605,11 +853,26 @@ Test::RemoteEvictorFactoryI::RemoteEvictorFactoryI(const std::string& envName) :
 Test::RemoteEvictorFactoryI::createEvictor(const string& name, bool transactional, const Current& current)
 {
     RemoteEvictorIPtr remoteEvictor =
-        new RemoteEvictorI(current.adapter->getCommunicator(), _envName, name, transactional);
+        new RemoteEvictorI(current.adapter->getCommunicator(), _envName, name, transactional, false);
+    return RemoteEvictorPrx::uncheckedCast(
+        current.adapter->add(remoteEvictor, Ice::stringToIdentity(name)));
+}
+
+::Test::RemoteEvictorPrx
+Test::RemoteEvictorFactoryI::createIndexedEvictor(const string& name, bool transactional, const Current& current)
+{
+    RemoteEvictorIPtr remoteEvictor =
+        new RemoteEvictorI(current.adapter->getCommunicator(), _envName, name, transactional, true);
     return RemoteEvictorPrx::uncheckedCast(
         current.adapter->add(remoteEvictor, Ice::stringToIdentity(name)));
 }
 
+void
+Test::RemoteEvictorFactoryI::setProperty(const string& name, const string& value, const Current& current)
+{
+    current.adapter->getCommunicator()->getProperties()->setProperty(name, value);
+}
+
 void
 Test::RemoteEvictorFactoryI::shutdown(const Current& current)
 {
@@ -10,6 +10,9 @@
 #include <Freeze/Freeze.h>
 #include <IceUtil/IceUtil.h>
 #include <Test.h>
+#include <ValueIndex.h>
+#include <DataIndex.h>
+#include <FacetValueIndex.h>
 
 namespace Test
 {
@@ -34,6 +37,10 @@ public:
 
     virtual void transfer3_async(const AMD_Account_transfer3Ptr&, int, const Test::AccountPrx&, const Ice::Current&);
 
+    virtual void transfer4(int, const Test::AccountPrx&, const Ice::Current&);
+
+    virtual void depositFromReader(int, const Test::AccountPrx&, const Ice::Current&);
+
     AccountI(int, const Freeze::TransactionalEvictorPtr&);
     AccountI();
 
@@ -44,7 +51,8 @@ private:
     Freeze::TransactionalEvictorPtr _evictor;
 };
 
-class ServantI : public virtual Servant, public IceUtil::AbstractMutexI<IceUtil::Monitor<IceUtil::Mutex> >
+class ServantI : public virtual Servant, public Freeze::Snapshot,
+                 public IceUtil::AbstractMutexI<IceUtil::Monitor<IceUtil::Mutex> >
 {
 public:
 
@@ -84,6 +92,8 @@ public:
 
     virtual void destroy(const Ice::Current& = Ice::Current());
 
+    virtual Ice::ObjectPtr ice_snapshot() const;
+
 protected:
 
     Ice::Int _transientValue;
@@ -105,13 +115,14 @@ public:
 
     virtual void setData(const std::string&, const Ice::Current& = Ice::Current());
 
+    virtual Ice::ObjectPtr ice_snapshot() const;
 };
 
 class RemoteEvictorI : virtual public RemoteEvictor
 {
 public:
 
-    RemoteEvictorI(const Ice::CommunicatorPtr&, const std::string&, const std::string&, bool);
+    RemoteEvictorI(const Ice::CommunicatorPtr&, const std::string&, const std::string&, bool, bool);
 
     virtual void setSize(::Ice::Int, const Ice::Current&);
 
@@ -121,6 +132,32 @@ public:
 
     virtual void saveNow(const Ice::Current&);
 
+    virtual ::Test::SaveStatus getSaveStatus(const Ice::Current&);
+
+    virtual ::Ice::Int getLoadCount(const Ice::Current&);
+
+    virtual ::Ice::Int preloadFacets(const std::string&, const Ice::Current&);
+
+    virtual void prefetch(const ::Test::StringSeq&, const std::string&, const Ice::Current&);
+
+    virtual ::Test::StringSeq findByValue(::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq findFirstServants(::Ice::Int, ::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq findFacetByValue(::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq findRange(::Ice::Int, ::Ice::Int, ::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq findDataPrefix(const std::string&, ::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq iterateByValue(::Ice::Int, ::Ice::Int, const Ice::Current&);
+
+    virtual ::Test::StringSeq iterateRange(::Ice::Int, ::Ice::Int, ::Ice::Int, const Ice::Current&);
+
+    virtual ::Ice::Int countByValue(::Ice::Int, const Ice::Current&);
+
+    virtual ::Ice::Int countServants(const Ice::Current&);
+
     virtual void deactivate(const Ice::Current&);
 
     virtual void destroyAllServants(const std::string&, const Ice::Current&);
@@ -131,12 +168,19 @@ public:
         return _envName;
     }
 
+    void servantLoaded();
+
 private:
 
     std::string _envName;
     std::string _category;
+    IceUtil::Mutex _loadCountMutex;
+    Ice::Int _loadCount;
     Freeze::EvictorPtr _evictor;
     Ice::ObjectAdapterPtr _evictorAdapter;
+    Test::ValueIndexPtr _valueIndex;
+    Test::DataIndexPtr _dataIndex;
+    Test::FacetValueIndexPtr _facetValueIndex;
 };
 
 class RemoteEvictorFactoryI : virtual public RemoteEvictorFactory
@@ -147,6 +191,10 @@ public:
 
     virtual ::Test::RemoteEvictorPrx createEvictor(const ::std::string&, bool, const Ice::Current&);
 
+    virtual ::Test::RemoteEvictorPrx createIndexedEvictor(const ::std::string&, bool, const Ice::Current&);
+
+    virtual void setProperty(const ::std::string&, const ::std::string&, const Ice::Current&);
+
     virtual void shutdown(const Ice::Current&);
 
 private:
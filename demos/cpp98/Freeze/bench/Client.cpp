@@ -8,6 +8,7 @@
 #include <Freeze/Freeze.h>
 #include <BenchTypes.h>
 #include <cstdlib>
+#include <algorithm>
 
 using namespace std;
 using namespace Demo;
@@ -140,6 +141,28 @@ private:
     int _current;
 };
 
+//
+// Counts the servants loaded from the database by an evictor
+//
+class LoadCounter : public Freeze::ServantInitializer
+{
+public:
+
+    LoadCounter() :
+        loads(0)
+    {
+    }
+
+    virtual void
+    initialize(const Ice::ObjectAdapterPtr&, const Ice::Identity&, const string&, const Ice::ObjectPtr&)
+    {
+        ++loads;
+    }
+
+    int loads;
+};
+typedef IceUtil::Handle<LoadCounter> LoadCounterPtr;
+
 class TestApp : public Ice::Application
 {
 public:
@@ -177,7 +200,11 @@ private:
 
     void Struct1ObjectMapTest();
 
+    void EvictorScanTest(const string&);
+    bool evictorAccess(const Freeze::EvictorPtr&, const LoadCounterPtr&, int);
+
     const string _envName;
+    Ice::ObjectAdapterPtr _adapter;
     Freeze::ConnectionPtr _connection;
     StopWatch _watch;
     int _repetitions;
@@ -673,6 +700,109 @@ TestApp::IntIntMapReadTest(const string& mapName, T*)
     */
 }
 
+bool
+TestApp::evictorAccess(const Freeze::EvictorPtr& evictor, const LoadCounterPtr& counter, int id)
+{
+    ostringstream os;
+    os << id;
+
+    Ice::Current current;
+    current.adapter = _adapter;
+    current.id.name = os.str();
+    current.id.category = "bench";
+
+    //
+    // Not ice_ping, which locate() answers without pinning the object
+    //
+    current.operation = "ice_id";
+    current.mode = Ice::Nonmutating;
+
+    int loads = counter->loads;
+    Ice::LocalObjectPtr cookie;
+    Ice::ObjectPtr servant = evictor->locate(current, cookie);
+    test(servant != 0);
+    evictor->finished(current, servant, cookie);
+
+    //
+    // Returns true if the servant was in the evictor's cache
+    //
+    return counter->loads == loads;
+}
+
+void
+TestApp::EvictorScanTest(const string& policy)
+{
+    const int objects = 5000;
+    const int hotObjects = 500;
+    const int evictorSize = 1000;
+
+    string filename = "Evictor" + policy;
+    communicator()->getProperties()->setProperty("Freeze.Evictor." + _envName + "." + filename + ".Policy", policy);
+
+    //
+    // Populate the database.
+    //
+    LoadCounterPtr counter = new LoadCounter;
+    Freeze::BackgroundSaveEvictorPtr evictor =
+        Freeze::createBackgroundSaveEvictor(_adapter, _envName, filename, counter);
+    Ice::Identity ident;
+    ident.category = "bench";
+    for(int i = 0; i < objects; ++i)
+    {
+        ostringstream os;
+        os << i;
+        ident.name = os.str();
+        if(!evictor->hasObject(ident))
+        {
+            evictor->add(new Class1(), ident);
+        }
+    }
+    evictor->deactivate("");
+
+    //
+    // Warm up the hot objects, with a new evictor.
+    //
+    counter = new LoadCounter;
+    evictor = Freeze::createBackgroundSaveEvictor(_adapter, _envName, filename, counter);
+    evictor->setSize(evictorSize);
+    for(int n = 0; n < 3; ++n)
+    {
+        for(int i = 0; i < hotObjects; ++i)
+        {
+            evictorAccess(evictor, counter, i);
+        }
+    }
+
+    //
+    // Scan all the objects, while accessing random hot objects.
+    //
+    RandomGenerator gen(0, hotObjects);
+    vector<IceUtil::Time> latencies;
+    int hits = 0;
+    _watch.start();
+    for(int i = 0; i < objects; ++i)
+    {
+        evictorAccess(evictor, counter, i);
+
+        StopWatch watch;
+        watch.start();
+        if(evictorAccess(evictor, counter, gen.next()))
+        {
+            ++hits;
+        }
+        latencies.push_back(watch.stop());
+    }
+    IceUtil::Time total = _watch.stop();
+    evictor->deactivate("");
+
+    sort(latencies.begin(), latencies.end());
+    IceUtil::Time p99 = latencies[latencies.size() * 99 / 100];
+
+    cout << "\t" << policy << ": time for scan of " << objects << " objects: " << total * 1000 << "ms" << endl;
+    cout << "\t" << policy << ": hot objects hit ratio during scan: " << hits * 100 / objects << "%" << endl;
+    cout << "\t" << policy << ": hot objects p99 latency during scan: " << p99 * 1000 << "ms" << endl;
+}
+
 class MyFactory : public Ice::ValueFactory
 {
 public:
@@ -733,6 +863,15 @@ TestApp::run(int argc, char*[])
     cout <<"IntIntMap with index (read test)" << endl;
     IntIntMapReadTest<IndexedIntIntMap>("IndexedIntIntMap");
 
+    _adapter = communicator()->createObjectAdapter("");
+
+    const char* policies[] = { "LRU", "CLOCK", "2Q", "ARC" };
+    for(size_t i = 0; i < sizeof(policies) / sizeof(*policies); ++i)
+    {
+        cout << "Evictor scan with " << policies[i] << " eviction policy" << endl;
+        EvictorScanTest(policies[i]);
+    }
+
     _connection->close();
 
     return EXIT_SUCCESS;
@@ -15,4 +15,15 @@ props = {
     'Ice.Config' : '{testdir}/config'
 }
 
-TestSuite(__name__, [FreezeEvictorTestCase(client=Client(props=props), server=Server(props=props))])
+#
+# With a larger SaveSizeTrigger, the background save evictor streams batches
+# big enough to be split between its stream threads
+#
+parallelProps = dict(props)
+parallelProps['Freeze.Evictor.db.Test.SaveSizeTrigger'] = 100
+
+TestSuite(__name__, [
+    FreezeEvictorTestCase(client=Client(props=props), server=Server(props=props)),
+    FreezeEvictorTestCase(name="client/server with parallel streaming",
+                          client=Client(props=parallelProps), server=Server(props=parallelProps))
+])